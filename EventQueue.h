@@ -1,13 +1,30 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
 #define QUEUE_LENGTH 16
 
+/*
+ * UI, MIDI and anything else hand events to the main loop through this.
+ * Any number of producers, including interrupts, one consumer. Each slot carries a sequence number,
+ * a producer claims the next slot by moving tail_ on with a compare and swap then publishes it by
+ * bumping its sequence, so a producer interrupted half way through never blocks another one, the
+ * consumer just waits at the unpublished slot so nothing comes out of order. Nothing locks or spins
+ * on anyone else. When it's full the event is dropped and counted, high_water_ is the deepest it's been.
+ * queue_length has to be a power of 2.
+ */
 template <size_t queue_length>
 class EventQueue
 {
   public:
 
-    EventQueue() : qhead_(0), qtail_(0), qfull_(false) {}
+    EventQueue() : head_(0), tail_(0), dropped_(0), high_water_(0), clock_(nullptr)
+    {
+      for (size_t i = 0; i < queue_length; i++) {
+	slots_[i].seq = i;
+      }
+    }
     ~EventQueue() {}
 
   enum event {
@@ -31,47 +48,121 @@ class EventQueue
     TOG_RETRIG,
     TOG_GATE,
     TOG_NOTE,
+    TOG_OVERDUB,
+    REC,
+    BOUNCE,
+    SAVE_BOUNCE,
+    LAYER_WAVE,
     NONE
   };
 
   struct event_entry {
     event ev;
     uint8_t id;
+    uint16_t val;   // 14 bit values
+    float f;
+    uint32_t time;  // from the clock when it was pushed, 0 without one
   };
 
+  // stamps every event with clock(), System::GetNow for instance
+  void SetClock(uint32_t (*clock)())
+  {
+    clock_ = clock;
+  }
+
   void push_event(event ev, uint8_t id)
   {
-    if (qfull_) { 
-      //drop it like its hot
-      return;
-    }
-    event_queue_[qtail_].ev = ev;
-    event_queue_[qtail_].id = id;
-    qtail_ = (qtail_ + 1) % queue_length;
-    if (qtail_ == qhead_) {
-      qfull_ = true;
+    event_entry e = {ev, id, 0, 0.0f, 0};
+    push(&e);
+  }
+
+  void push_value(event ev, uint8_t id, uint16_t val)
+  {
+    event_entry e = {ev, id, val, 0.0f, 0};
+    push(&e);
+  }
+
+  void push_float(event ev, uint8_t id, float f)
+  {
+    event_entry e = {ev, id, 0, f, 0};
+    push(&e);
+  }
+
+  // any producer, false (and counted) if it's full
+  bool push(event_entry *e)
+  {
+    slot_t *s;
+    uint32_t seq, depth, high;
+    uint32_t pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+
+    if (clock_ != nullptr) e->time = clock_();
+    for (;;) {
+      s = &slots_[pos & (queue_length - 1)];
+      seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+      if (seq == pos) {
+	// pos is updated with where tail_ has got to if someone else got there first
+	if (__atomic_compare_exchange_n(&tail_, &pos, pos + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+      } else if ((int32_t)(seq - pos) < 0) {
+	//drop it like its hot
+	__atomic_fetch_add(&dropped_, 1, __ATOMIC_RELAXED);
+	return false;
+      } else {
+	pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+      }
     }
+    s->e = *e;
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+
+    depth = pos + 1 - __atomic_load_n(&head_, __ATOMIC_RELAXED);
+    high = __atomic_load_n(&high_water_, __ATOMIC_RELAXED);
+    while ((depth > high) && !__atomic_compare_exchange_n(&high_water_, &high, depth, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return true;
   }
 
+  // consumer only, false if there's nothing (published) yet
+  bool pop(event_entry *e)
+  {
+    slot_t *s = &slots_[head_ & (queue_length - 1)];
+    if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != (head_ + 1)) return false;
+    *e = s->e;
+    __atomic_store_n(&s->seq, head_ + queue_length, __ATOMIC_RELEASE);
+    __atomic_store_n(&head_, head_ + 1, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  // consumer only, NONE if there's nothing
   event_entry pull_event()
   {
-    event_entry this_event;
-    this_event = event_queue_[qhead_];
-    qhead_ = (qhead_ + 1) % queue_length;
-    if (qfull_) {
-      qfull_ = false;
-    }
+    event_entry this_event = {NONE, 0, 0, 0.0f, 0};
+    pop(&this_event);
     return this_event;
   }
 
   bool has_event()
   {
-    return (qfull_ || !(qtail_ == qhead_));
+    return __atomic_load_n(&slots_[head_ & (queue_length - 1)].seq, __ATOMIC_ACQUIRE) == (head_ + 1);
+  }
+
+  uint32_t Dropped()
+  {
+    return __atomic_load_n(&dropped_, __ATOMIC_RELAXED);
+  }
+
+  uint32_t HighWater()
+  {
+    return __atomic_load_n(&high_water_, __ATOMIC_RELAXED);
   }
 
   private:
-    event_entry event_queue_[queue_length];
-    uint8_t qhead_;
-    uint8_t qtail_;
-    bool qfull_;
+    static_assert((queue_length & (queue_length - 1)) == 0, "EventQueue length must be a power of 2");
+
+    struct slot_t {
+      uint32_t seq;
+      event_entry e;
+    };
+
+    slot_t slots_[queue_length];
+    uint32_t head_, tail_;
+    uint32_t dropped_, high_water_;
+    uint32_t (*clock_)();
 };
@@ -2,6 +2,29 @@
 
 #define SPM 60.0f
 
+// messages handled per Process call, anything left waits for the next pass round the main loop
+#define MIDI_BATCH	    32
+#define MIDI_NUM_CC	    128
+// data entry and parameter number controllers for NRPNs
+#define MIDI_DATA_MSB	    6
+#define MIDI_DATA_LSB	    38
+#define MIDI_NRPN_LSB	    98
+#define MIDI_NRPN_MSB	    99
+#define MIDI_RPN_LSB	    100
+#define MIDI_RPN_MSB	    101
+// and for RPNs
+#define MIDI_NRPN_NULL	    0x3fff
+#define MIDI_RPN_BEND_RANGE 0
+// MPE configuration message, data entry MSB is the number of member channels
+#define MIDI_RPN_MCM	    6
+#define MIDI_CHANNELS	    16
+// MPE defaults, member channel bend range is in semitones and CC74 is slide
+#define MIDI_MPE_BEND_RANGE 48
+#define MIDI_MPE_SLIDE	    74
+#define MIDI_NO_NOTE	    0xff
+
+#include "clock_dll.h"
+
 #ifdef TARGET_POD
 #include "pod.h"
 #endif
@@ -26,12 +49,21 @@ class MidiMsgHandler
 
     typedef void (*MidiCCHandlerCB)(uint8_t cc, uint8_t val);
 
-    typedef void (*MidiNOnHandlerCB)(uint8_t n, uint8_t vel);
+    // 14 bit, val is the last of a run of CCs, lo to hi the range they covered
+    typedef void (*MidiCCRangeHandlerCB)(uint8_t cc, uint16_t val, uint16_t lo, uint16_t hi);
+
+    // member is the MPE member channel the note came in on, 0 for the master channel or with MPE off
+    typedef void (*MidiNOnHandlerCB)(uint8_t n, uint8_t vel, uint8_t member);
+
+    typedef void (*MidiNOffHandlerCB)(uint8_t n, uint8_t vel, uint8_t member);
 
-    typedef void (*MidiNOffHandlerCB)(uint8_t n, uint8_t vel);
+    // per note expression from an MPE member channel, bend is in semitones, pressure and slide 0 to 1
+    typedef void (*MidiExprHandlerCB)(uint8_t member, uint8_t type, float val);
 
     typedef void (*MidiPBHandlerCB)(int16_t val);
 
+    typedef void (*MidiSPPHandlerCB)(uint16_t spp);
+
     void SetMNOnHCB(MidiNOnHandlerCB cb)
     {
       midi_non_cb_= cb;
@@ -47,6 +79,16 @@ class MidiMsgHandler
       midi_pb_cb_= cb;
     }
 
+    void SetExprHCB(MidiExprHandlerCB cb)
+    {
+      midi_expr_cb_= cb;
+    }
+
+    void SetSPPHCB(MidiSPPHandlerCB cb)
+    {
+      midi_spp_cb_= cb;
+    }
+
     void SetMCCHCB(MidiCCHandlerCB cb)
     {
       midi_cc_cb_= cb;
@@ -57,13 +99,46 @@ class MidiMsgHandler
       midi_cb_= cb;
     }
 
+    void SetMCCRangeHCB(MidiCCRangeHandlerCB cb)
+    {
+      midi_cc_range_cb_= cb;
+    }
+
+    // lsb is the fine half of msb, they're put together before anything is passed on as msb
+    void SetCCPair(uint8_t msb, uint8_t lsb)
+    {
+      pair_msb_[lsb] = msb;
+      is_lsb_[lsb] = true;
+      is_msb_[msb] = true;
+    }
+
+    // Only the last value of cc in each batch is passed on, to the range callback
+    // anything else that comes in first gets it before it's handled, so nothing is reordered that matters
+    void SetCCCoalesce(uint8_t cc, bool on)
+    {
+      if (on) {
+	cc_coalesce_[cc >> 5] |= (1u << (cc & 31));
+      } else {
+	cc_coalesce_[cc >> 5] &= ~(1u << (cc & 31));
+      }
+    }
+
+    enum ExprType
+    {
+      Bend,
+      Pressure,
+      Slide,
+      ExprTypes
+    };
+
     enum RealTimeType 
     {
       Start,
       Stop,
       Continue,
       Beat,
-      HalfBeat
+      HalfBeat,
+      Clock
     };
 
     void SetSRTCB(RealTimeType type, SystemRealTimeHandler cb)
@@ -84,6 +159,9 @@ class MidiMsgHandler
         case HalfBeat:
           half_beat_cb_ = cb;
           break;
+        case Clock:
+          clock_cb_ = cb;
+          break;
         default: break;
       }
     }
@@ -92,16 +170,54 @@ class MidiMsgHandler
     {
       hw_handle_ = hw;
       tick_dur_ = 1.0f / (2 * hw_handle_->seed.system.GetPClk1Freq());
+      dll_.Init(ppqn_);
     }
 
     void SetChannel(int c)
     {
       channel_ = c;
+      SetMPE(0);
+    }
+
+    /*
+     * MPE lower zone, the set channel is the master and the members are the channels above it.
+     * Each note on a member channel gets that channel's bend, pressure and slide to itself,
+     * anything else on a member channel is ignored. 0 members is MPE off.
+     * An MPE controller turns it on itself with the MCM message (RPN 6) on the master channel.
+     */
+    void SetMPE(uint8_t members)
+    {
+      // notes still held on the old members would never get their note off
+      for (uint8_t m = 1; m <= members_; m++) {
+	if ((member_note_[m] != MIDI_NO_NOTE) && (midi_noff_cb_ != nullptr)) {
+	  midi_noff_cb_(member_note_[m], 0, m);
+	}
+      }
+      members_ = (members < (MIDI_CHANNELS - 1 - channel_)) ? members : (MIDI_CHANNELS - 1 - channel_);
+      bend_range_ = MIDI_MPE_BEND_RANGE;
+      for (uint8_t m = 0; m < MIDI_CHANNELS; m++) {
+	member_note_[m] = MIDI_NO_NOTE;
+	for (uint8_t t = 0; t < ExprTypes; t++) {
+	  Expr(m, t, 0.0f);
+	}
+      }
+      FlushExpr();
+    }
+
+    uint8_t GetMPE()
+    {
+      return members_;
     }
 
     void SetPPQN(int ppqn)
     {
       ppqn_ = ppqn;
+      dll_.Init(ppqn_);
+    }
+
+    int GetPPQN()
+    {
+      return ppqn_;
     }
 
     float GetBPM()
@@ -119,13 +235,50 @@ class MidiMsgHandler
       got_clock_ = false;
     }
 
+    // the clock is there and the tempo can be trusted
+    bool ClockLocked()
+    {
+      return dll_.Locked();
+    }
+
+    // 0 to 1, how steady the clock is
+    float ClockConfidence()
+    {
+      return dll_.Confidence();
+    }
+
+    // how far we are between the last clock tick and the next, 0 to 1
+    float GetSubTick()
+    {
+      return dll_.SubTick((hw_handle_->seed.system.GetTick() - last_midi_tick_) * tick_dur_);
+    }
+
     void Process()
     {
+      int ticks;
+      size_t n = 0;
+      uint8_t member;
+
       hw_handle_->midi.Listen();
-      while(hw_handle_->midi.HasEvents())
+      dll_.Check((hw_handle_->seed.system.GetTick() - last_midi_tick_) * tick_dur_);
+      while((n++ < MIDI_BATCH) && hw_handle_->midi.HasEvents())
       {
         daisy::MidiEvent m = hw_handle_->midi.PopEvent();
-        if (m.channel != channel_) { return; } 
+	// system messages aren't on a channel
+	if ((m.type != daisy::SystemCommon) && (m.type != daisy::SystemRealTime)) {
+	  if ((m.channel < channel_) || (m.channel > (channel_ + members_))) continue;
+	  member = m.channel - channel_;
+	  if (member > 0) {
+	    Member(&m, member);
+	    continue;
+	  }
+	}
+	if (m.type == daisy::ControlChange) {
+	  daisy::ControlChangeEvent p = m.AsControlChange();
+	  ControlChange(p.control_number, p.value);
+	  continue;
+	}
+	if ((m.type != daisy::SystemRealTime) || (m.srt_type != daisy::TimingClock)) FlushCCs();
         switch(m.type) { 
           case daisy::SystemRealTime:
             switch(m.srt_type) {
@@ -134,13 +287,11 @@ class MidiMsgHandler
 		  start_cb_();
 		}
                 ppqn_count_ = 0;
-                last_midi_tick_ = hw_handle_->seed.system.GetTick();
                 break;
               case daisy::Continue:
 		if (cont_cb_ != nullptr) {
 		  cont_cb_();
 		}
-                last_midi_tick_ = hw_handle_->seed.system.GetTick();
                 break;
               case daisy::Stop:
 		if (stop_cb_ != nullptr) {
@@ -157,21 +308,15 @@ class MidiMsgHandler
                 }
                 last_midi_tick_ = this_midi_tick_;
 
-                avg_midi_diff_ = cum_avg(midi_tick_diff_, ppqn_count_, avg_midi_diff_);
-                midi_bpm_ = SPM / (ppqn_ * avg_midi_diff_ * tick_dur_);
-                got_clock_ = true;
-
-                if (++ppqn_count_ == ppqn_) {
-                  ppqn_count_ = 0;
-		  if (beat_cb_ != nullptr) {
-		    beat_cb_();
-		  }
-                }
-                if (ppqn_count_ == ppqn_ / 2) {
-		  if (half_beat_cb_ != nullptr) {
-		    half_beat_cb_();
-		  }
-                }
+		// the loop filters out the jitter, and counts in any ticks that went missing
+		ticks = dll_.Tick(midi_tick_diff_ * tick_dur_);
+		if (dll_.Locked()) {
+		  midi_bpm_ = dll_.GetBPM();
+		  got_clock_ = true;
+		}
+		for (int i = 0; i < ticks; i++) {
+		  ClockTick();
+		}
                 break;
               default: break;
             }
@@ -180,7 +325,7 @@ class MidiMsgHandler
     	  {
 	    daisy::NoteOnEvent n = m.AsNoteOn();
 	    if (midi_non_cb_ != nullptr) {
-	      midi_non_cb_(n.note, n.velocity);
+	      midi_non_cb_(n.note, n.velocity, 0);
 	    }
 	    break;
 	  }
@@ -188,18 +333,16 @@ class MidiMsgHandler
     	  {
 	    daisy::NoteOffEvent n = m.AsNoteOff();
 	    if (midi_noff_cb_ != nullptr) {
-	      midi_noff_cb_(n.note, n.velocity);
+	      midi_noff_cb_(n.note, n.velocity, 0);
 	    }
 	    break;
 	  }
-          case daisy::ControlChange:
-          {
-            daisy::ControlChangeEvent p = m.AsControlChange();
-	    if (midi_cc_cb_ != nullptr) {
-	      midi_cc_cb_(p.control_number, p.value);
+	  case daisy::SystemCommon:
+	    // 14 bit count of 16th notes since the start of the song
+	    if ((m.sc_type == daisy::SongPositionPointer) && (midi_spp_cb_ != nullptr)) {
+	      midi_spp_cb_((m.data[1] << 7) | m.data[0]);
 	    }
-            break;
-          }
+	    break;
 	  case daisy::PitchBend:
     	  {
 	    daisy::PitchBendEvent p = m.AsPitchBend();
@@ -215,6 +358,8 @@ class MidiMsgHandler
             break;
         }
       }
+      FlushCCs();
+      FlushExpr();
     }
 
   private:
@@ -226,22 +371,255 @@ class MidiMsgHandler
     uint32_t this_midi_tick_ = 0;
     uint32_t last_midi_tick_ = 0;
     uint32_t midi_tick_diff_;
-    float midi_bpm_, avg_midi_diff_, tick_dur_;
+    float midi_bpm_, tick_dur_;
+    ClockDLL dll_;
 
     SystemRealTimeHandler start_cb_ =	  nullptr;
     SystemRealTimeHandler cont_cb_ =	  nullptr;
     SystemRealTimeHandler stop_cb_ = 	  nullptr;
     SystemRealTimeHandler beat_cb_ = 	  nullptr;
     SystemRealTimeHandler half_beat_cb_ = nullptr;
+    SystemRealTimeHandler clock_cb_ = 	  nullptr;
     MidiCCHandlerCB midi_cc_cb_ = nullptr;
     MidiNOnHandlerCB midi_non_cb_ = nullptr;
     MidiNOffHandlerCB midi_noff_cb_ = nullptr;
     MidiPBHandlerCB midi_pb_cb_ = nullptr;
+    MidiSPPHandlerCB midi_spp_cb_ = nullptr;
     MidiMsgHandlerCB midi_cb_ =	  nullptr;
+    MidiCCRangeHandlerCB midi_cc_range_cb_ = nullptr;
+    MidiExprHandlerCB midi_expr_cb_ = nullptr;
+
+    // one bit per controller
+    uint32_t cc_coalesce_[MIDI_NUM_CC / 32] = {0};
+    uint32_t cc_pending_[MIDI_NUM_CC / 32] = {0};
+    uint16_t cc_val_[MIDI_NUM_CC], cc_lo_[MIDI_NUM_CC], cc_hi_[MIDI_NUM_CC];
+
+    // 14 bit controllers
+    bool is_msb_[MIDI_NUM_CC] = {false};
+    bool is_lsb_[MIDI_NUM_CC] = {false};
+    uint8_t pair_msb_[MIDI_NUM_CC];
+    uint8_t msb_[MIDI_NUM_CC] = {0};
+    bool lsb_seen_[MIDI_NUM_CC] = {false};
+    uint16_t nrpn_ = MIDI_NRPN_NULL, rpn_ = MIDI_NRPN_NULL;
+    uint8_t data_msb_ = 0;
+    bool data_entry_ = false;
+    bool nrpn_lsb_seen_[MIDI_NUM_CC] = {false};
+
+    // MPE, indexed by member channel, 0 is the master
+    uint8_t members_ = 0, bend_range_ = MIDI_MPE_BEND_RANGE;
+    uint8_t member_note_[MIDI_CHANNELS];
+    float expr_val_[MIDI_CHANNELS][ExprTypes];
+    // one bit per member channel for each type
+    uint16_t expr_pending_[ExprTypes] = {0};
+
+    /*
+     * Puts the 14 bit value together from CC pairs and NRPN data entry.
+     * An MSB on its own counts as the whole 7 bit value (v << 7 | v spans 0 to 16383 the same as v spans 0 to 127),
+     * until an LSB turns up, after that the MSB waits for its LSB so a sweep doesn't jump about between them.
+     * NRPN n below 128 is the 14 bit version of CC n.
+     * CC38 is only data entry LSB straight after a data entry MSB (RPN or NRPN), otherwise it's left alone as a CC.
+     * Anything that isn't coalesced only ever gets 7 bits, which is all in the MSB, so it goes once on the MSB
+     * and the LSB is dropped, a toggle doesn't flip twice.
+     */
+    void ControlChange(uint8_t cc, uint8_t val)
+    {
+      bool data_lsb = data_entry_;
+      data_entry_ = false;
+
+      switch (cc) {
+	case MIDI_NRPN_MSB:
+	  nrpn_ = (val << 7) | (nrpn_ & 0x7f);
+	  rpn_ = MIDI_NRPN_NULL;
+	  return;
+	case MIDI_NRPN_LSB:
+	  nrpn_ = (nrpn_ & 0x3f80) | val;
+	  rpn_ = MIDI_NRPN_NULL;
+	  return;
+	// either stops data entry going to the last NRPN
+	case MIDI_RPN_MSB:
+	case MIDI_RPN_LSB:
+	  Rpn(cc, val, 0);
+	  return;
+	case MIDI_DATA_MSB:
+	  if (rpn_ != MIDI_NRPN_NULL) {
+	    data_entry_ = true;
+	    Rpn(cc, val, 0);
+	    return;
+	  }
+	  if (nrpn_ == MIDI_NRPN_NULL) break;
+	  data_entry_ = true;
+	  if (nrpn_ < MIDI_NUM_CC) {
+	    data_msb_ = val;
+	    if (!nrpn_lsb_seen_[nrpn_] || !Coalesced(nrpn_)) Control(nrpn_, (val << 7) | val);
+	  }
+	  return;
+	case MIDI_DATA_LSB:
+	  if (!data_lsb) break;
+	  // the RPNs used here don't need the fine part
+	  if ((rpn_ != MIDI_NRPN_NULL) || (nrpn_ >= MIDI_NUM_CC)) return;
+	  nrpn_lsb_seen_[nrpn_] = true;
+	  if (Coalesced(nrpn_)) Control(nrpn_, (data_msb_ << 7) | val);
+	  return;
+	default:
+	  break;
+      }
+
+      if (is_lsb_[cc]) {
+	lsb_seen_[pair_msb_[cc]] = true;
+	if (Coalesced(pair_msb_[cc])) Control(pair_msb_[cc], (msb_[pair_msb_[cc]] << 7) | val);
+      } else if (is_msb_[cc]) {
+	msb_[cc] = val;
+	if (!lsb_seen_[cc] || !Coalesced(cc)) Control(cc, (val << 7) | val);
+      } else {
+	Control(cc, (val << 7) | val);
+      }
+    }
 
-    // n starts from zero
-    float cum_avg(uint32_t x, int n, float ca)
+    inline bool Coalesced(uint8_t cc)
     {
-      return (float)((x + (n * ca)) / (n + 1));
+      return (midi_cc_range_cb_ != nullptr) && (cc_coalesce_[cc >> 5] & (1u << (cc & 31)));
+    }
+
+    // val is 14 bit, anything not coalesced goes to the plain CC callback as 7 bit
+    void Control(uint8_t cc, uint16_t val)
+    {
+      uint32_t bit = 1u << (cc & 31);
+      if (Coalesced(cc)) {
+	if (cc_pending_[cc >> 5] & bit) {
+	  cc_lo_[cc] = (val < cc_lo_[cc]) ? val : cc_lo_[cc];
+	  cc_hi_[cc] = (val > cc_hi_[cc]) ? val : cc_hi_[cc];
+	} else {
+	  cc_pending_[cc >> 5] |= bit;
+	  cc_lo_[cc] = cc_hi_[cc] = val;
+	}
+	cc_val_[cc] = val;
+	return;
+      }
+      FlushCCs();
+      if (midi_cc_cb_ != nullptr) {
+	midi_cc_cb_(cc, val >> 7);
+      }
+    }
+
+    void FlushCCs()
+    {
+      uint8_t cc;
+      for (size_t w = 0; w < (MIDI_NUM_CC / 32); w++) {
+	while (cc_pending_[w]) {
+	  cc = (w << 5) + __builtin_ctz(cc_pending_[w]);
+	  cc_pending_[w] &= cc_pending_[w] - 1;
+	  midi_cc_range_cb_(cc, cc_val_[cc], cc_lo_[cc], cc_hi_[cc]);
+	}
+      }
+    }
+
+    // the only RPNs are the MPE ones, bend range from a member and MCM from the master
+    void Rpn(uint8_t cc, uint8_t val, uint8_t member)
+    {
+      switch (cc) {
+	case MIDI_RPN_MSB:
+	  rpn_ = (val << 7) | (rpn_ & 0x7f);
+	  nrpn_ = MIDI_NRPN_NULL;
+	  break;
+	case MIDI_RPN_LSB:
+	  rpn_ = (rpn_ & 0x3f80) | val;
+	  nrpn_ = MIDI_NRPN_NULL;
+	  break;
+	case MIDI_DATA_MSB:
+	  if ((rpn_ == MIDI_RPN_MCM) && (member == 0)) {
+	    SetMPE(val);
+	  } else if ((rpn_ == MIDI_RPN_BEND_RANGE) && (member > 0)) {
+	    bend_range_ = val;
+	  }
+	  break;
+	default:
+	  break;
+      }
+    }
+
+    // something on a member channel, notes and the three kinds of expression
+    void Member(daisy::MidiEvent *m, uint8_t member)
+    {
+      switch (m->type) {
+	case daisy::NoteOn:
+	{
+	  daisy::NoteOnEvent n = m->AsNoteOn();
+	  // the note starts with the channel's expression as it is now
+	  FlushExpr();
+	  member_note_[member] = (n.velocity > 0) ? n.note : MIDI_NO_NOTE;
+	  if (midi_non_cb_ != nullptr) {
+	    midi_non_cb_(n.note, n.velocity, member);
+	  }
+	  break;
+	}
+	case daisy::NoteOff:
+	{
+	  daisy::NoteOffEvent n = m->AsNoteOff();
+	  FlushExpr();
+	  member_note_[member] = MIDI_NO_NOTE;
+	  if (midi_noff_cb_ != nullptr) {
+	    midi_noff_cb_(n.note, n.velocity, member);
+	  }
+	  break;
+	}
+	case daisy::PitchBend:
+	  Expr(member, Bend, (m->AsPitchBend().value * bend_range_) / 8192.0f);
+	  break;
+	case daisy::ChannelPressure:
+	  Expr(member, Pressure, m->AsChannelPressure().monophonic_pressure / 127.0f);
+	  break;
+	case daisy::ControlChange:
+	{
+	  daisy::ControlChangeEvent p = m->AsControlChange();
+	  if (p.control_number == MIDI_MPE_SLIDE) {
+	    Expr(member, Slide, p.value / 127.0f);
+	  } else {
+	    Rpn(p.control_number, p.value, member);
+	  }
+	  break;
+	}
+	default:
+	  break;
+      }
+    }
+
+    // expression is coalesced like CCs, only the last of each per channel in a batch is passed on
+    void Expr(uint8_t member, uint8_t type, float val)
+    {
+      expr_val_[member][type] = val;
+      expr_pending_[type] |= (1u << member);
+    }
+
+    void FlushExpr()
+    {
+      uint8_t member;
+      for (uint8_t t = 0; t < ExprTypes; t++) {
+	while (expr_pending_[t]) {
+	  member = __builtin_ctz(expr_pending_[t]);
+	  expr_pending_[t] &= expr_pending_[t] - 1;
+	  if (midi_expr_cb_ != nullptr) {
+	    midi_expr_cb_(member, t, expr_val_[member][t]);
+	  }
+	}
+      }
+    }
+
+    void ClockTick()
+    {
+      if (clock_cb_ != nullptr) {
+	clock_cb_();
+      }
+
+      if (++ppqn_count_ == ppqn_) {
+	ppqn_count_ = 0;
+	if (beat_cb_ != nullptr) {
+	  beat_cb_();
+	}
+      }
+      if (ppqn_count_ == ppqn_ / 2) {
+	if (half_beat_cb_ != nullptr) {
+	  half_beat_cb_();
+	}
+      }
     }
 };
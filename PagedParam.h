@@ -3,6 +3,8 @@
 #define CC_TO_VAL(x, min, max) (min + (x / 127.0f) * (max - min))
 // expect a range of -1 to 1
 #define PB_TO_VAL(x) (x / 8191.0f)
+// 14 bit CC pairs and NRPNs
+#define CC14_TO_VAL(x) (x / 16383.0f)
 
 // All in values are expected to be in the 0 to 1 range
 // cur_val is stored as a range between 0 and 1
@@ -67,6 +69,12 @@ class PagedParam
       cur_val_ = fminf(1.0f, fmaxf(0.0f, val));
     }
 
+    // between 0 and 1
+    float Raw()
+    {
+      return cur_val_;
+    }
+
     float Process(float in, uint8_t current_page)
     {
       if (current_page == page_) {
@@ -123,6 +131,28 @@ class PagedParam
       }
     }
 
+    /*
+     * 14 bit, and maybe several CCs rolled into one, val was the last and lo to hi is the range they covered,
+     * so catch mode still picks it up if the value went past on the way.
+     */
+    void MidiCC14In(uint16_t val, uint16_t lo, uint16_t hi)
+    {
+      float in = CC14_TO_VAL(val);
+      if (midi_locked_) {
+	if (((CC14_TO_VAL(lo) - thresh_) < cur_val_) && (cur_val_ < (CC14_TO_VAL(hi) + thresh_))) {
+	  midi_locked_ = false;
+	  locked_ = true;
+	  changed_ = true;
+	  cur_val_ = in;
+	}
+      } else if (in != cur_val_) {
+	changed_ = true;
+	cur_val_ = in;
+      } else {
+	changed_ = false;
+      }
+    }
+
     /*
      * As above but for we ignore midi locks
      */
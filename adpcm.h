@@ -0,0 +1,216 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * IMA-ADPCM in fixed size blocks so any sample can be reached by decoding at most one block.
+ * Each channel of a block is a 4 byte header (first sample and step index) followed by
+ * the remaining ADPCM_BLOCK_FRAMES - 1 samples as nibbles.
+ * Stereo blocks are the left channel followed by the right.
+ */
+#define ADPCM_BLOCK_SHIFT   7
+#define ADPCM_BLOCK_FRAMES  (1 << ADPCM_BLOCK_SHIFT)
+#define ADPCM_BLOCK_MASK    (ADPCM_BLOCK_FRAMES - 1)
+#define ADPCM_HDR_BYTES	    4
+#define ADPCM_CH_BYTES	    (ADPCM_HDR_BYTES + (ADPCM_BLOCK_FRAMES / 2))
+#define ADPCM_NO_BLOCK	    SIZE_MAX
+
+static const int16_t adpcm_steps[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+  253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+  1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+  3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+  12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t adpcm_index_adj[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// Bytes needed to hold frames of chans channel audio
+inline size_t AdpcmBytes(size_t frames, uint8_t chans)
+{
+  return ((frames + ADPCM_BLOCK_MASK) >> ADPCM_BLOCK_SHIFT) * ADPCM_CH_BYTES * chans;
+}
+
+// Shared by the encoder and decoder so they can't drift apart
+inline int16_t AdpcmStep(uint8_t nibble, int32_t *pred, int8_t *index)
+{
+  int32_t step = adpcm_steps[*index];
+  int32_t diff = step >> 3;
+
+  if (nibble & 4) diff += step;
+  if (nibble & 2) diff += step >> 1;
+  if (nibble & 1) diff += step >> 2;
+  *pred += (nibble & 8) ? -diff : diff;
+  *pred = (*pred > 32767) ? 32767 : ((*pred < -32768) ? -32768 : *pred);
+
+  *index += adpcm_index_adj[nibble];
+  *index = (*index < 0) ? 0 : ((*index > 88) ? 88 : *index);
+  return (int16_t)*pred;
+}
+
+// Used at load time, fed converted s16 frames as they come off the card
+class AdpcmEncoder
+{
+  public:
+    AdpcmEncoder() {}
+    ~AdpcmEncoder() {}
+
+    void Init(uint8_t *out, uint8_t chans)
+    {
+      out_ = out;
+      chans_ = chans;
+      fill_ = 0;
+      bytes_ = 0;
+      for (size_t ch = 0; ch < 2; ch++) {
+	index_[ch] = 0;
+      }
+    }
+
+    void Encode(const int16_t *in, size_t frames)
+    {
+      size_t n;
+      while (frames > 0) {
+	n = ADPCM_BLOCK_FRAMES - fill_;
+	n = (frames < n) ? frames : n;
+	memcpy(&pcm_[fill_ * chans_], in, n * chans_ * sizeof(int16_t));
+	fill_ += n;
+	in += n * chans_;
+	frames -= n;
+	if (fill_ == ADPCM_BLOCK_FRAMES) {
+	  EncodeBlock();
+	}
+      }
+    }
+
+    // pads out the last block, returns the total number of bytes written
+    size_t Flush()
+    {
+      if (fill_ > 0) {
+	for (size_t i = fill_; i < ADPCM_BLOCK_FRAMES; i++) {
+	  for (size_t ch = 0; ch < chans_; ch++) {
+	    pcm_[(i * chans_) + ch] = pcm_[((fill_ - 1) * chans_) + ch];
+	  }
+	}
+	EncodeBlock();
+      }
+      return bytes_;
+    }
+
+  private:
+    void EncodeBlock()
+    {
+      int32_t pred, diff, step;
+      int8_t index;
+      uint8_t nibble, *p;
+
+      for (size_t ch = 0; ch < chans_; ch++) {
+	p = out_ + bytes_;
+	pred = pcm_[ch];
+	index = index_[ch];
+	memcpy(p, &pcm_[ch], sizeof(int16_t));
+	p[2] = (uint8_t)index;
+	p[3] = 0;
+	p += ADPCM_HDR_BYTES;
+	memset(p, 0, ADPCM_BLOCK_FRAMES / 2);
+
+	for (size_t i = 1; i < ADPCM_BLOCK_FRAMES; i++) {
+	  diff = pcm_[(i * chans_) + ch] - pred;
+	  step = adpcm_steps[index];
+	  nibble = 0;
+	  if (diff < 0) {
+	    nibble = 8;
+	    diff = -diff;
+	  }
+	  if (diff >= step) { nibble |= 4; diff -= step; }
+	  step >>= 1;
+	  if (diff >= step) { nibble |= 2; diff -= step; }
+	  step >>= 1;
+	  if (diff >= step) { nibble |= 1; }
+	  AdpcmStep(nibble, &pred, &index);
+	  // sample i lives in nibble i - 1
+	  p[(i - 1) >> 1] |= ((i - 1) & 1) ? (nibble << 4) : nibble;
+	}
+	index_[ch] = index;
+	bytes_ += ADPCM_CH_BYTES;
+      }
+      fill_ = 0;
+    }
+
+    int16_t pcm_[ADPCM_BLOCK_FRAMES * 2];
+    uint8_t *out_;
+    size_t fill_, bytes_;
+    int8_t index_[2];
+    uint8_t chans_;
+};
+
+/*
+ * One decoded block per grain.
+ * Grains only decode the blocks they actually touch and the first sample of a block
+ * comes straight from its header, so stepping across a block boundary for the
+ * interpolation doesn't throw the current block away.
+ */
+class AdpcmCache
+{
+  public:
+    AdpcmCache() {}
+    ~AdpcmCache() {}
+
+    void Init(const uint8_t *blocks, uint8_t chans)
+    {
+      blocks_ = blocks;
+      chans_ = chans;
+      block_bytes_ = ADPCM_CH_BYTES * chans;
+      blk_ = ADPCM_NO_BLOCK;
+    }
+
+    inline int16_t Get(size_t idx, uint8_t ch)
+    {
+      size_t blk = idx >> ADPCM_BLOCK_SHIFT;
+      size_t off = idx & ADPCM_BLOCK_MASK;
+      if (blk != blk_) {
+	if (off == 0) {
+	  return Head(blk, ch);
+	}
+	Decode(blk);
+      }
+      return pcm_[(off * chans_) + ch];
+    }
+
+  private:
+    inline int16_t Head(size_t blk, uint8_t ch)
+    {
+      int16_t s;
+      memcpy(&s, blocks_ + (blk * block_bytes_) + (ch * ADPCM_CH_BYTES), sizeof(int16_t));
+      return s;
+    }
+
+    void Decode(size_t blk)
+    {
+      const uint8_t *p;
+      int32_t pred;
+      int8_t index;
+      uint8_t nibble;
+
+      for (size_t ch = 0; ch < chans_; ch++) {
+	p = blocks_ + (blk * block_bytes_) + (ch * ADPCM_CH_BYTES);
+	pred = Head(blk, ch);
+	index = (int8_t)p[2];
+	p += ADPCM_HDR_BYTES;
+	pcm_[ch] = (int16_t)pred;
+	for (size_t i = 1; i < ADPCM_BLOCK_FRAMES; i++) {
+	  nibble = ((i - 1) & 1) ? (p[(i - 1) >> 1] >> 4) : (p[(i - 1) >> 1] & 0x0F);
+	  pcm_[(i * chans_) + ch] = AdpcmStep(nibble, &pred, &index);
+	}
+      }
+      blk_ = blk;
+    }
+
+    int16_t pcm_[ADPCM_BLOCK_FRAMES * 2];
+    const uint8_t *blocks_;
+    size_t blk_, block_bytes_;
+    uint8_t chans_;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Which audio frame is going out, for stamping events in the main loop so the callback can play them
+ * on the sample. The callback marks the first frame of each block and the timer when it started it,
+ * Stamp() adds on however many frames of timer have gone by since, then a block, so anything stamped
+ * plays a constant block after it came in rather than anywhere from nothing to a block later.
+ * Frames and ticks both wrap, every comparison with a stamp has to be (int32_t)(a - b).
+ */
+class BlockClock
+{
+  public:
+    BlockClock() {}
+    ~BlockClock() {}
+
+    // frames_per_tick turns clock() ticks into audio frames
+    void Init(uint32_t (*clock)(), float frames_per_tick)
+    {
+      clock_ = clock;
+      frames_per_tick_ = frames_per_tick;
+      frame_ = tick_ = 0;
+      size_ = 0;
+    }
+
+    // Audio callback only, at the start of every block
+    void Block(size_t size)
+    {
+      frame_ += size_;
+      size_ = size;
+      tick_ = clock_();
+    }
+
+    // Audio callback only, the first frame of the block it's on
+    inline uint32_t Frame()
+    {
+      return frame_;
+    }
+
+    // Main loop only, the frame to play something that's just come in at
+    uint32_t Stamp()
+    {
+      uint32_t frame, tick;
+      size_t size;
+
+      // the callback might come in half way through
+      do {
+	tick = tick_;
+	frame = frame_;
+	size = size_;
+      } while (tick != tick_);
+      return frame + size + (uint32_t)((clock_() - tick) * frames_per_tick_);
+    }
+
+  private:
+    volatile uint32_t frame_, tick_;
+    volatile size_t size_;
+    uint32_t (*clock_)();
+    float frames_per_tick_;
+};
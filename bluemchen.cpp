@@ -18,11 +18,11 @@ int8_t next_dir;
 page_t pages[NUM_PAGES] = { 
   {"P1",     "grain env",  "rst pitch",  eq.INCR_GRAIN_ENV,  eq.RST_PITCH_SCAN},  /* k1 = Grain Pitch	    k2 = Scan Rate*	*/
   {"P2",  "grain rev",  "scan rev",	  eq.TOG_GRAIN_REV,   eq.TOG_SCAN_REV},	   /* k1 = Grain Duration   k2 = Grain Density	*/
-  {"P3",  "scatter",    "freeze",	  eq.TOG_SCAT,	      eq.TOG_FREEZE},	   /* k1 = Scatter Distance			*/
-  {"P4",   "rnd pitch",  "rnd dens",	  eq.TOG_RND_PITCH,   eq.TOG_RND_DENS},    /* k1 = Pitch Distance			*/
+  {"P3",  "scatter",    "freeze",	  eq.TOG_SCAT,	      eq.TOG_FREEZE},	   /* k1 = Scatter Distance k2 = Live Delay	*/
+  {"P4",   "rnd pitch",  "rnd dens",	  eq.TOG_RND_PITCH,   eq.TOG_RND_DENS},    /* k1 = Pitch Distance   k2 = Stereo Width	*/
   {"P5",    "live rec",   "play rec",	  eq.LIVE_REC,	      eq.LIVE_PLAY},       /* k1 = Sample Start*    k2 = Sample End*	*/
-  {"P6",  "crush",	    "dwn smpl",		  eq.NONE,	      eq.NONE},            /* k1 = Bit Crush	    k2 = Downsample	*/
-  {"P7",  "rnd pan",    "",		  eq.TOG_RND_PAN,     eq.NONE},            /* k1 = pan		    k2 = pan dist	*/
+  {"P6",  "record",     "bounce",	  eq.REC,	      eq.BOUNCE},          /* k1 = Bit Crush	    k2 = Downsample	*/
+  {"P7",  "rnd pan",    "overdub",	  eq.TOG_RND_PAN,     eq.TOG_OVERDUB},     /* k1 = pan		    k2 = pan dist	*/
   {"P8",    "gate",	    "retrig",	  eq.TOG_GATE,	      eq.TOG_RETRIG},      /* k1 = delay mix	    k2 = delay time	*/
   {"P9",  "note",	    "loop",	  eq.TOG_NOTE,	      eq.TOG_LOOP}         /* k1 = delay fbk	    k2 = delay xst  	*/
 };
@@ -103,7 +103,7 @@ void UpdateUI(int8_t cur_page)
 
   // limit update rate
   uint32_t now = hw.seed.system.GetNow();
-  if (last_ui_update - now >= 30) {
+  if ((now - last_ui_update) >= 30) {
     last_ui_update = now;
 
     if (setup_page) {
@@ -185,6 +185,9 @@ void Status(status_t status)
     case MISSING_WAV:
       hw.display.WriteString("SIZE?", Font_6x8, true);
       break;
+    case REC_ERROR:
+      hw.display.WriteString("REC?", Font_6x8, true);
+      break;
     case FSI_INIT:
       hw.display.WriteString("~.~", Font_6x8, true);
       break;
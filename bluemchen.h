@@ -12,6 +12,8 @@
 #define MAX_STRING 11 // 10 chars 6px wide + terminating \0
 
 #define LONG_PRESS 512
+// 30Hz is plenty for the display
+#define UI_PERIOD_US 33333
 #define EXTRA_LONG_PRESS (LONG_PRESS * 3)
 #define DOUBLE_CLICK 500
 
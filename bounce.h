@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include "daisy_core.h"
+
+/*
+ * Captures the final stereo output into SDRAM so it can be played back as a new wave.
+ * The callback copies whole blocks, so the cost is one block of conversions whatever happens,
+ * and the main loop picks the result up once it's stopped or full.
+ */
+class Bouncer
+{
+  public:
+    Bouncer() {}
+    ~Bouncer() {}
+
+    enum bounce_state {
+      IDLE,
+      RUNNING,
+      DONE
+    };
+
+    void Init()
+    {
+      state_ = IDLE;
+    }
+
+    // mem holds max_frames of interleaved stereo
+    void Start(int16_t *mem, size_t max_frames)
+    {
+      mem_ = mem;
+      max_ = max_frames;
+      len_ = 0;
+      state_ = RUNNING;
+    }
+
+    void Stop()
+    {
+      if (state_ == RUNNING) state_ = DONE;
+    }
+
+    // the memory is about to be reused, drop whatever was captured
+    void Cancel()
+    {
+      state_ = IDLE;
+    }
+
+    // Audio callback only
+    void Process(const float *l, const float *r, size_t size)
+    {
+      if (state_ != RUNNING) return;
+
+      size_t n = max_ - len_;
+      n = (size < n) ? size : n;
+      int16_t *p = &mem_[2 * len_];
+      for (size_t i = 0; i < n; i++) {
+	p[2 * i] = f2s16(l[i]);
+	p[(2 * i) + 1] = f2s16(r[i]);
+      }
+      len_ += n;
+      if (len_ == max_) state_ = DONE;
+    }
+
+    bool IsRunning()
+    {
+      return state_ == RUNNING;
+    }
+
+    bool IsDone()
+    {
+      return state_ == DONE;
+    }
+
+    // Main loop - hand over what was captured and go back to idle
+    size_t Take()
+    {
+      state_ = IDLE;
+      return len_;
+    }
+
+  private:
+    int16_t *mem_;
+    size_t max_;
+    volatile size_t len_;
+    volatile bounce_state state_;
+};
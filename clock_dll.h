@@ -0,0 +1,151 @@
+#pragma once
+
+#include <math.h>
+
+// loop bandwidth in Hz, starts wide to pull in quickly then narrows to filter out jitter
+#define DLL_BW_FAST	    2.0f
+#define DLL_BW_SLOW	    0.2f
+// how quickly it narrows, per tick
+#define DLL_BW_DECAY	    0.98f
+// no tick for this many periods and the clock's gone
+#define DLL_TIMEOUT_TICKS   8.0f
+// smoothing for the error variance behind the confidence
+#define DLL_VAR_COEF	    0.05f
+// rms timing error, as a fraction of a tick, that counts as no confidence at all
+#define DLL_MAX_JITTER	    0.25f
+// ticks further out than this are a tempo change, widen up again
+#define DLL_REPULL	    0.5f
+// a late tick is only some gone missing when it's within this much of a whole number of periods late,
+// the loop's at least DLL_MISS_CONF sure of the period, and it's not been late more than DLL_MAX_MISSES in a row
+#define DLL_MISS_SLACK	    0.2f
+#define DLL_MISS_CONF	    0.5f
+#define DLL_MAX_MISSES	    2
+
+/*
+ * Second order delay locked loop (after Adriaensen, "Using a DLL to filter time") tracking MIDI clock.
+ * Every tick compares when it came in with when the loop said it would, and pulls the predicted time
+ * and the period towards it. The period is the filtered tempo, the prediction gives the sub-tick phase.
+ * Ticks that go missing (a dropped byte, a busy main loop) are counted in rather than read as a tempo halving,
+ * anything late that doesn't look like that is the tempo dropping and the loop pulls in again.
+ * All times are in seconds relative to when the last tick arrived, so timer wrap around doesn't matter.
+ */
+class ClockDLL
+{
+  public:
+    ClockDLL() {}
+    ~ClockDLL() {}
+
+    void Init(int ppqn)
+    {
+      ppqn_ = ppqn;
+      Reset();
+    }
+
+    // forget the tempo, the next two ticks start again from scratch
+    void Reset()
+    {
+      state_ = WAITING;
+      bw_ = DLL_BW_FAST;
+      var_ = 0.0f;
+      misses_ = 0;
+    }
+
+    // dt is the time since the last tick arrived
+    // returns how many ticks that was, more than 1 if some went missing
+    int Tick(float dt)
+    {
+      int n = 1;
+      float e, late;
+
+      switch (state_) {
+	case WAITING:
+	  state_ = FIRST;
+	  return 1;
+	case FIRST:
+	  period_ = dt;
+	  next_ = dt;
+	  off_ = 0.0f;
+	  state_ = LOCKED;
+	  bw_ = DLL_BW_FAST;
+	  var_ = DLL_MAX_JITTER * DLL_MAX_JITTER;
+	  return 1;
+	default:
+	  break;
+      }
+
+      // whole missing periods, the prediction moves on with them
+      if (dt > (next_ + (0.5f * period_))) {
+	late = (dt - next_) / period_;
+	n = (int)(late + 0.5f);
+	if ((fabsf(late - n) < DLL_MISS_SLACK) && (Confidence() >= DLL_MISS_CONF) && (misses_ < DLL_MAX_MISSES)) {
+	  next_ += n * period_;
+	  n++;
+	  misses_++;
+	} else {
+	  n = 1;
+	}
+      } else {
+	misses_ = 0;
+      }
+
+      e = dt - next_;
+      if (fabsf(e) > (DLL_REPULL * period_)) bw_ = DLL_BW_FAST;
+
+      float w = 2.0f * M_PI * bw_ * period_;
+      float b = sqrtf(2.0f) * w;
+      float c = w * w;
+      // filtered time of this tick, then the next one, relative to when this one arrived
+      off_ = -e;
+      next_ = period_ + ((b - 1.0f) * e);
+      period_ += c * e;
+
+      var_ += DLL_VAR_COEF * (((e * e) / (period_ * period_)) - var_);
+      bw_ = DLL_BW_SLOW + ((bw_ - DLL_BW_SLOW) * DLL_BW_DECAY);
+      return n;
+    }
+
+    // since is the time since the last tick arrived
+    void Check(float since)
+    {
+      if ((state_ == LOCKED) && (since > (DLL_TIMEOUT_TICKS * period_))) {
+	Reset();
+      }
+    }
+
+    bool Locked()
+    {
+      return state_ == LOCKED;
+    }
+
+    float GetBPM()
+    {
+      return 60.0f / (period_ * ppqn_);
+    }
+
+    // how far through the current tick we are, 0 to 1
+    float SubTick(float since)
+    {
+      if (state_ != LOCKED) return 0.0f;
+      float p = (since - off_) / (next_ - off_);
+      return (p < 0.0f) ? 0.0f : ((p > 1.0f) ? 1.0f : p);
+    }
+
+    // 1 for a steady clock, 0 for one that's all over the place or not there
+    float Confidence()
+    {
+      if (state_ != LOCKED) return 0.0f;
+      float c = 1.0f - (sqrtf(var_) / DLL_MAX_JITTER);
+      return (c > 0.0f) ? c : 0.0f;
+    }
+
+  private:
+    enum dll_state {
+      WAITING,
+      FIRST,
+      LOCKED
+    };
+
+    dll_state state_;
+    int ppqn_, misses_;
+    float period_, next_, off_, bw_, var_;
+};
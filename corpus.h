@@ -0,0 +1,237 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include "sample_src.h"
+#include "sample_index.h"
+
+// 2048 frame segments, ~43mS at 48k
+#define CORPUS_SEG_SHIFT    11
+#define CORPUS_SEG_FRAMES   (1 << CORPUS_SEG_SHIFT)
+#define CORPUS_MAX_WAVES    32
+// loudness, brightness, pitch - all scaled 0 to 1
+#define CORPUS_DIMS	    3
+#define CORPUS_LOUD	    0
+#define CORPUS_BRIGHT	    1
+#define CORPUS_PITCH	    2
+// nearest neighbour search gives up after this many nodes so dispatch cost is bounded
+#define CORPUS_MAX_VISITS   48
+// feature ranges
+#define CORPUS_MIN_DB	    -60.0f
+#define CORPUS_MIN_HZ	    50.0f
+#define CORPUS_MAX_BRIGHT   16000.0f
+#define CORPUS_MAX_PITCH    2000.0f
+// one pole low pass ahead of the pitch zero crossing count, ~1kHz at 48k
+#define CORPUS_LP_COEF	    0.12f
+
+typedef struct {
+  float	    f[CORPUS_DIMS];
+  uint32_t  pos;
+  uint8_t   wave;
+} corpus_seg_t;
+
+/*
+ * Every non silent segment of every wave in the bank, described by a few cheap features
+ * and arranged as an implicit k-d tree (each sub range is split on its median) so
+ * grains can be picked by what they sound like instead of where they are.
+ *
+ * The features are time domain estimates rather than anything FFT based:
+ * brightness is the rms frequency, sqrt(E[dx^2] / E[x^2]) * sr / 2pi, which tracks the spectral centroid,
+ * and pitch comes from the zero crossing rate of a low passed copy.
+ */
+class Corpus
+{
+  public:
+    Corpus() {}
+    ~Corpus() {}
+
+    void Init(corpus_seg_t *mem, size_t max_segs, float sr)
+    {
+      segs_ = mem;
+      max_segs_ = max_segs;
+      sr_ = sr;
+      Clear();
+    }
+
+    void Clear()
+    {
+      n_ = 0;
+      waves_ = 0;
+    }
+
+    // Upper bound on the segments a wave can add
+    static size_t Segments(size_t len)
+    {
+      return (len >> CORPUS_SEG_SHIFT) + 1;
+    }
+
+    // Analyse every whole segment of src, which has to stay put until the next Clear
+    bool Add(const sample_src_t *src)
+    {
+      float f[CORPUS_DIMS];
+      size_t nsegs = src->len >> CORPUS_SEG_SHIFT;
+
+      if (waves_ >= CORPUS_MAX_WAVES) return false;
+      src_[waves_] = src;
+      reader_.Init(src);
+      for (size_t s = 0; (s < nsegs) && (n_ < max_segs_); s++) {
+	if (Features(s << CORPUS_SEG_SHIFT, f)) {
+	  corpus_seg_t *seg = &segs_[n_++];
+	  for (size_t d = 0; d < CORPUS_DIMS; d++) {
+	    seg->f[d] = f[d];
+	  }
+	  seg->pos = s << CORPUS_SEG_SHIFT;
+	  seg->wave = waves_;
+	}
+      }
+      waves_++;
+      return true;
+    }
+
+    // Call once everything has been added
+    void Build()
+    {
+      Split(0, n_, 0);
+    }
+
+    // Closest segment to target, approximate once the visit budget runs out
+    bool Nearest(const float *target, const sample_src_t **src, size_t *pos)
+    {
+      if (n_ == 0) return false;
+      best_ = 0;
+      best_d_ = INFINITY;
+      visits_ = 0;
+      Search(target, 0, n_, 0);
+      *src = src_[segs_[best_].wave];
+      *pos = segs_[best_].pos;
+      return true;
+    }
+
+    size_t Size()
+    {
+      return n_;
+    }
+
+    // in tree order once it's built
+    const corpus_seg_t *Seg(size_t i)
+    {
+      return &segs_[i];
+    }
+
+  private:
+    // false for silence, nothing useful to match there
+    bool Features(size_t start, float *f)
+    {
+      float x, dx, lp = 0.0f;
+      float ex = 0.0f, edx = 0.0f;
+      float prev = reader_.Mid(start);
+      bool pos_lp = false;
+      size_t zc = 0;
+
+      for (size_t i = 0; i < CORPUS_SEG_FRAMES; i++) {
+	x = reader_.Mid(start + i);
+	dx = x - prev;
+	ex += x * x;
+	edx += dx * dx;
+	prev = x;
+	lp += CORPUS_LP_COEF * (x - lp);
+	if ((lp >= 0.0f) != pos_lp) {
+	  pos_lp = !pos_lp;
+	  zc++;
+	}
+      }
+
+      float rms = sqrtf(ex / CORPUS_SEG_FRAMES);
+      if (rms <= IDX_SILENCE) return false;
+
+      float bright = (sr_ / (2.0f * M_PI)) * sqrtf(edx / ex);
+      float pitch = (zc * sr_) / (2.0f * CORPUS_SEG_FRAMES);
+      f[CORPUS_LOUD] = Unit((20.0f * log10f(rms / 32768.0f) - CORPUS_MIN_DB) / -CORPUS_MIN_DB);
+      f[CORPUS_BRIGHT] = Unit(log2f(fmaxf(bright, 1.0f) / CORPUS_MIN_HZ) / log2f(CORPUS_MAX_BRIGHT / CORPUS_MIN_HZ));
+      f[CORPUS_PITCH] = Unit(log2f(fmaxf(pitch, 1.0f) / CORPUS_MIN_HZ) / log2f(CORPUS_MAX_PITCH / CORPUS_MIN_HZ));
+      return true;
+    }
+
+    inline float Unit(float x)
+    {
+      return fminf(1.0f, fmaxf(0.0f, x));
+    }
+
+    // median of [lo, hi) on this depth's axis ends up in the middle, smaller to the left
+    void Split(size_t lo, size_t hi, size_t depth)
+    {
+      if ((hi - lo) < 2) return;
+      size_t mid = lo + ((hi - lo) >> 1);
+      Select(lo, hi, mid, depth % CORPUS_DIMS);
+      Split(lo, mid, depth + 1);
+      Split(mid + 1, hi, depth + 1);
+    }
+
+    // quickselect
+    void Select(size_t lo, size_t hi, size_t k, size_t axis)
+    {
+      size_t l, r, store;
+      float pivot;
+
+      while ((hi - lo) > 1) {
+	l = lo;
+	r = hi - 1;
+	Swap(lo + ((hi - lo) >> 1), r);
+	pivot = segs_[r].f[axis];
+	store = l;
+	for (size_t i = l; i < r; i++) {
+	  if (segs_[i].f[axis] < pivot) {
+	    Swap(i, store++);
+	  }
+	}
+	Swap(store, r);
+	if (store == k) return;
+	if (k < store) {
+	  hi = store;
+	} else {
+	  lo = store + 1;
+	}
+      }
+    }
+
+    inline void Swap(size_t a, size_t b)
+    {
+      corpus_seg_t t = segs_[a];
+      segs_[a] = segs_[b];
+      segs_[b] = t;
+    }
+
+    void Search(const float *target, size_t lo, size_t hi, size_t depth)
+    {
+      if ((lo >= hi) || (visits_ >= CORPUS_MAX_VISITS)) return;
+      visits_++;
+
+      size_t mid = lo + ((hi - lo) >> 1);
+      size_t axis = depth % CORPUS_DIMS;
+      float d = 0.0f, diff;
+      for (size_t i = 0; i < CORPUS_DIMS; i++) {
+	diff = target[i] - segs_[mid].f[i];
+	d += diff * diff;
+      }
+      if (d < best_d_) {
+	best_d_ = d;
+	best_ = mid;
+      }
+
+      diff = target[axis] - segs_[mid].f[axis];
+      if (diff < 0.0f) {
+	Search(target, lo, mid, depth + 1);
+	if ((diff * diff) < best_d_) Search(target, mid + 1, hi, depth + 1);
+      } else {
+	Search(target, mid + 1, hi, depth + 1);
+	if ((diff * diff) < best_d_) Search(target, lo, mid, depth + 1);
+      }
+    }
+
+    corpus_seg_t *segs_;
+    const sample_src_t *src_[CORPUS_MAX_WAVES];
+    SampleReader reader_;
+    size_t n_, max_segs_, best_, visits_;
+    float sr_, best_d_;
+    uint8_t waves_;
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "sample_phasor.h"
+#include "sample_src.h"
+#include "adpcm.h"
 
 typedef struct {
   float l;
@@ -15,15 +17,44 @@ class Grain
     Grain() {}
     ~Grain() {} 
 
-    void Init(float sr, T *start, size_t len, float vol, float *env, size_t env_len) 
+    void Init(float sr, const sample_src_t *src, float vol, float *env, size_t env_len) 
     {
-      sample_.Init(start, sr, len);
+      sr_ = sr;
+      SetSource(src);
       env_.Init(env, sr, env_len); 
       vol_ = vol;
+      width_ = 1.0f;
+      fade_ = 1.0f;
+      fade_step_ = 0.0f;
       done_ = true;
     }
 
 
+    // Grains can be pointed at a different wave between dispatches, concatenative mode does this
+    void SetSource(const sample_src_t *src)
+    {
+      src_ = src;
+      sample_.Init(src->start, sr_, src->len, src->chans, src->mask);
+      sample_.SetLoop(src->wrap);
+      if (src->adpcm != nullptr) {
+	cache_.Init(src->adpcm, src->chans);
+	sample_.SetCache(&cache_);
+      }
+      stereo_ = (src->chans == 2);
+    }
+
+    inline const sample_src_t *Source()
+    {
+      return src_;
+    }
+
+    // src has been rewritten where it is (bank reload, stream reopened), the next dispatch has to read it again
+    // a grain still playing carries on from its own copy, it never looks at src_ again
+    void Forget()
+    {
+      src_ = nullptr;
+    }
+
     // pitch usually in the range of 0.5 to 2.0 (-8va to +8va)
     // 1 is no pitch adjustment
     void SetSamplePitch(float pitch)
@@ -53,6 +84,7 @@ class Grain
       sample_.Reset();
       sample_.SetCurPos(sample_pos);
       env_.Reset();
+      Unfade();
       done_ = false;
     }
 
@@ -60,12 +92,26 @@ class Grain
     {
       sample_.Reset();
       env_.Reset();
+      Unfade();
       done_ = false;
     }
 
+    // cut it off
+    void Stop()
+    {
+      done_ = true;
+    }
+
+    // fade it out over frames rather than cut it off, poly mode does this when a voice is taken for another note
+    void Fade(size_t frames)
+    {
+      fade_step_ = 1.0f / ((frames > 0) ? frames : 1);
+    }
+
     void ResetEnv()
     {
       env_.Reset();
+      Unfade();
       done_ = false;
     }
 
@@ -84,19 +130,45 @@ class Grain
       vol_ = vol;
     }
 
-    // equal power panning
+    inline float GrainVol()
+    {
+      return vol_;
+    }
+
+    // equal power panning for mono samples
     // pan -> 0 = l, 1 = r
+    // stereo samples treat pan as balance instead
     void SetGrainPan(float pan)
     {
-      float pan_rads = (M_PI / 4) + pan * (-M_PI / 2);
-      float root_two_on_two = sqrtf(2.0f) / 2.0f;
-      float c = cosf(pan_rads);
-      float s = sinf(pan_rads);
-      pan_l_ = root_two_on_two * (c + s);
-      pan_r_ = root_two_on_two * (c - s);
+      if (stereo_) {
+	bal_l_ = fminf(1.0f, 2.0f * (1.0f - pan));
+	bal_r_ = fminf(1.0f, 2.0f * pan);
+	SetGrainWidth(width_);
+      } else {
+	float pan_rads = (M_PI / 4) + pan * (-M_PI / 2);
+	float root_two_on_two = sqrtf(2.0f) / 2.0f;
+	float c = cosf(pan_rads);
+	float s = sinf(pan_rads);
+	pan_l_ = root_two_on_two * (c + s);
+	pan_r_ = root_two_on_two * (c - s);
+      }
+    }
+
+    // stereo samples only
+    // width -> 0 = mono, 1 = original image
+    // folded into a 2x2 mix with the balance so Process doesn't do any extra work
+    void SetGrainWidth(float width)
+    {
+      width_ = width;
+      float direct = 0.5f * (1.0f + width);
+      float cross = 0.5f * (1.0f - width);
+      pan_l_ = bal_l_ * direct;
+      cross_l_ = bal_l_ * cross;
+      pan_r_ = bal_r_ * direct;
+      cross_r_ = bal_r_ * cross;
     }
 
-    void Dispatch(size_t sample_pos, float dur, float *env, float pitch, float pan, bool r)
+    void Dispatch(size_t sample_pos, float dur, float *env, float pitch, float pan, float width, bool r)
     {
       sample_.Reset();
       sample_.SetCurPos(sample_pos);
@@ -107,32 +179,64 @@ class Grain
       env_.SetDur(dur);
       env_.SetSample(env);
 
+      width_ = width;
       SetGrainPan(pan);
 
+      Unfade();
       done_ = false;
     }
 
     sample_t Process()
     {
-      float env, sample;
+      float env, sample, l, r;
       bool sample_done;
       sample_t out;
 
       if (done_) {
-	sample = 0.0f;
+	out.l = out.r = 0.0f;
+      } else if (stereo_) {
+	env = env_.Process(&done_) * vol_;
+	env *= Fading();
+	sample_.ProcessStereo(&sample_done, &l, &r);
+	l *= env;
+	r *= env;
+	out.l = (pan_l_ * l) + (cross_l_ * r);
+	out.r = (pan_r_ * r) + (cross_r_ * l);
       } else {
       	env = env_.Process(&done_);
+	env *= Fading();
 	sample = sample_.Process(&sample_done) * vol_ * env;
+	out.l = pan_l_ * sample;
+	out.r = pan_r_ * sample;
       }
-      out.l = pan_l_ * sample;
-      out.r = pan_r_ * sample;
       return out;
     }
 
   private:
+    inline void Unfade()
+    {
+      fade_ = 1.0f;
+      fade_step_ = 0.0f;
+    }
+
+    // 1 unless it's been told to Fade(), done once it gets to 0, after the envelope's had its say about done_
+    inline float Fading()
+    {
+      if (fade_step_ > 0.0f) {
+	fade_ -= fade_step_;
+	if (fade_ <= 0.0f) {
+	  fade_ = 0.0f;
+	  done_ = true;
+	}
+      }
+      return fade_;
+    }
+
     Sample<T> sample_;
     Sample<float> env_;
-    float vol_;
-    float pan_l_, pan_r_;
-    bool done_;
+    AdpcmCache cache_;
+    const sample_src_t *src_;
+    float sr_, vol_, width_, fade_, fade_step_;
+    float pan_l_, pan_r_, cross_l_, cross_r_, bal_l_, bal_r_;
+    bool done_, stereo_;
 };
@@ -1,11 +1,36 @@
 #pragma once
 
 #include "grain.h"
+#include "sample_src.h"
+#include "sample_index.h"
+#include "pitch_marks.h"
+#include "corpus.h"
+#include "voice.h"
 #include "crc_noise.h"
 
 #include "params.h"
 
 #define MAX_GRAINS 16
+// how much of the old layer survives each overdub pass, out of 256
+#define LIVE_OVERDUB_FBK 205
+// random spread around the target in concatenative mode so it's not the same segment every time
+#define CORPUS_JITTER 0.05f
+// time stretch grains, Hann windows a quarter of a grain apart add up to a constant 2
+#define STRETCH_GRAIN_SECS 0.06f
+#define STRETCH_OVERLAP 4
+// each grain can move this many frames either way to line up with the one before (~7.5mS at 48k)
+#define STRETCH_TOL 360
+// frames compared when lining them up, every other one is used
+#define STRETCH_CMP 128
+// the first pass at lining them up only tries every this many frames, on half the points
+#define STRETCH_COARSE 8
+// the scan head is pulled back into phase with the clock over about this long
+#define PHASE_CATCHUP_SECS 0.5f
+// most the scan rate is nudged to catch up with the clock before it just jumps, as a fraction of the rate
+#define PHASE_MAX_TRIM 0.1f
+// cloud mode scan heads, at full spread the last one runs this much faster than the scan rate
+#define MAX_HEADS 4
+#define HEAD_DETUNE 0.5f
 // Let's stick to 16bit samples for now
 // This can be templated later
 class Granulator
@@ -14,68 +39,137 @@ class Granulator
     Granulator() {}
     ~Granulator() {}
 
-    void Init(float sr, int16_t *start, size_t len, float *env, size_t env_len, bool loop, bool rev) 
+    void Init(float sr, const sample_src_t *src, float *env, size_t env_len, bool loop, bool rev) 
     {
       sr_ = sr;
-      sample_start_ = start;
-      len_ = len;
+      src_ = *src;
+      src_ptr_ = src;
+      len_ = src_.len;
+      width_ = DEFAULT_WIDTH;
       env_mem_ = env;
       env_len_ = env_len;
+      live_dly_ = 0.0f;
+      overdub_ = false;
+      skip_silence_ = snap_zc_ = true;
+      normalize_ = concat_ = psola_ = stretch_ = false;
+      stretch_hop_ = (int32_t)((STRETCH_GRAIN_SECS * sr_) / STRETCH_OVERLAP);
+      stretch_count_ = 0;
+      scan_rate_ = DEFAULT_SCAN_RATE;
+      beat_frames_ = 0.0f;
+      hann_env_ = env;
+      corpus_ = nullptr;
+      poly_ = false;
+      budget_ = MAX_GRAINS;
+      heads_count_ = 1;
+      head_spread_ = 0.0f;
+      head_weighted_ = false;
+      note_age_ = 0;
+      for (size_t v = 0; v < MAX_VOICES; v++) {
+	voices_[v].Init(sr_);
+      }
+      for (size_t m = 0; m < EXPR_CHANNELS; m++) {
+	for (size_t d = 0; d < EXPR_DIMS; d++) {
+	  expr_[m][d] = 0.0f;
+	}
+      }
+      for (size_t d = 0; d < CORPUS_DIMS; d++) {
+	target_[d] = 0.5f;
+      }
+      for (size_t i = 0; i < MAX_GRAINS; i++) {
+	silo[i].Init(sr_, src_ptr_, GrainVol(), env_mem_, env_len_);
+      }
       Setup(loop, rev);
-      live_ = filled_ = false;
+      live_ = false;
       rng.Init();
     }
 
     void Stop()
     {
       stop_ = true;
-      filled_ = false;
+      for (size_t v = 0; v < MAX_VOICES; v++) {
+	voices_[v].Release();
+      }
     }
 
+    // the first grain goes on the next sample if it was stopped, not whenever the density count gets round to it
     void Start()
     {
+      if (stop_) Trigger();
       stop_ = false;
     }
 
     void ReStart()
     {
       sample_pos_.Reset();
+      PlaceHeads();
+      Trigger();
       stop_ = false;
     }
 
-    void Reset(int16_t *start, size_t len, bool loop, bool rev) 
+    /*
+     * Switch to another wave, src has to stay put while any grain might still be reading it.
+     * Grains already going carry on with the old wave until their envelopes end, they keep their own copy
+     * of where it is, new ones pick up src when they're dispatched. Only the scan head and the settings
+     * are reset, so it's cheap enough to do in the callback at the sample a note asked for.
+     * A streamed wave's window is about to be refilled with something else, so its grains are cut.
+     */
+    void Reset(const sample_src_t *src, bool loop, bool rev) 
     {
-      sample_start_ = start;
-      len_ = len;
+      if (src_.win != nullptr) Cut(src_ptr_);
+      // src may have been filled in again since these grains last looked
+      for (size_t i = 0; i < MAX_GRAINS; i++) {
+	if (silo[i].Source() == src) silo[i].Forget();
+      }
+      src_ = *src;
+      src_ptr_ = src;
+      len_ = src_.len;
       Setup(loop, rev);
-      live_ = filled_ = false;
+      live_ = false;
+    }
+
+    // stops every grain reading src, nullptr for all of them, for when its memory is about to go
+    // whatever src gets loaded with next, the grains have to pick it up afresh
+    void Cut(const sample_src_t *src)
+    {
+      for (size_t i = 0; i < MAX_GRAINS; i++) {
+	if ((src == nullptr) || (silo[i].Source() == src)) {
+	  silo[i].Stop();
+	  silo[i].Forget();
+	}
+      }
     }
 
     /*
-     * This live looping is very naive, shoehorning the record buffer into a Phasor/SamplePhasor
-     * instead of something specifically designed for it.
-     * A proper record buffer should be in something like a delay line or circular buffer 
-     * where the start and end points are moved and wrapped accordingly as the write head moves.
-     * Maybe its possible to retrofit that into the existing grain code with a little more thought and effort
+     * Live mode records into src, a power of 2 ring of interleaved stereo with a write head that never stops.
+     * Grains read a settable delay behind the write head and wrap round with the ring,
+     * so they can start straight away rather than waiting for the buffer to fill.
+     * Freeze stops the write head, overdub mixes new input over what's already there.
      */
-    void Live(int16_t *start, size_t len) 
+    void Live(const sample_src_t *src) 
     {
-      sample_start_ = start;
-      len_ = len;
-      record_buf_ = sample_start_;
+      if (src_.win != nullptr) Cut(src_ptr_);
+      src_ = *src;
+      src_ptr_ = src;
+      len_ = src_.len;
+      record_buf_ = src_.start;
+      live_mask_ = len_ - 1;
+      // keep the longest grain clear of the write head coming round the other way
+      live_span_ = len_ - (size_t)(MAX_GRAIN_DUR * sr_ * MAX_GRAIN_PITCH);
       write_pos_ = 0;
       Setup(false, false);
       live_ = true;
-      filled_ = false;
     }
 
-    // don't allow this in live mode
+    // Audio callback only, it restarts the scan heads. don't allow this in live mode
     void ToggleSampleLoop()
     {
       if (!live_) {
 	sample_loop_ = sample_loop_ ? false : true;
       	sample_pos_.ToggleLoop();
       	if (sample_loop_) Start();
+	for (size_t v = 0; v < MAX_VOICES; v++) {
+	  voices_[v].Scan()->SetLoop(sample_loop_);
+	}
       }
     }
 
@@ -98,7 +192,14 @@ class Granulator
     void SetScanRate(float rate)
     {
       if (!live_) {
-	sample_pos_.SetPitch(rate);
+	scan_rate_ = rate;
+	sample_pos_.SetPitch(rate + trim_);
+	for (size_t v = 0; v < MAX_VOICES; v++) {
+	  voices_[v].Scan()->SetPitch(rate);
+	}
+	for (size_t h = 1; h < MAX_HEADS; h++) {
+	  heads_[h].SetPitch(rate * head_rate_[h]);
+	}
       }
     }
 
@@ -119,8 +220,21 @@ class Granulator
       float rand;
       float pitch = grain_pitch_;
       float pan = pan_;
-      for (size_t i = 0; i < MAX_GRAINS; i++) {
+      const sample_src_t *src = src_ptr_;
+      float target[CORPUS_DIMS];
+      for (size_t i = 0; i < budget_; i++) {
 	if (silo[i].IsDone()) {
+	  if (concat_ && !live_ && (corpus_ != nullptr)) {
+	    for (size_t d = 0; d < CORPUS_DIMS; d++) {
+	      target[d] = target_[d] + (CORPUS_JITTER * rng.Process());
+	    }
+	    corpus_->Nearest(target, &src, &sample_pos);
+	  }
+	  if (silo[i].Source() != src) {
+	    silo[i].SetSource(src);
+	  }
+	  // every kind of dispatch sets its own level, this grain's last go might have been a quieter psola or stretch one
+	  silo[i].SetGrainVol(GrainVol());
 	  if (random_pitch_) {
 	    rand = rng.Process();
 	    pitch = fminf(4.0f, fmaxf(0.25f, pitch * (1.0f + (rand * pitch_dist_))));
@@ -129,12 +243,27 @@ class Granulator
 	    rand = rng.Process();
 	    pan = fminf(1.0f, fmaxf(0.0f, pan + (0.5f * rand * pan_dist_)));
 	  }
-	  silo[i].Dispatch(sample_pos, grain_dur_, env_mem_, pitch, pan, reverse_grain_);
+	  if (live_) {
+	    // start at the newest frame, and far enough back that faster grains don't catch the write head
+	    sample_pos = (sample_pos - 1 - ((reverse_grain_ || (pitch <= 1.0f)) ? 0 : \
+		  (size_t)(grain_dur_ * sr_ * (pitch - 1.0f)))) & live_mask_;
+	  }
+	  silo[i].Dispatch(sample_pos, grain_dur_, env_mem_, pitch, pan, width_, reverse_grain_);
 	  return;
 	}
       }
     }
 
+    /*
+     * Layers share the grains out, each only starts grains in the first n of its own so all of them
+     * together never have more than MAX_GRAINS going. Any already going past n play out.
+     */
+    void SetGrainBudget(size_t n)
+    {
+      budget_ = (n < 1) ? 1 : ((n > MAX_GRAINS) ? MAX_GRAINS : n);
+      Share();
+    }
+
     // density is number of samples until a new grain is dispatched
     void SetDensity(int32_t density)
     {
@@ -142,11 +271,15 @@ class Granulator
     }
 
 
-    // don't allow this in live mode
+    // Audio callback only, the heads are copies of the scan head. don't allow this in live mode
     void ToggleScanReverse()
     {
       if (!live_) {
 	sample_pos_.ToggleReverse();
+	for (size_t v = 0; v < MAX_VOICES; v++) {
+	  voices_[v].Scan()->SetReverse(sample_pos_.IsReverse());
+	}
+	PlaceHeads();
       }
     }
 
@@ -184,6 +317,12 @@ class Granulator
     {
       if (!live_) {
 	sample_pos_.SetStartPos(pos);
+	for (size_t v = 0; v < MAX_VOICES; v++) {
+	  voices_[v].Scan()->SetStartPos(pos);
+	}
+	for (size_t h = 1; h < MAX_HEADS; h++) {
+	  heads_[h].SetStartPos(pos);
+	}
       }
     }
 
@@ -192,6 +331,12 @@ class Granulator
     {
       if (!live_) {
 	sample_pos_.SetEndPos(pos);
+	for (size_t v = 0; v < MAX_VOICES; v++) {
+	  voices_[v].Scan()->SetEndPos(pos);
+	}
+	for (size_t h = 1; h < MAX_HEADS; h++) {
+	  heads_[h].SetEndPos(pos);
+	}
       }
     }
 
@@ -205,37 +350,320 @@ class Granulator
       pan_dist_ = pan_dist;
     }
 
+    // only affects stereo samples, 0 = mono, 1 = original image
+    void SetWidth(float width)
+    {
+      width_ = width;
+    }
+
     bool IsLive() {
       return live_;
     }
 
+    // dly is how far behind the write head grains start, 0 to 1 of the live buffer
+    void SetLiveDelay(float dly)
+    {
+      live_dly_ = dly;
+    }
+
+    void ToggleOverdub()
+    {
+      overdub_ = !overdub_;
+    }
+
+    // these only do anything for waves with an index
+    void ToggleSkipSilence()
+    {
+      skip_silence_ = !skip_silence_;
+    }
+
+    void ToggleSnapZC()
+    {
+      snap_zc_ = !snap_zc_;
+    }
+
+    // concatenative mode picks each grain from the whole bank by how close it sounds to the target
+    void SetCorpus(Corpus *corpus)
+    {
+      corpus_ = corpus;
+    }
+
+    void ToggleConcat()
+    {
+      concat_ = !concat_;
+    }
+
+    // dim is one of CORPUS_LOUD, CORPUS_BRIGHT, CORPUS_PITCH, val is 0 to 1
+    void SetTarget(size_t dim, float val)
+    {
+      target_[dim] = val;
+    }
+
+    /*
+     * Pitch synchronous mode, for waves that have had their pitch marks found.
+     * Each grain is two periods long around a mark, Hann windowed and played at its original pitch,
+     * so the formants stay put. Grain pitch sets how often they're started (a period apart divided by pitch)
+     * and scan rate sets how fast the marks are walked through, so pitch and time are independent.
+     */
+    void TogglePsola()
+    {
+      psola_ = !psola_;
+      psola_count_ = 0.0f;
+    }
+
+    /*
+     * Time stretch mode, for tempo locked loops.
+     * Grain size and spacing are fixed so the Hann windows always add up to the same level,
+     * and nothing is randomised, so only the scan rate (BPM over the wave's BPM with a clock) moves.
+     * Each grain is shifted a little so it carries on from where the last one was going (WSOLA),
+     * otherwise overlapping grains from different places partly cancel as the rate moves away from 1.
+     * Audio callback only, SyncPhase() trims the rate from there too.
+     */
+    void ToggleStretch()
+    {
+      stretch_ = !stretch_;
+      stretch_count_ = 0;
+      stretch_last_ = SIZE_MAX;
+      trim_ = 0.0f;
+      SetScanRate(scan_rate_);
+    }
+
+    // how many of the wave's frames make up one beat
+    void SetBeatFrames(float frames)
+    {
+      beat_frames_ = frames;
+    }
+
+    /*
+     * Phase lock to the sequencer, call once a block with where the transport is.
+     * The scan head should be beats * beat frames into the loop, the scan rate is trimmed so it gets
+     * there over PHASE_CATCHUP_SECS rather than jumping, unless it's too far out for that.
+     */
+    void SyncPhase(double beats)
+    {
+      if (live_ || freeze_ || stop_ || (beat_frames_ <= 0.0f) || (scan_rate_ <= 0.0f)) return;
+
+      double start = sample_pos_.GetStartPos();
+      double span = sample_pos_.GetEndPos() - start;
+      double off = fmod(beats * beat_frames_, span);
+      double want = sample_pos_.IsReverse() ? sample_pos_.GetEndPos() - off : start + off;
+      double err = want - sample_pos_.GetPos();
+      // the short way round the loop
+      if (err > (0.5 * span)) {
+	err -= span;
+      } else if (err < (-0.5 * span)) {
+	err += span;
+      }
+      if (sample_pos_.IsReverse()) err = -err;
+
+      trim_ = (float)err / (PHASE_CATCHUP_SECS * sr_);
+      if (fabsf(trim_) > (PHASE_MAX_TRIM * scan_rate_)) {
+	sample_pos_.SetCurPos(want);
+	trim_ = 0.0f;
+      }
+      SetScanRate(scan_rate_);
+    }
+
+    // psola and stretch grains are always Hann windowed whatever the grain envelope is
+    // overlapping ones the right distance apart add up flat, nothing else does
+    void SetHannEnv(float *env)
+    {
+      hann_env_ = env;
+    }
+
+    // Audio callback only, grains already going are scaled rather than set, psola and stretch ones are quieter than the rest
+    // the rest pick their level up when they're next dispatched
+    void ToggleNormalize()
+    {
+      float was = GrainVol();
+      normalize_ = !normalize_;
+      float k = GrainVol() / was;
+      for (size_t i = 0; i < MAX_GRAINS; i++) {
+	if (!silo[i].IsDone()) silo[i].SetGrainVol(silo[i].GrainVol() * k);
+      }
+    }
+
+    // the streamer follows these from the main loop
+    size_t GetScanPos()
+    {
+      return sample_pos_.GetPos();
+    }
+
+    bool ScanReverse()
+    {
+      return sample_pos_.IsReverse();
+    }
+
+    float GetScanRate()
+    {
+      return sample_pos_.GetRate();
+    }
+
     void ToggleRandomPan()
     {
       random_pan_ = !random_pan_;
     }
 
-    sample_t Process(int16_t input)
+    /*
+     * Cloud mode, up to MAX_HEADS scan heads going over the wave at once, each with its own rate, direction
+     * and offset from the main one. Grains take turns between the heads, or with weighting on, pick one
+     * at random by weight, all from the same grains, so it's a lot more going on than one head and
+     * scatter for the price of a few phasors. The extra heads always loop between start and end.
+     * Normal density grains from an in memory wave only, like poly mode.
+     */
+    // Audio callback only, like everything that places the heads. 1 is just the main head
+    void SetHeads(size_t n)
+    {
+      heads_count_ = (n < 1) ? 1 : ((n > MAX_HEADS) ? MAX_HEADS : n);
+      SetHeadSpread(head_spread_);
+    }
+
+    // 0 to 1, lays the heads out evenly from the main one, faster and slower by turns,
+    // the odd ones going backwards over half way, and each weighted half as much as the last
+    void SetHeadSpread(float spread)
+    {
+      float detune;
+
+      head_spread_ = spread;
+      for (size_t h = 1; h < MAX_HEADS; h++) {
+	detune = (spread * HEAD_DETUNE * h) / (MAX_HEADS - 1);
+	head_rate_[h] = (h & 1) ? 1.0f + detune : 1.0f - detune;
+	head_rev_[h] = (spread > 0.5f) && (h & 1);
+	head_offset_[h] = (float)h / heads_count_;
+	head_weight_[h] = 1.0f / (1 << h);
+      }
+      PlaceHeads();
+    }
+
+    // rate is times the scan rate, rev against the main head's direction, offset a fraction of start to end
+    void SetHead(size_t h, float rate, bool rev, float offset, float weight)
+    {
+      if ((h < 1) || (h >= MAX_HEADS)) return;
+      head_rate_[h] = rate;
+      head_rev_[h] = rev;
+      head_offset_[h] = offset;
+      head_weight_[h] = weight;
+      PlaceHeads();
+    }
+
+    void ToggleHeadWeights()
+    {
+      head_weighted_ = !head_weighted_;
+    }
+
+    size_t GetHeads()
+    {
+      return heads_count_;
+    }
+
+    /*
+     * Poly mode, each note gets a voice with its own pitch (times the grain pitch), scan head and gate envelope.
+     * The voices share the one grain pool, each is allowed an equal share of it. A voice that's at its share
+     * skips grains rather than cutting one short, a new voice that's short of its share when the pool's empty
+     * takes the oldest grain of one that's over. Always the normal density grains from an in memory wave,
+     * live and streamed waves stay mono, as do psola, stretch and concatenative mode.
+     */
+    void TogglePoly()
+    {
+      poly_ = !poly_;
+      poly_reset_ = true;
+    }
+
+    bool IsPoly()
+    {
+      return poly_;
+    }
+
+    // Audio callback only, member is the MPE channel whose expression the note follows, 0 for none
+    void NoteOn(uint8_t note, float pitch, uint8_t member)
+    {
+      uint8_t v = 0;
+
+      member &= EXPR_CHANNELS - 1;
+      NoteOff(note, member);
+      // an idle voice, or the one that's been going longest, ones already let go first
+      for (uint8_t i = 1; i < MAX_VOICES; i++) {
+	if (Quieter(&voices_[i], &voices_[v])) v = i;
+      }
+      if (voices_[v].Active()) EndVoice(v);
+      voices_[v].Start(note, pitch, member, &sample_pos_, expr_[member], note_age_++);
+      stop_ = false;
+      Share();
+    }
+
+    // Audio callback only
+    void NoteOff(uint8_t note, uint8_t member)
+    {
+      member &= EXPR_CHANNELS - 1;
+      for (uint8_t v = 0; v < MAX_VOICES; v++) {
+	if (voices_[v].Held() && (voices_[v].Note() == note) && (voices_[v].Member() == member)) voices_[v].Release();
+      }
+    }
+
+    /*
+     * Per note bend, pressure and slide bend the voice's pitch, thicken its grains and scatter them.
+     * The main loop writes the latest of each and the callback reads them once a block, they're single
+     * floats so there's nothing to lock and a flood of them just overwrites. Member 0 is never set,
+     * so notes that aren't MPE play as they were.
+     */
+    // Main loop only
+    void SetExpression(uint8_t member, uint8_t dim, float val)
+    {
+      if ((member > 0) && (member < EXPR_CHANNELS) && (dim < EXPR_DIMS)) {
+	expr_[member][dim] = val;
+      }
+    }
+
+    // Audio callback only, once a block of frames
+    void Express(size_t frames)
+    {
+      if (!poly_) return;
+      float coef = 1.0f - expf(-(float)frames / (EXPR_SMOOTH_SECS * sr_));
+      for (uint8_t v = 0; v < MAX_VOICES; v++) {
+	if (voices_[v].Active()) voices_[v].Express(expr_[voices_[v].Member()], coef);
+      }
+    }
+
+    sample_t Process(int16_t in_l, int16_t in_r)
     {
       sample_t s;
       sample_t out = {0, 0};
       float rand;
-      int32_t offset;
-      size_t pos = 0;
-      bool eot = false;
+      size_t pos = 0, offset, span;
+      bool eot = false, head_eot;
+
+      if (poly_reset_) {
+	ResetVoices();
+      }
+      if (poly_ && !live_ && (src_.win == nullptr)) return ProcessPoly();
 
       if (stop_) return {0.0f, 0.0f};
 
-      if (freeze_)
-      {
+      if (live_) {
+	if (!freeze_) { Record(in_l, in_r); }
+	pos = write_pos_;
+      } else if (freeze_) {
 	pos = sample_pos_.GetPos();
       } else {
-	if (live_) { record_buf_[write_pos_] = input; }
 	pos = sample_pos_.Process(&eot);
-	write_pos_ = pos;
-	if (eot) { filled_ = true; }
+	for (size_t h = 1; h < heads_count_; h++) {
+	  heads_[h].Process(&head_eot);
+	}
       }
 
-      if (density_count_-- < 0)
+      if (stretch_ && !live_) {
+	if (--stretch_count_ <= 0) {
+	  stretch_count_ = stretch_hop_;
+	  if ((src_.win == nullptr) || InWindow(&pos)) {
+	    DispatchStretch(pos);
+	  }
+	}
+      } else if (PsolaReady()) {
+	psola_count_ -= 1.0f;
+	if (psola_count_ <= 0.0f) {
+	  DispatchPsola(pos);
+	}
+      } else if (density_count_-- < 0)
       {
 	if (random_density_) {
 	  rand = rng.Process();
@@ -244,24 +672,28 @@ class Granulator
 	  density_count_ = density_;
 	}
 
-	if (scatter_grain_) {
-	  rand = rng.Process();
-	  offset = rand * scatter_dist_;
-
-
-// Do the pragma dance - we take care of wrap around 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wsign-compare"
-	  offset += pos;
-	  if (offset < 0) {
-	    offset += len_;
-	  } else if (offset > len_) {
-	    offset -= len_;
+	if ((heads_count_ > 1) && !live_ && (src_.win == nullptr)) {
+	  pos = NextHead();
+	}
+	if (live_) {
+	  // only ever scatter backwards, ahead of the write head is a lap old, and never so far back
+	  // that the write head comes round again before this grain's done with it
+	  span = grain_dur_ * sr_ * (random_pitch_ ? MAX_GRAIN_PITCH : grain_pitch_);
+	  offset = live_dly_ * live_span_;
+	  if (scatter_grain_) {
+	    offset += fabsf(rng.Process()) * scatter_dist_;
 	  }
-#pragma GCC diagnostic pop
-	  pos = (size_t)offset;
+	  if (offset > (live_span_ - span)) offset = live_span_ - span;
+	  pos = (pos - offset) & live_mask_;
+	} else if (scatter_grain_) {
+	  pos = Scatter(pos, scatter_dist_);
+	}
+	if (src_.index != nullptr) {
+	  pos = Refine(pos);
+	}
+	if ((src_.win == nullptr) || InWindow(&pos)) {
+	  Dispatch(pos);
 	}
-	if (!live_ || filled_) { Dispatch(pos); }
       }
 
       for (size_t i = 0; i < MAX_GRAINS; i++) {
@@ -281,12 +713,387 @@ class Granulator
 
   private:
 
+    sample_t ProcessPoly()
+    {
+      sample_t s;
+      sample_t out = {0, 0};
+      Voice *voice;
+      size_t pos;
+      bool eot;
+      uint8_t owner;
+      float level;
+
+      for (uint8_t v = 0; v < MAX_VOICES; v++) {
+	voice = &voices_[v];
+	if (!voice->Active()) continue;
+	if (!voice->Process()) {
+	  EndVoice(v);
+	  Share();
+	  continue;
+	}
+	pos = voice->Scan()->Process(&eot);
+	if (eot && !sample_loop_) voice->Release();
+	if (voice->Due()) {
+	  voice->Wait((random_density_ ? rng.Process() * density_ : density_) / (1.0f + voice->Pressure() * (EXPR_DENSITY - 1.0f)));
+	  DispatchVoice(v, pos);
+	}
+      }
+
+      for (size_t i = 0; i < MAX_GRAINS; i++) {
+	if (!silo[i].IsDone()) {
+	  s = silo[i].Process();
+	  owner = pool_.Owner(i);
+	  // orphans have their old voice's level in with their own, nobody's play out as they are
+	  level = (owner >= MAX_VOICES) ? 1.0f : voices_[owner].Level();
+	  out.l += s.l * level;
+	  out.r += s.r * level;
+	  if (silo[i].IsDone() && (owner != NO_VOICE)) pool_.Release(i);
+	}
+      }
+
+      out.l = fminf(1.0f, fmaxf(-1.0f, out.l));
+      out.r = fminf(1.0f, fmaxf(-1.0f, out.r));
+      return out;
+    }
+
+    void DispatchVoice(uint8_t v, size_t pos)
+    {
+      float rand;
+      float pitch = voices_[v].Pitch() * grain_pitch_;
+      float pan = pan_;
+      size_t dist = (scatter_grain_ ? scatter_dist_ : 0) + (size_t)(voices_[v].Slide() * EXPR_SCATTER * len_);
+      int g;
+
+      // at its share, skip this one rather than cut a grain off
+      if (pool_.Count(v) >= share_) return;
+      g = pool_.Alloc(v);
+      if (g == NO_GRAIN) {
+	// one voice is looked at per try so this stays O(1), whichever's over its share gives up its oldest
+	g = pool_.Oldest(steal_);
+	if ((g != NO_GRAIN) && (pool_.Count(steal_) > share_)) {
+	  pool_.Move(g, v);
+	} else {
+	  g = NO_GRAIN;
+	}
+	steal_ = (steal_ + 1) % MAX_VOICES;
+	if (g == NO_GRAIN) return;
+      }
+
+      if (dist > 0) {
+	pos = Scatter(pos, dist);
+      }
+      if (src_.index != nullptr) {
+	pos = Refine(pos);
+      }
+      if (random_pitch_) {
+	rand = rng.Process();
+	pitch *= 1.0f + (rand * pitch_dist_);
+      }
+      pitch = fminf(4.0f, fmaxf(0.25f, pitch));
+      if (random_pan_) {
+	rand = rng.Process();
+	pan = fminf(1.0f, fmaxf(0.0f, pan + (0.5f * rand * pan_dist_)));
+      }
+      if (silo[g].Source() != src_ptr_) {
+	silo[g].SetSource(src_ptr_);
+      }
+      silo[g].SetGrainVol(GrainVol());
+      silo[g].Dispatch(pos, grain_dur_, env_mem_, pitch, pan, width_, reverse_grain_);
+    }
+
+    // where the next grain starts, head 0 is the main one
+    inline size_t NextHead()
+    {
+      float r, w;
+      size_t h = 0;
+
+      if (head_weighted_) {
+	w = 1.0f;
+	for (size_t i = 1; i < heads_count_; i++) {
+	  w += head_weight_[i];
+	}
+	r = 0.5f * (rng.Process() + 1.0f) * w - 1.0f;
+	while ((r >= 0.0f) && (h + 1 < heads_count_)) {
+	  r -= head_weight_[++h];
+	}
+      } else {
+	h = next_head_;
+	next_head_ = (next_head_ + 1 < heads_count_) ? next_head_ + 1 : 0;
+      }
+      return (h == 0) ? sample_pos_.GetPos() : heads_[h].GetPos();
+    }
+
+    // the extra heads take the main one's settings and go to their offsets from it
+    void PlaceHeads()
+    {
+      double start = sample_pos_.GetStartPos();
+      double span = sample_pos_.GetEndPos() - start;
+      double pos;
+
+      for (size_t h = 1; h < MAX_HEADS; h++) {
+	heads_[h] = sample_pos_;
+	heads_[h].SetLoop(true);
+	heads_[h].SetReverse(sample_pos_.IsReverse() != head_rev_[h]);
+	pos = fmod(sample_pos_.GetPos() - start + (head_offset_[h] * span), span);
+	heads_[h].SetCurPos(start + ((pos < 0.0) ? pos + span : pos));
+	heads_[h].SetPitch(scan_rate_ * head_rate_[h]);
+      }
+      next_head_ = 0;
+    }
+
+    // idle beats active, released beats held, then oldest first
+    inline bool Quieter(Voice *a, Voice *b)
+    {
+      if (a->Active() != b->Active()) return !a->Active();
+      if (a->Held() != b->Held()) return !a->Held();
+      return (int32_t)(a->Age() - b->Age()) < 0;
+    }
+
+    // the voice is done or taken, its grains fade out as orphans at the level it was at
+    void EndVoice(uint8_t v)
+    {
+      int g;
+      while ((g = pool_.Oldest(v)) != NO_GRAIN) {
+	silo[g].SetGrainVol(silo[g].GrainVol() * voices_[v].Level());
+	silo[g].Fade(VOICE_STEAL_SECS * sr_);
+	pool_.Move(g, ORPHANS);
+      }
+      voices_[v].Init(sr_);
+    }
+
+    void Share()
+    {
+      uint8_t n = 0;
+      for (uint8_t v = 0; v < MAX_VOICES; v++) {
+	if (voices_[v].Active()) n++;
+      }
+      share_ = budget_ / ((n > 0) ? n : 1);
+      // with more voices than grains each still gets one, the pool's the limit then
+      if (share_ < 1) share_ = 1;
+    }
+
+    // anything still going, from mono mode or the voices before, plays out as an orphan
+    void ResetVoices()
+    {
+      bool busy[MAX_GRAINS];
+
+      for (size_t v = 0; v < MAX_VOICES; v++) {
+	voices_[v].Init(sr_);
+      }
+      for (size_t i = 0; i < MAX_GRAINS; i++) {
+	busy[i] = !silo[i].IsDone();
+      }
+      pool_.Init(busy);
+      share_ = budget_;
+      steal_ = 0;
+      poly_reset_ = false;
+    }
+
+    // somewhere within dist of pos, wrapping round the wave
+    inline size_t Scatter(size_t pos, size_t dist)
+    {
+      int32_t offset = rng.Process() * dist;
+
+// Do the pragma dance - we take care of wrap around 
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-compare"
+      offset += pos;
+      if (offset < 0) {
+	offset += len_;
+      } else if (offset > len_) {
+	offset -= len_;
+      }
+#pragma GCC diagnostic pop
+      return (size_t)offset;
+    }
+
+    // Lookups into the load time analysis, no searching
+    // Jump over silence to the next loud block, then back to that block's first zero crossing
+    inline size_t Refine(size_t pos)
+    {
+      size_t blk;
+      const idx_block_t *b;
+
+      // scatter and the heads can land on len_, which is one block past the end of the index when len_ is a whole number of blocks
+      if (pos >= len_) pos = len_ - 1;
+      blk = pos >> IDX_BLOCK_SHIFT;
+      b = &src_.index->blocks[blk];
+      if (skip_silence_ && b->skip) {
+	blk += b->skip;
+	b += b->skip;
+	pos = blk << IDX_BLOCK_SHIFT;
+      }
+      if (snap_zc_) {
+	pos = (blk << IDX_BLOCK_SHIFT) + b->zc;
+      }
+      return (pos < len_) ? pos : len_ - 1;
+    }
+
+    inline bool PsolaReady()
+    {
+      return psola_ && !live_ && !concat_ && (src_.marks != nullptr) && src_.marks->ready;
+    }
+
+    // last mark at or before pos
+    inline size_t FindMark(size_t pos)
+    {
+      const uint32_t *marks = src_.marks->pos;
+      size_t lo = 0, hi = src_.marks->n - 1, mid;
+      while (lo < hi) {
+	mid = (lo + hi + 1) >> 1;
+	if (marks[mid] <= pos) {
+	  lo = mid;
+	} else {
+	  hi = mid - 1;
+	}
+      }
+      return lo;
+    }
+
+    void DispatchPsola(size_t pos)
+    {
+      const uint32_t *marks = src_.marks->pos;
+      size_t k = FindMark(pos);
+      if (k >= (src_.marks->n - 1)) k = src_.marks->n - 2;
+      size_t period = marks[k + 1] - marks[k];
+      size_t start = (marks[k] > period) ? marks[k] - period : 0;
+
+      // the next one starts a period later, sooner or later for higher or lower pitches
+      psola_count_ += period / grain_pitch_;
+      for (size_t i = 0; i < budget_; i++) {
+	if (silo[i].IsDone()) {
+	  if (silo[i].Source() != src_ptr_) {
+	    silo[i].SetSource(src_ptr_);
+	  }
+	  // grain_pitch_ of them overlap at any time, below 1 they start to leave gaps instead
+	  silo[i].SetGrainVol(GrainVol() / fmaxf(1.0f, grain_pitch_));
+	  silo[i].Dispatch(start, (2.0f * period) / sr_, hann_env_, 1.0f, pan_, width_, false);
+	  return;
+	}
+      }
+    }
+
+    void DispatchStretch(size_t pos)
+    {
+      if (stretch_last_ != SIZE_MAX) {
+	pos = Align(pos, stretch_last_ + (size_t)(stretch_hop_ * grain_pitch_));
+      }
+      stretch_last_ = pos;
+      for (size_t i = 0; i < budget_; i++) {
+	if (silo[i].IsDone()) {
+	  if (silo[i].Source() != src_ptr_) {
+	    silo[i].SetSource(src_ptr_);
+	  }
+	  silo[i].SetGrainVol(GrainVol() / (STRETCH_OVERLAP / 2));
+	  silo[i].Dispatch(pos, (float)(stretch_hop_ * STRETCH_OVERLAP) / sr_, hann_env_, grain_pitch_, pan_, width_, reverse_grain_);
+	  return;
+	}
+      }
+    }
+
+    // the start near pos that best matches what the last grain would have played next
+    // this is in the callback, so a coarse search over the whole range then a fine one around the best of that
+    // compressed waves would decode a block for most of the reads so they're left where they are, like streamed ones
+    size_t Align(size_t pos, size_t next)
+    {
+      float ref[STRETCH_CMP / 2];
+      size_t lo, hi, best;
+
+      if ((src_.win != nullptr) || (src_.adpcm != nullptr) || reverse_grain_) return pos;
+      lo = (pos > STRETCH_TOL) ? pos - STRETCH_TOL : 0;
+      hi = pos + STRETCH_TOL;
+      if (((hi + STRETCH_CMP) > len_) || ((next + STRETCH_CMP) > len_)) return pos;
+
+      for (size_t k = 0; k < (STRETCH_CMP / 2); k++) {
+	ref[k] = reader_.Mid(next + (2 * k));
+      }
+      best = Match(ref, lo, hi, STRETCH_COARSE, 2, pos);
+      lo = (best > (lo + STRETCH_COARSE)) ? best - STRETCH_COARSE : lo;
+      hi = ((best + STRETCH_COARSE) < hi) ? best + STRETCH_COARSE : hi;
+      return Match(ref, lo, hi, 2, 1, best);
+    }
+
+    // best correlation with ref for starts lo to hi every step frames, using every stride'th point of ref
+    size_t Match(const float *ref, size_t lo, size_t hi, size_t step, size_t stride, size_t best)
+    {
+      float c, best_c = -INFINITY;
+
+      for (size_t p = lo; p <= hi; p += step) {
+	c = 0.0f;
+	for (size_t k = 0; k < (STRETCH_CMP / 2); k += stride) {
+	  c += ref[k] * reader_.Mid(p + (2 * k));
+	}
+	if (c > best_c) {
+	  best_c = c;
+	  best = p;
+	}
+      }
+      return best;
+    }
+
+    inline float GrainVol()
+    {
+      return (normalize_ && (src_.index != nullptr)) ? DEFAULT_GRAIN_VOL * src_.index->gain : DEFAULT_GRAIN_VOL;
+    }
+
+    inline void Record(int16_t in_l, int16_t in_r)
+    {
+      int16_t *frame = &record_buf_[2 * write_pos_];
+      if (overdub_) {
+	frame[0] = Overdub(frame[0], in_l);
+	frame[1] = Overdub(frame[1], in_r);
+      } else {
+	frame[0] = in_l;
+	frame[1] = in_r;
+      }
+      write_pos_ = (write_pos_ + 1) & live_mask_;
+    }
+
+    // old layers fade a little each lap so they don't pile up into clipping
+    inline int16_t Overdub(int16_t old, int16_t in)
+    {
+      int32_t s = ((old * LIVE_OVERDUB_FBK) >> 8) + in;
+      return (s > 32767) ? 32767 : ((s < -32768) ? -32768 : s);
+    }
+
+    // Streamed samples only have a window around the scan head in memory
+    // If the scan head has outrun the streamer skip the grain rather than play stale memory,
+    // otherwise pull scattered grains in far enough that they finish inside the window
+    bool InWindow(size_t *pos)
+    {
+      stream_win_t *win = src_.win;
+      size_t scan = sample_pos_.GetPos();
+      size_t lo, hi, span;
+
+      if (win->seq & 1) return false;
+      lo = win->lo;
+      hi = win->hi;
+      span = grain_dur_ * sr_ * (random_pitch_ ? MAX_GRAIN_PITCH : grain_pitch_);
+      if ((scan < lo) || (scan >= hi) || ((hi - lo) <= (2 * span))) {
+	win->underruns++;
+	return false;
+      }
+      *pos = (*pos < (lo + span)) ? (lo + span) : ((*pos > (hi - span)) ? (hi - span) : *pos);
+      return true;
+    }
+
+    void Trigger()
+    {
+      density_count_ = -1;
+      psola_count_ = 0.0f;
+      stretch_count_ = 0;
+    }
+
     void Setup(bool loop, bool rev)
     {
       sample_pos_.Init(sr_, len_);
       sample_loop_ = loop;
       sample_pos_.SetLoop(sample_loop_);
       density_count_ = -1;
+      trim_ = 0.0f;
+      stretch_last_ = SIZE_MAX;
+      poly_reset_ = true;
+      reader_.Init(&src_);
       SetGrainDuration(DEFAULT_GRAIN_DUR);
       SetGrainPitch(DEFAULT_GRAIN_PITCH);
       SetScanRate(DEFAULT_SCAN_RATE);
@@ -297,18 +1104,18 @@ class Granulator
       SetPanDist(DEFAULT_PAN_DIST);
       reverse_grain_ = rev;
       sample_pos_.SetReverse(rev);
+      SetHeadSpread(head_spread_);
       stop_ = random_pitch_ = scatter_grain_ = random_density_ = random_pan_ = false;
-      for (size_t i = 0; i < MAX_GRAINS; i++) {
-	silo[i].Init(sr_, sample_start_, len_, DEFAULT_GRAIN_VOL, env_mem_, env_len_);
-      }
     }
 
     Grain<int16_t> silo[MAX_GRAINS];
-    Phasor sample_pos_;
-    int16_t *sample_start_;  
+    ScanPhasor sample_pos_;
+    sample_src_t src_;
+    // the caller's, grains are pointed at this so they can tell a new wave from the one they've got
+    const sample_src_t *src_ptr_;
     size_t len_, env_len_, scatter_dist_, write_pos_;
     int32_t density_, density_count_;
-    float sr_, grain_dur_, grain_pitch_, pitch_dist_, pan_, pan_dist_;
+    float sr_, grain_dur_, grain_pitch_, pitch_dist_, pan_, pan_dist_, width_;
     float *env_mem_;
     bool sample_loop_, stop_, reverse_grain_, scatter_grain_, \
 	 random_pitch_, random_density_, freeze_, random_pan_;
@@ -316,6 +1123,31 @@ class Granulator
 
     // used for live record buffer only
     int16_t *record_buf_;  
-    bool live_, filled_;
+    size_t live_mask_, live_span_;
+    float live_dly_;
+    bool live_, overdub_;
+    bool skip_silence_, snap_zc_, normalize_, concat_, psola_;
+    float *hann_env_;
+    float psola_count_;
+    bool stretch_;
+    int32_t stretch_hop_, stretch_count_;
+    size_t stretch_last_;
+    SampleReader reader_;
+    float scan_rate_, trim_, beat_frames_;
+    Corpus *corpus_;
+    float target_[CORPUS_DIMS];
+    Voice voices_[MAX_VOICES];
+    volatile float expr_[EXPR_CHANNELS][EXPR_DIMS];
+    GrainPool<MAX_GRAINS> pool_;
+    uint32_t note_age_;
+    uint8_t share_, steal_;
+    size_t budget_;
+    // heads_[0] isn't used, the main head is sample_pos_
+    ScanPhasor heads_[MAX_HEADS];
+    float head_rate_[MAX_HEADS], head_offset_[MAX_HEADS], head_weight_[MAX_HEADS], head_spread_;
+    bool head_rev_[MAX_HEADS], head_weighted_;
+    size_t heads_count_, next_head_;
+    bool poly_;
+    volatile bool poly_reset_;
 };
 
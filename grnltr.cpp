@@ -26,17 +26,39 @@
 #include "EventQueue.h"
 #include "grnltr.h"
 #include "status.h"
+#include "wav_convert.h"
+#include "adpcm.h"
+#include "stream.h"
+#include "wav_writer.h"
+#include "bounce.h"
+#include "transport.h"
+#include "sample_index.h"
+#include "spsc_queue.h"
+#include "block_clock.h"
+#include "snapshot.h"
+#include "smoother.h"
+#include "scheduler.h"
+#ifdef DEBUG_POD
+#include "util/CpuLoadMeter.h"
+#endif
 
 using namespace daisy;
 using namespace daisysp;
 
-static Granulator grnltr;
+static Granulator grnltrs[MAX_LAYERS];
+// layer 0, the main one
+static Granulator &grnltr = grnltrs[0];
 static Decimator crush_l;
 static Decimator crush_r;
 static DelayLine<float, MAX_DELAY> dell;
 static DelayLine<float, MAX_DELAY> delr;
 MidiMsgHandler<HW_TYPE> mmh;
 EventQueue<QUEUE_LENGTH> eq;
+#ifdef DEBUG_POD
+// longest an event has waited to be handled, mS
+uint32_t event_wait = 0;
+CpuLoadMeter cpu_meter;
+#endif
 
 float rect_env[GRAIN_ENV_SIZE];
 float gauss_env[GRAIN_ENV_SIZE];
@@ -49,20 +71,70 @@ size_t cur_grain_env = DEFAULT_GRAIN_ENV;
 
 // 64 MB of memory - how many 16bit samples can we fit in there?
 int16_t DSY_SDRAM_BSS sm[(64 * 1024 * 1024) / sizeof(int16_t)];
-size_t sm_size = sizeof(sm);
+// the recorder staging sits above everything the banks can use
+size_t sm_size = sizeof(sm) - REC_STAGE_BYTES;
+int16_t *rec_stage = &sm[(sizeof(sm) - REC_STAGE_BYTES) / sizeof(int16_t)];
 
 // put a record buffer at the start of memory
-// It should be sizeof(int16_t) * sr * MAX_GRAIN_DUR * MAX_GRAIN_PITCH * 2 in length 
-// cur_sm_bytes needs to be set in init now to catch the sample rate
-// but done before SD file waveform reading
+// LIVE_BUF_FRAMES of interleaved stereo, a power of 2 so the write head just masks round
 size_t cur_sm_bytes;
-size_t live_rec_buf_len;
+sample_src_t live_src;
 
 // Buffer for copying wav files to SDRAM
 char buf[CP_BUF_SIZE];
 
+// Gets whatever is on the card into s16 at sr on the way to SDRAM
+WavConverter conv;
+AdpcmEncoder enc;
+SampleAnalyser analyser;
+// pitch marks are found in the background, one wave after another
+PitchMarker marker;
+uint8_t marks_next = 0;
+// every loaded wave cut up and described for concatenative mode
+Corpus corpus;
+// converted frames on their way to the ADPCM encoder
+int16_t pcm_stage[PCM_STAGE_FRAMES * 2];
+
 wav_info_t wav_info[MAX_WAVES];
 
+// A bank is read in a chunk at a time from LoadTask() so the main loop keeps going
+// wl is the wave that's part way in, load_next the next one to start
+typedef struct {
+  wav_info_t  *info; // nullptr between waves
+  int16_t     *out;
+  size_t      data_left, max_len, len, frame_bytes;
+  uint8_t     chans;
+  bool	      adpcm;
+#ifdef DEBUG_POD
+  uint32_t    start;
+#endif
+} wav_load_t;
+
+wav_load_t wl = {};
+uint8_t load_next = 0;
+wav_info_t *loaded[MAX_WAVES];
+// the callback stays quiet and nothing new is started until it's all in
+volatile bool bank_loading = false;
+// the callback has stopped every grain reading the old bank, nothing of it is written over before then
+volatile bool bank_quiet = false;
+// StartBank() has listed the bank LoadTask() is reading in
+bool bank_listed = false;
+
+WavRecorder rec;
+int rec_bars = REC_BARS;
+bool rec_out = false; // record the output rather than the input
+
+Bouncer bounce;
+float bounce_bpm;
+int8_t last_bounce = -1;
+// the bounce being written out by rec and the file it's going to, -1 when there isn't one
+int8_t saving_bounce = -1;
+char saving_name[LINE_BUF_SIZE];
+
+// one window shared by every streamed wave in a dir, only the current one is ever open
+SampleStream stream;
+int16_t *stream_mem;
+
 uint8_t	    wav_file_count = 0;
 int8_t	    cur_wave = 0;
 int8_t	    wavs_read = 0;
@@ -76,13 +148,42 @@ Parameter knob1, knob2;
 PagedParam  pitch_p, rate_p, crush_p, downsample_p, grain_duration_p, \
 	    grain_density_p, scatter_dist_p, pitch_dist_p, sample_start_p, \
 	    sample_end_p, pan_p, pan_dist_p, dly_mix_p, dly_time_p, \
-	    dly_fbk_p, dly_xst_p;
-
-float cur_dly_time;
+	    dly_fbk_p, dly_xst_p, width_p, live_dly_p, \
+	    tgt_loud_p, tgt_bright_p, tgt_pitch_p;
+
+// the delay's continuous params, audio callback only
+Smoother<SM_FX_PARAMS> fx_smooth;
+
+/*
+ * Layers, each granulating its own wave from the bank with its own params, level and note range,
+ * mixed before the crusher and delay. Layer 0 is the main one and is always on, it's the only one that
+ * can be live or streamed and the one the wave notes change. The knobs and CCs edit the selected layer,
+ * the others keep what they were last given. The grains are shared out evenly between the layers that
+ * are on and each only starts grains in its share, so there are never more than MAX_GRAINS going
+ * and every layer on adds one pass over its grains and scan head.
+ */
+typedef struct {
+  int8_t  wave;	  // -1 is off, layer 0 uses cur_wave
+  uint8_t lo, hi; // the notes that play it, lo at the wave's own pitch
+  float	  level;
+  float	  gain;	  // audio callback only, follows level
+  float	  raw[NUM_LAYER_PARAMS];
+  Smoother<SM_GRAIN_PARAMS> smooth; // audio callback only
+} layer_t;
+
+layer_t layers[MAX_LAYERS];
+int8_t cur_layer = 0;
+// the params each layer has its own of, the crusher and delay are shared
+PagedParam *layer_params[NUM_LAYER_PARAMS] = {&pitch_p, &rate_p, &grain_duration_p, &grain_density_p, \
+  &scatter_dist_p, &live_dly_p, &pitch_dist_p, &width_p, &sample_start_p, &sample_end_p, &pan_p, &pan_dist_p, \
+  &tgt_loud_p, &tgt_bright_p, &tgt_pitch_p};
 
 int8_t cur_page = 0;
 
 float sample_bpm = DEFAULT_BPM;
+// where the sequencer is, the scan head follows it when phase lock is on
+Transport transport;
+bool phase_lock = true;
 
 float sr;
 
@@ -91,6 +192,8 @@ FatFSInterface fsi;
 FIL            SDFile; // Needs to be global to work https://forum.electro-smith.com/t/fatfs-f-read-returns-fr-disk-err/2883
 
 grnltr_params_t grnltr_params;
+// Parameters() publishes, the callback picks the newest up at the start of a block
+Snapshot<param_snap_t> param_snap;
 
 int cur_midi_channel = MIDI_CHANNEL;
 
@@ -104,31 +207,317 @@ bool retrig = false;
 bool gate = false;
 bool note = false;
 uint note_on_count = 0;
+// MIDI has moved a param, it's passed on without waiting for the knobs
+bool midi_params = false;
+
+/*
+ * Notes are stamped with the audio frame they arrived at and handed to the callback, which plays them
+ * a block later at that sample. The latency is then a constant block rather than anywhere from nothing
+ * to a block, and the pitch goes with the note instead of waiting up to MAIN_LOOP_DLY for Parameters().
+ */
+enum note_action {
+  NOTE_START,
+  NOTE_RESTART,
+  NOTE_STOP,
+  // poly mode
+  NOTE_VOICE_ON,
+  NOTE_VOICE_OFF,
+  // note is the wave to switch to
+  NOTE_WAVE,
+  // layer 0 to the live buffer, recording into it or playing back what's there
+  NOTE_LIVE_REC,
+  NOTE_LIVE_PLAY,
+  // the heads are copied from the scan head, so only the callback moves any of them
+  NOTE_HEADS,	    // note is how many
+  NOTE_HEAD_SPREAD, // pitch is the spread
+  NOTE_SCAN_REV,
+  // toggles that move the scan heads or grains the callback is in the middle of
+  NOTE_TOG_LOOP,
+  NOTE_TOG_STRETCH,
+  NOTE_TOG_NORM
+};
+
+typedef struct {
+  uint32_t  frame;
+  uint8_t   action;
+  uint8_t   layer;
+  uint8_t   note;
+  uint8_t   member; // MPE channel, poly mode only
+  float	    pitch; // 0 leaves it as it is
+} note_event_t;
+
+SpscQueue<note_event_t, NOTE_QUEUE_LEN> note_q;
+// a wave switch is queued, the scan head is still the old wave's so the streamer leaves it be
+volatile bool wave_queued = false;
+BlockClock block_clock;
+
+bool QueueNote(uint8_t layer, uint8_t action, uint8_t n, uint8_t member, float pitch)
+{
+  note_event_t ev = {block_clock.Stamp(), action, layer, n, member, pitch};
+  return note_q.Push(ev);
+}
+
+// Audio callback only
+void PlayNote(const note_event_t *ev)
+{
+  Granulator *g = &grnltrs[ev->layer];
+  // the waves are being loaded over, anything that would read one waits for the new bank, the heads and toggles don't
+  if (bank_loading && (ev->action != NOTE_STOP) && (ev->action < NOTE_HEADS)) {
+    if ((ev->action == NOTE_WAVE) && (ev->layer == 0)) wave_queued = false;
+    return;
+  }
+  if ((ev->pitch > 0.0f) && (ev->action < NOTE_VOICE_ON)) {
+    g->SetGrainPitch(ev->pitch);
+    // notes don't glide
+    layers[ev->layer].smooth.Jump(SM_PITCH, ev->pitch);
+  }
+  switch (ev->action) {
+    case NOTE_START:
+      g->Start();
+      break;
+    case NOTE_RESTART:
+      g->ReStart();
+      break;
+    case NOTE_STOP:
+      g->Stop();
+      break;
+    case NOTE_VOICE_ON:
+      g->NoteOn(ev->note, ev->pitch, ev->member);
+      break;
+    case NOTE_VOICE_OFF:
+      g->NoteOff(ev->note, ev->member);
+      break;
+    case NOTE_WAVE:
+      g->Reset(&wav_info[ev->note].src, wav_info[ev->note].loop, wav_info[ev->note].rev);
+      if (ev->layer == 0) wave_queued = false;
+      break;
+    case NOTE_LIVE_REC:
+      g->Stop();
+      g->Live(&live_src);
+      break;
+    case NOTE_LIVE_PLAY:
+      g->Stop();
+      g->Reset(&live_src, true, false);
+      break;
+    case NOTE_HEADS:
+      g->SetHeads(ev->note);
+      break;
+    case NOTE_HEAD_SPREAD:
+      g->SetHeadSpread(ev->pitch);
+      break;
+    case NOTE_SCAN_REV:
+      g->ToggleScanReverse();
+      break;
+    case NOTE_TOG_LOOP:
+      g->ToggleSampleLoop();
+      break;
+    case NOTE_TOG_STRETCH:
+      g->ToggleStretch();
+      break;
+    case NOTE_TOG_NORM:
+      g->ToggleNormalize();
+      break;
+  }
+}
+
+// Audio callback only, off layers cost nothing once they've faded out
+inline bool LayerOn(size_t l)
+{
+  return (l == 0) || (layers[l].wave >= 0) || (layers[l].gain > LAYER_SILENT);
+}
+
+inline sample_t MixLayers(int16_t in_l, int16_t in_r)
+{
+  sample_t s;
+  sample_t out = {0.0f, 0.0f};
+
+  // voices in their release would still be reading waves that are being loaded over
+  if (bank_loading) return out;
+  for (size_t l = 0; l < MAX_LAYERS; l++) {
+    if (!LayerOn(l)) continue;
+    fonepole(layers[l].gain, ((l == 0) || (layers[l].wave >= 0)) ? layers[l].level : 0.0f, LAYER_GAIN_COEF);
+    // only the main layer records
+    s = grnltrs[l].Process(in_l, in_r);
+    in_l = in_r = 0;
+    out.l += s.l * layers[l].gain;
+    out.r += s.r * layers[l].gain;
+  }
+  out.l = fminf(1.0f, fmaxf(-1.0f, out.l));
+  out.r = fminf(1.0f, fmaxf(-1.0f, out.r));
+  return out;
+}
+
+// Audio callback only, the whole set at once so the granulator never sees half of a change
+// the continuous ones are only targets, SmoothParams() gets them there
+void ApplyParams(const param_snap_t *snap)
+{
+  const grnltr_params_t *p = &snap->Params;
+  Granulator *g = &grnltrs[snap->Layer];
+  Smoother<SM_GRAIN_PARAMS> *sm = &layers[snap->Layer].smooth;
+
+  sm->SetTarget(SM_PITCH, p->GrainPitch);
+  sm->SetTarget(SM_RATE, p->ScanRate);
+  sm->SetTarget(SM_PAN, p->Pan);
+  sm->SetTarget(SM_DUR, p->GrainDur);
+  sm->SetTarget(SM_SCATTER, p->ScatterDist);
+  sm->SetTarget(SM_PITCH_DIST, p->PitchDist);
+  sm->SetTarget(SM_PAN_DIST, p->PanDist);
+  sm->SetTarget(SM_WIDTH, p->Width);
+  sm->SetTarget(SM_LIVE_DLY, p->LiveDelay);
+  fx_smooth.SetTarget(SM_DLY_MIX, p->DelayMix);
+  fx_smooth.SetTarget(SM_DLY_TIME, sr * p->DelayTime);
+  fx_smooth.SetTarget(SM_DLY_DIRECT, p->DelayFbk * (1.0f - p->DelayXSt));
+  fx_smooth.SetTarget(SM_DLY_CROSS, p->DelayFbk * p->DelayXSt);
+  g->SetBeatFrames(snap->BeatFrames);
+  g->SetDensity(p->GrainDens);
+  g->SetSampleStart(p->SampleStart);
+  g->SetSampleEnd(p->SampleEnd);
+  g->SetTarget(CORPUS_LOUD, p->TargetLoud);
+  g->SetTarget(CORPUS_BRIGHT, p->TargetBright);
+  g->SetTarget(CORPUS_PITCH, p->TargetPitch);
+  crush_l.SetBitcrushFactor(p->Crush);
+  crush_l.SetDownsampleFactor(p->DownSample);
+  crush_r.SetBitcrushFactor(p->Crush);
+  crush_r.SetDownsampleFactor(p->DownSample);
+}
+
+// Audio callback only, once a block, every time so a wave change's Reset() doesn't leave the defaults in
+void SmoothParams(size_t l, size_t size)
+{
+  Granulator *g = &grnltrs[l];
+  Smoother<SM_GRAIN_PARAMS> *sm = &layers[l].smooth;
+
+  sm->Process(size);
+  g->SetGrainPitch(sm->Value(SM_PITCH));
+  g->SetScanRate(sm->Value(SM_RATE));
+  g->SetPan(sm->Value(SM_PAN));
+  g->SetGrainDuration(sm->Value(SM_DUR));
+  g->SetScatterDist(sm->Value(SM_SCATTER));
+  g->SetPitchDist(sm->Value(SM_PITCH_DIST));
+  g->SetPanDist(sm->Value(SM_PAN_DIST));
+  g->SetWidth(sm->Value(SM_WIDTH));
+  g->SetLiveDelay(sm->Value(SM_LIVE_DLY));
+}
+
+// Main loop only, before the callback starts, everything starts where a fresh granulator is
+void InitSmoothers()
+{
+  Smoother<SM_GRAIN_PARAMS> *sm;
+
+  for (size_t l = 0; l < MAX_LAYERS; l++) {
+    sm = &layers[l].smooth;
+    sm->Init(sr);
+    for (size_t i = 0; i < SM_GRAIN_PARAMS; i++) {
+      sm->SetTime(i, (i <= SM_PAN) ? SMOOTH_GLIDE_SECS : SMOOTH_SECS, i <= SM_PAN);
+    }
+    sm->Jump(SM_PITCH, DEFAULT_GRAIN_PITCH);
+    sm->Jump(SM_RATE, DEFAULT_SCAN_RATE);
+    sm->Jump(SM_PAN, DEFAULT_PAN);
+    sm->Jump(SM_DUR, DEFAULT_GRAIN_DUR);
+    sm->Jump(SM_SCATTER, DEFAULT_SCATTER_DIST);
+    sm->Jump(SM_PITCH_DIST, DEFAULT_PITCH_DIST);
+    sm->Jump(SM_PAN_DIST, DEFAULT_PAN_DIST);
+    sm->Jump(SM_WIDTH, DEFAULT_WIDTH);
+    sm->Jump(SM_LIVE_DLY, DEFAULT_LIVE_DLY);
+  }
+  fx_smooth.Init(sr);
+  for (size_t i = 0; i < SM_FX_PARAMS; i++) {
+    fx_smooth.SetTime(i, (i == SM_DLY_TIME) ? SMOOTH_DLY_SECS : SMOOTH_SECS, false);
+  }
+  fx_smooth.Jump(SM_DLY_MIX, DEFAULT_MIX);
+  fx_smooth.Jump(SM_DLY_TIME, sr * DEFAULT_DLY);
+  fx_smooth.Jump(SM_DLY_DIRECT, DEFAULT_FBK * (1.0f - DEFAULT_XST));
+  fx_smooth.Jump(SM_DLY_CROSS, DEFAULT_FBK * DEFAULT_XST);
+}
 
 void AudioCallback(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size)
 {
   sample_t sample, delay;
+  note_event_t ev;
+  float dly_mix, dly_time, dly_direct, dly_cross;
+  float mix_step, time_step, direct_step, cross_step;
+
+#ifdef DEBUG_POD
+  cpu_meter.OnBlockStart();
+#endif
+
+  block_clock.Block(size);
+  // a new bank is about to be loaded over the old one, the main loop waits for this before it starts
+  if (bank_loading && !bank_quiet) {
+    for (size_t l = 0; l < MAX_LAYERS; l++) {
+      grnltrs[l].Stop();
+      grnltrs[l].Cut(nullptr);
+    }
+    bank_quiet = true;
+  }
+  if (param_snap.Fetch()) ApplyParams(param_snap.Front());
+  // per note expression and the params move once a block
+  for (size_t l = 0; l < MAX_LAYERS; l++) {
+    if (LayerOn(l)) {
+      SmoothParams(l, size);
+      grnltrs[l].Express(size);
+    }
+  }
+  // the delay's go a step a sample from where they were at the end of the last block
+  fx_smooth.Process(size);
+  dly_mix = fx_smooth.Start(SM_DLY_MIX);
+  dly_time = fx_smooth.Start(SM_DLY_TIME);
+  dly_direct = fx_smooth.Start(SM_DLY_DIRECT);
+  dly_cross = fx_smooth.Start(SM_DLY_CROSS);
+  // in locals, the compiler can't tell the delay lines' writes don't touch the smoother
+  mix_step = fx_smooth.Step(SM_DLY_MIX);
+  time_step = fx_smooth.Step(SM_DLY_TIME);
+  direct_step = fx_smooth.Step(SM_DLY_DIRECT);
+  cross_step = fx_smooth.Step(SM_DLY_CROSS);
 
   //audio
   for(size_t i = 0; i < size; i++)
   {
-    sample = grnltr.Process(f2s16(in[0][i]));
+    // anything late goes on the first sample
+    while (note_q.Peek(&ev) && ((int32_t)(ev.frame - (block_clock.Frame() + i)) <= 0)) {
+      note_q.Drop();
+      PlayNote(&ev);
+    }
+    sample = MixLayers(f2s16(in[0][i]), f2s16(in[1][i]));
     sample.l = crush_l.Process(sample.l);
     sample.r = crush_r.Process(sample.r);
 
-    fonepole(cur_dly_time, sr * grnltr_params.DelayTime, .00007f);
-    dell.SetDelay(cur_dly_time);
-    delr.SetDelay(cur_dly_time);
+    dly_mix += mix_step;
+    dly_time += time_step;
+    dly_direct += direct_step;
+    dly_cross += cross_step;
+    dell.SetDelay(dly_time);
+    delr.SetDelay(dly_time);
 
     delay.l = dell.Read();
     delay.r = delr.Read();
 
-    dell.Write((grnltr_params.DelayFbk * ((grnltr_params.DelayXSt * delay.r) + ((1 - grnltr_params.DelayXSt) * delay.l))) + sample.l);
-    delr.Write((grnltr_params.DelayFbk * ((grnltr_params.DelayXSt * delay.l) + ((1 - grnltr_params.DelayXSt) * delay.r))) + sample.r);
+    dell.Write((dly_cross * delay.r) + (dly_direct * delay.l) + sample.l);
+    delr.Write((dly_cross * delay.l) + (dly_direct * delay.r) + sample.r);
     
-    out[0][i] = (grnltr_params.DelayMix * delay.l) + ((1.0f - grnltr_params.DelayMix) * sample.l);
-    out[1][i] = (grnltr_params.DelayMix * delay.r) + ((1.0f - grnltr_params.DelayMix) * sample.r);
+    out[0][i] = (dly_mix * delay.l) + ((1.0f - dly_mix) * sample.l);
+    out[1][i] = (dly_mix * delay.r) + ((1.0f - dly_mix) * sample.r);
+
+    if (rec_out) {
+      rec.Write(f2s16(out[0][i]), f2s16(out[1][i]));
+    } else {
+      rec.Write(f2s16(in[0][i]), f2s16(in[1][i]));
+    }
+  }
+
+  bounce.Process(out[0], out[1], size);
+
+  double beats;
+  transport.Advance(size);
+  if (phase_lock && mmh.GotClock() && mmh.ClockLocked() && transport.Beats(&beats)) {
+    for (size_t l = 0; l < MAX_LAYERS; l++) {
+      if (LayerOn(l)) grnltrs[l].SyncPhase(beats);
+    }
   }
+
+#ifdef DEBUG_POD
+  cpu_meter.OnBlockEnd();
+#endif
 }
 
 // needed to make led pwm work so we can see what's happening
@@ -169,6 +558,231 @@ int ListDirs(const char *path)
   return 0;
 }
 
+// Carve the stream window out of SDRAM the first time a wave needs it
+bool ReserveStream()
+{
+  size_t win_bytes = STREAM_WIN_FRAMES * 2 * sizeof(int16_t);
+  if (stream_mem != nullptr) return true;
+  if ((cur_sm_bytes + win_bytes) > sm_size) return false;
+  stream_mem = &sm[cur_sm_bytes / sizeof(int16_t)];
+  cur_sm_bytes += win_bytes;
+  stream.Init(stream_mem, STREAM_WIN_FRAMES, buf, CP_BUF_SIZE);
+  return true;
+}
+
+// Analyse a wave that's just landed in SDRAM and keep its index straight after it
+// Waves still play without one if there's no room
+void IndexWave(wav_info_t *info)
+{
+  size_t bytes = (IndexBytes(info->src.len) + 3) & ~3;
+  // a mono wave can leave it on a half word, the index and marks are read a word at a time
+  cur_sm_bytes = (cur_sm_bytes + 3) & ~3;
+  if ((cur_sm_bytes + bytes) > sm_size) return;
+  idx_block_t *mem = (idx_block_t *)&sm[cur_sm_bytes / sizeof(int16_t)];
+  analyser.Analyse(&info->src, mem, &info->index);
+  info->src.index = &info->index;
+  cur_sm_bytes += bytes;
+
+  // make room for the pitch marks too, MarkWaves fills them in later
+  bytes = PitchMarksBytes(info->src.len, sr);
+  if ((cur_sm_bytes + bytes) > sm_size) return;
+  info->marks.pos = (uint32_t *)&sm[cur_sm_bytes / sizeof(int16_t)];
+  info->marks.n = 0;
+  info->marks.ready = false;
+  info->src.marks = &info->marks;
+  cur_sm_bytes += bytes;
+}
+
+// A few pitch marks at a time from the main loop, moving on to the next wave when one's done
+// Bounces are picked up too as they're added on the end
+void MarkWaves()
+{
+  if (marker.Service()) return;
+  while (marks_next < wav_file_count) {
+    wav_info_t *info = &wav_info[marks_next++];
+    if ((info->src.marks != nullptr) && !info->marks.ready) {
+      marker.Start(&info->src, &info->marks);
+      return;
+    }
+  }
+}
+
+// Describe every wave that loaded for concatenative mode, in whatever SDRAM is left
+// Streamed waves are left out, grains can only reach what's in memory
+void BuildCorpus(wav_info_t **waves, size_t n)
+{
+  size_t segs = 0;
+
+  corpus.Clear();
+  cur_sm_bytes = (cur_sm_bytes + 3) & ~3;
+  for (size_t i = 0; i < n; i++) {
+    if (!waves[i]->stream) segs += Corpus::Segments(waves[i]->src.len);
+  }
+  if ((cur_sm_bytes + (segs * sizeof(corpus_seg_t))) > sm_size) {
+    segs = (sm_size - cur_sm_bytes) / sizeof(corpus_seg_t);
+  }
+
+#ifdef DEBUG_POD
+  uint32_t start = System::GetNow();
+#endif
+  corpus.Init((corpus_seg_t *)&sm[cur_sm_bytes / sizeof(int16_t)], segs, sr);
+  for (size_t i = 0; i < n; i++) {
+    if (!waves[i]->stream) corpus.Add(&waves[i]->src);
+  }
+  corpus.Build();
+  // silence isn't kept so only take what was used
+  cur_sm_bytes += corpus.Size() * sizeof(corpus_seg_t);
+#ifdef DEBUG_POD
+  hw.seed.PrintLine("Corpus: %d segments in %dms", corpus.Size(), System::GetNow() - start);
+#endif
+}
+
+// Opens one wav and works out where and how it goes in SDRAM at cur_sm_bytes
+// LOAD_BUSY if it's to be read in with LoadChunk(), streamed waves are done straight away
+int BeginWav(wav_info_t *info)
+{
+  // nothing to mark if this doesn't load
+  info->src.marks = nullptr;
+  if(f_open(&SDFile, info->wav_file_hdr.name, FA_READ) != FR_OK) return LOAD_ERR;
+
+  WAV_FormatTypeDef *hdr = &info->wav_file_hdr.raw_data;
+  // keep stereo as stereo, anything wider gets cut down to the first two channels
+  if ((ReadWavHeader(&SDFile, hdr) < 0) || \
+      !conv.Init(hdr->AudioFormat, hdr->NbrChannels, hdr->BitPerSample, hdr->SampleRate, sr, \
+	(hdr->NbrChannels > 1) ? 2 : 1)) {
+#ifdef DEBUG_POD
+    hw.seed.PrintLine("Can't read %s", info->wav_file_hdr.name);
+#endif
+    f_close(&SDFile);
+    return LOAD_ERR;
+  }
+
+  size_t frame_bytes = conv.FrameBytes();
+  uint8_t chans = conv.OutChans();
+  size_t data_left = hdr->SubCHunk2Size - (hdr->SubCHunk2Size % frame_bytes);
+  size_t max_len = conv.OutFrames(data_left / frame_bytes);
+  size_t wav_size = max_len * chans * sizeof(int16_t);
+
+  // compress if asked to, or if that's the only way it will fit
+  bool adpcm = info->adpcm || ((cur_sm_bytes + wav_size) > sm_size);
+  if (adpcm) {
+    wav_size = AdpcmBytes(max_len, chans);
+  }
+  if ((cur_sm_bytes + wav_size) > sm_size) {
+    // still too big, but s16 at sr can be played straight off the card
+    if (conv.IsPassthru() && ReserveStream()) {
+      info->stream = true;
+      info->data_offset = f_tell(&SDFile);
+      info->src.start = nullptr;
+      info->src.adpcm = nullptr;
+      info->src.len = data_left / frame_bytes;
+      info->src.chans = chans;
+      info->src.mask = SIZE_MAX;
+      info->src.win = nullptr;
+      info->src.index = nullptr;
+      info->src.marks = nullptr;
+      info->src.wrap = false;
+#ifdef DEBUG_POD
+      hw.seed.PrintLine("  %d frames streamed", info->src.len);
+#endif
+      f_close(&SDFile);
+      return LOAD_OK;
+    }
+    f_close(&SDFile);
+    return LOAD_NO_ROOM;
+  }
+
+  // leave a guard frame in front of each wave
+  size_t this_wav_start_pos = (cur_sm_bytes / sizeof(int16_t)) + chans;
+  int16_t *out = &sm[this_wav_start_pos];
+  info->stream = false;
+  info->src.chans = chans;
+  info->src.mask = SIZE_MAX;
+  info->src.win = nullptr;
+  info->src.index = nullptr;
+  info->src.wrap = false;
+  if (adpcm) {
+    info->src.start = nullptr;
+    info->src.adpcm = (uint8_t *)out;
+    enc.Init((uint8_t *)out, chans);
+  } else {
+    info->src.start = out;
+    info->src.adpcm = nullptr;
+  }
+
+  wl.info = info;
+  wl.out = out;
+  wl.data_left = data_left;
+  wl.max_len = max_len;
+  wl.len = 0;
+  wl.frame_bytes = frame_bytes;
+  wl.chans = chans;
+  wl.adpcm = adpcm;
+#ifdef DEBUG_POD
+  wl.start = System::GetNow();
+#endif
+  return LOAD_BUSY;
+}
+
+// One buffer of the wave BeginWav() opened, converted (and compressed) into SDRAM, LOAD_OK once it's all in
+int LoadChunk()
+{
+  wav_info_t *info = wl.info;
+  size_t frame_bytes = wl.frame_bytes;
+  uint8_t chans = wl.chans;
+  int16_t *out = wl.out;
+  size_t max_len = wl.max_len;
+  // only ever read whole frames
+  size_t chunk = CP_BUF_SIZE - (CP_BUF_SIZE % frame_bytes);
+  // compressed waves go through pcm_stage so keep each conversion small enough to fit
+  size_t sub = conv.InFrames(PCM_STAGE_FRAMES);
+  size_t bytesread, to_read, frames, n, m, wav_size;
+  size_t len = wl.len;
+
+  to_read = (wl.data_left < chunk) ? wl.data_left : chunk;
+  f_read(&SDFile, (void *)buf, to_read, &bytesread);
+  wl.data_left -= bytesread;
+  frames = bytesread / frame_bytes;
+  if (wl.adpcm) {
+    for (size_t f = 0; f < frames; f += n) {
+      n = ((frames - f) < sub) ? (frames - f) : sub;
+      m = conv.Process((uint8_t *)&buf[f * frame_bytes], n, pcm_stage, PCM_STAGE_FRAMES);
+      enc.Encode(pcm_stage, m);
+      len += m;
+    }
+  } else {
+    len += conv.Process((uint8_t *)buf, frames, &out[len * chans], max_len - len);
+  }
+  wl.len = len;
+  if ((bytesread == to_read) && (wl.data_left > 0)) return LOAD_BUSY;
+
+  if (wl.adpcm) {
+    m = conv.Flush(pcm_stage, PCM_STAGE_FRAMES);
+    enc.Encode(pcm_stage, m);
+    len += m;
+    // keep the next wave aligned
+    wav_size = (enc.Flush() + 3) & ~3;
+    cur_sm_bytes += (chans * sizeof(int16_t)) + wav_size;
+  } else {
+    len += conv.Flush(&out[len * chans], max_len - len);
+    cur_sm_bytes += (len + 1) * chans * sizeof(int16_t);
+  }
+  info->src.len = len;
+  IndexWave(info);
+
+#ifdef DEBUG_POD
+  WAV_FormatTypeDef *hdr = &info->wav_file_hdr.raw_data;
+  uint32_t load_ms = System::GetNow() - wl.start;
+  hw.seed.PrintLine("  %dHz %dbit %dch -> %d frames%s in %dms", \
+      hdr->SampleRate, hdr->BitPerSample, hdr->NbrChannels, len, wl.adpcm ? " adpcm" : "", load_ms);
+#endif
+
+  f_close(&SDFile);
+  wl.info = nullptr;
+  return LOAD_OK;
+}
+
+// Lists the waves in dir_path and clears the way for them, LoadBankStep() reads them in
 int ReadWavsFromDir(const char *dir_path)
 {
   DIR dir;
@@ -176,10 +790,16 @@ int ReadWavsFromDir(const char *dir_path)
   char line_buf[LINE_BUF_SIZE];
   char path_buf[LINE_BUF_SIZE];
   char *fn;
-  char *tokens[5];
+  char *tokens[MAX_CFG_TOKENS + 1];
 
   size_t bytesread;
 
+  // a bank that was still on its way in is dropped where it is
+  if (wl.info != nullptr) {
+    f_close(&SDFile);
+    wl.info = nullptr;
+  }
+  load_next = 0;
   wav_file_count = 0;
   wavs_read = 0;
 
@@ -205,10 +825,12 @@ int ReadWavsFromDir(const char *dir_path)
     }
     while (f_gets(line_buf, LINE_BUF_SIZE, &SDFile) && (wav_file_count < MAX_WAVES)) {
       int i = 0;
-      tokens[i] = strtok(line_buf, ",");
-      while (tokens[i] != NULL) {
-	tokens[++i] = strtok(NULL, ",");
+      // split on line endings too so the last column compares cleanly
+      tokens[i] = strtok(line_buf, ",\r\n");
+      while ((tokens[i] != NULL) && (i < MAX_CFG_TOKENS)) {
+	tokens[++i] = strtok(NULL, ",\r\n");
       }	
+      if (i < 4) continue;
       strcpy(path_buf, dir_path);
       strcat(path_buf, "/");
       strcat(path_buf, tokens[0]);
@@ -221,6 +843,8 @@ int ReadWavsFromDir(const char *dir_path)
 	wav_info[wav_file_count].bpm  = atof(tokens[1]);
 	wav_info[wav_file_count].loop = (strcmp(tokens[2], "True") == 0);
 	wav_info[wav_file_count].rev  = (strcmp(tokens[3], "True") == 0);
+	wav_info[wav_file_count].adpcm = (i > 4) && (strcmp(tokens[4], "True") == 0);
+	wav_info[wav_file_count].stream = false;
         wav_file_count++;
       }
     }
@@ -252,45 +876,62 @@ int ReadWavsFromDir(const char *dir_path)
 	wav_info[wav_file_count].bpm  = DEFAULT_BPM;
 	wav_info[wav_file_count].loop = true;
 	wav_info[wav_file_count].rev  = false;
+	wav_info[wav_file_count].adpcm = false;
+	wav_info[wav_file_count].stream = false;
         wav_file_count++;
       }
     }
     f_closedir(&dir);
   }
 
-  cur_sm_bytes = sizeof(int16_t) * MAX_GRAIN_DUR * sr * MAX_GRAIN_PITCH * 2;
-  live_rec_buf_len = cur_sm_bytes / sizeof(int16_t);
+  cur_sm_bytes = LIVE_BUF_FRAMES * 2 * sizeof(int16_t);
+  live_src.start = &sm[0];
+  live_src.len = LIVE_BUF_FRAMES;
+  live_src.chans = 2;
+  live_src.adpcm = nullptr;
+  live_src.mask = LIVE_BUF_FRAMES - 1;
+  live_src.win = nullptr;
+  live_src.index = nullptr;
+  live_src.marks = nullptr;
+  live_src.wrap = true;
+  stream.Close();
+  stream_mem = nullptr;
+  // a bounce in progress was using memory that's about to be loaded over
+  bounce.Cancel();
+  // and one being saved was reading from it
+  rec.Cancel();
+  saving_bounce = -1;
+  last_bounce = -1;
+  marker.Cancel();
+  marks_next = 0;
   cur_wave = 0;
-  
-  // Now we'll go through each file and load the WavInfo.
-  for(size_t i = 0; i < wav_file_count; i++)
-  {
-    Status(READING_WAV);
-    // Read the test file from the SD Card.
-    if(f_open(&SDFile, wav_info[i].wav_file_hdr.name, FA_READ) == FR_OK)
-    {
-      // TODO: Add checks here to ensure we can deal with the wav file correctly
-      f_read(&SDFile, (void *)&wav_info[i].wav_file_hdr.raw_data, sizeof(WAV_FormatTypeDef), &bytesread);
-      size_t wav_size = wav_info[i].wav_file_hdr.raw_data.SubCHunk2Size;
-      if ((cur_sm_bytes + wav_size) > sm_size) break;
-      size_t this_wav_start_pos = (cur_sm_bytes / sizeof(int16_t)) + 1;
-      wav_info[i].wav_start_pos = this_wav_start_pos;
-
-      do {
-	f_read(&SDFile, (void *)buf, CP_BUF_SIZE, &bytesread);
-	memcpy((void *)&sm[this_wav_start_pos], buf, bytesread);
-      	cur_sm_bytes += bytesread;
-	this_wav_start_pos = (cur_sm_bytes / sizeof(int16_t));
-      } while (bytesread == CP_BUF_SIZE && !f_eof(&SDFile));
+  return 0;
+}
 
-      f_close(&SDFile);
-      wavs_read++;
-    }
+// One buffer's worth of loading the bank ReadWavsFromDir() listed, false once it's all in
+bool LoadBankStep()
+{
+  wav_info_t *info = wl.info;
+  int res;
+
+  if (info != nullptr) {
+    res = LoadChunk();
+  } else if (load_next < wav_file_count) {
+    Status(READING_WAV);
+    info = &wav_info[load_next++];
+    res = BeginWav(info);
+  } else {
+    BuildCorpus(loaded, wavs_read);
+    return false;
   }
-  return 0;
+  if (res == LOAD_OK) loaded[wavs_read++] = info;
+  // nothing after it will fit either
+  if (res == LOAD_NO_ROOM) load_next = wav_file_count;
+  return true;
 }
 
-void LoadNewDir() {
+// Lists the bank in cur_dir, LoadBankStep() loads it
+void StartBank() {
   strcpy(cur_dir_name, GRNLTR_PATH);
   // If there are no dirs, just wavs under /grnltr
   // From https://github.com/jazamatronic/grnltr/issues/1
@@ -313,7 +954,10 @@ void LoadNewDir() {
       grnltr_delay(1);
     }
   }
+}
 
+void BankLoaded()
+{
   if (wavs_read != wav_file_count) {
     Status(MISSING_WAV);
 #ifdef DEBUG_POD
@@ -323,28 +967,271 @@ void LoadNewDir() {
     grnltr_delay(1000);
   }
 }
+
+// Boot, all in one go
+void LoadNewDir()
+{
+  StartBank();
+  while (LoadBankStep());
+  BankLoaded();
+}
   
 
+// one bar at the MIDI clock tempo if there is one, otherwise the current wave's
+size_t BarFrames()
+{
+  float bpm = mmh.GotClock() ? mmh.GetBPM() : sample_bpm;
+  return (size_t)((BEATS_PER_BAR * 60.0f * sr) / bpm);
+}
+
+// Fills name with the first file in the current bank that matches fmt and doesn't exist yet
+bool NextFreeName(const char *fmt, char *name)
+{
+  char *fn;
+  FILINFO fno;
+
+  strcpy(name, cur_dir_name);
+  strcat(name, "/");
+  fn = name + strlen(name);
+  for (int i = 0; i < MAX_RECS; i++) {
+    sprintf(fn, fmt, i);
+    if (f_stat(name, &fno) != FR_OK) return true;
+  }
+  return false;
+}
+
+// Records rec_bars into the next free recNNN.wav in the current bank
+// The first press starts, a second press stops at the end of the current bar
+void ToggleRecord()
+{
+  char name[LINE_BUF_SIZE];
+
+  if (rec.IsSaving()) {
+    Status(REC_ERROR);
+    return;
+  }
+  if (rec.IsRecording()) {
+    rec.Stop(BarFrames());
+    return;
+  }
+
+  if (!NextFreeName(REC_NAME, name) || !rec.Start(name, rec_bars * BarFrames(), (uint32_t)sr)) {
+    Status(REC_ERROR);
+    return;
+  }
+#ifdef DEBUG_POD
+  hw.seed.PrintLine("Recording %d bars to %s", rec_bars, name);
+#endif
+}
+
+// Bounces the output into whatever SDRAM the bank hasn't used
+// A second press stops it and it turns up as the next wave
+void ToggleBounce()
+{
+  if (bounce.IsRunning()) {
+    bounce.Stop();
+    return;
+  }
+
+  // leave a guard frame in front, same as LoadWav
+  size_t start = (cur_sm_bytes / sizeof(int16_t)) + 2;
+  size_t max_frames = (sm_size / sizeof(int16_t) > start) ? ((sm_size / sizeof(int16_t)) - start) / 2 : 0;
+  if (bank_loading || (wav_file_count >= MAX_WAVES) || (max_frames < sr) || bounce.IsDone()) {
+    Status(REC_ERROR);
+    return;
+  }
+  bounce_bpm = mmh.GotClock() ? mmh.GetBPM() : sample_bpm;
+  bounce.Start(&sm[start], max_frames);
+}
+
+// Make a finished bounce the newest wave in the bank
+void AddBounce()
+{
+  wav_info_t *info = &wav_info[wav_file_count];
+  size_t len = bounce.Take();
+
+  sprintf(info->wav_file_hdr.name, "%s/" BOUNCE_NAME, cur_dir_name, wav_file_count);
+  info->src.start = &sm[(cur_sm_bytes / sizeof(int16_t)) + 2];
+  info->src.adpcm = nullptr;
+  info->src.len = len;
+  info->src.chans = 2;
+  info->src.mask = SIZE_MAX;
+  info->src.win = nullptr;
+  info->src.index = nullptr;
+  info->src.marks = nullptr;
+  info->src.wrap = false;
+  info->bpm = bounce_bpm;
+  info->loop = true;
+  info->rev = false;
+  info->adpcm = false;
+  info->stream = false;
+  cur_sm_bytes += (len + 1) * 2 * sizeof(int16_t);
+  IndexWave(info);
+  last_bounce = wav_file_count;
+  wav_file_count++;
+  wavs_read++;
+#ifdef DEBUG_POD
+  hw.seed.PrintLine("Bounced %d frames to wave %d", len, last_bounce);
+#endif
+}
+
+// Starts writing the last bounce out to the next free bounceNNN.wav in the bank, RecTask() does the writing
+void SaveBounce(uint8_t chans)
+{
+  wav_info_t *info;
+
+  if (last_bounce < 0) return;
+  info = &wav_info[last_bounce];
+  if (!NextFreeName(BOUNCE_NAME, saving_name) || \
+      !rec.Save(saving_name, info->src.start, info->src.len, (uint32_t)sr, chans)) {
+    Status(REC_ERROR);
+    return;
+  }
+  saving_bounce = last_bounce;
+}
+
+// the wave only takes the file's name once all of it is on the card
+void BounceSaved()
+{
+  if (rec.Failed()) {
+    Status(REC_ERROR);
+  } else {
+    strcpy(wav_info[saving_bounce].wav_file_hdr.name, saving_name);
+  }
+#ifdef DEBUG_POD
+  hw.seed.PrintLine("%s %s", rec.Failed() ? "Failed saving" : "Saved", saving_name);
+#endif
+  saving_bounce = -1;
+}
+
+// Streamed waves get their file opened and the start of the window read before they play
+// false if it won't open, the wave is left as it is and mustn't be played
+bool OpenStream(wav_info_t *info)
+{
+  stream.Close();
+  if (!info->stream) return true;
+  if (!stream.Open(info->wav_file_hdr.name, info->data_offset, &info->src)) {
+    Status(MISSING_WAV);
+    return false;
+  }
+  stream.Prime(info->rev ? info->src.len - 1 : 0, info->rev);
+  return true;
+}
+
+// Point the granulator at cur_wave from the top
+// the callback does the switch, after anything already queued, grains still going finish on the old wave
+void ResetWave()
+{
+  wav_info_t *info = &wav_info[cur_wave];
+  // LoadTask() does it once the bank is in
+  if (bank_loading) return;
+  if (!OpenStream(info)) {
+    // card pulled? stay on the old wave, stopped, rather than read from nowhere
+    QueueNote(0, NOTE_STOP, 0, 0, 0.0f);
+    return;
+  }
+  sample_bpm = info->bpm;
+  wave_queued = true;
+  if (!QueueNote(0, NOTE_WAVE, cur_wave, 0, 0.0f)) wave_queued = false;
+}
+
+float LayerBPM(int8_t l)
+{
+  return ((l == 0) || (layers[l].wave < 0)) ? sample_bpm : wav_info[layers[l].wave].bpm;
+}
+
+// an even share of the grains for each layer that's on
+void ShareGrains()
+{
+  size_t n = 0;
+  for (size_t l = 0; l < MAX_LAYERS; l++) {
+    if ((l == 0) || (layers[l].wave >= 0)) n++;
+  }
+  for (size_t l = 0; l < MAX_LAYERS; l++) {
+    grnltrs[l].SetGrainBudget(MAX_GRAINS / n);
+  }
+}
+
+// the knobs and CCs move to layer l, its params are caught like after a page change
+void SelectLayer(int8_t l)
+{
+  if (l == cur_layer) return;
+  for (size_t p = 0; p < NUM_LAYER_PARAMS; p++) {
+    layers[cur_layer].raw[p] = layer_params[p]->Raw();
+  }
+  cur_layer = l;
+  for (size_t p = 0; p < NUM_LAYER_PARAMS; p++) {
+    layer_params[p]->RawLock(layers[l].raw[p]);
+  }
+}
+
+// Main loop only, w < 0 turns it off, streamed waves can only be on layer 0
+void SetLayerWave(int8_t l, int8_t w)
+{
+  if (l == 0) return;
+  if ((w >= 0) && (w < wav_file_count) && !wav_info[w].stream && !bank_loading) {
+    layers[l].wave = w;
+    QueueNote(l, NOTE_WAVE, w, 0, 0.0f);
+    // Reset() puts it back to the defaults
+    if (l == cur_layer) midi_params = true;
+  } else {
+    layers[l].wave = -1;
+    QueueNote(l, NOTE_STOP, 0, 0, 0.0f);
+  }
+  ShareGrains();
+}
+
+void LayersOff()
+{
+  SelectLayer(0);
+  for (int8_t l = 1; l < MAX_LAYERS; l++) {
+    SetLayerWave(l, -1);
+  }
+}
+
+// the layer whose notes n is in, layer 0 has whatever the others don't
+int8_t NoteLayer(uint8_t n)
+{
+  for (int8_t l = 1; l < MAX_LAYERS; l++) {
+    if ((layers[l].wave >= 0) && (n >= layers[l].lo) && (n <= layers[l].hi)) return l;
+  }
+  return 0;
+}
+
+void InitLayers()
+{
+  for (size_t l = 0; l < MAX_LAYERS; l++) {
+    layers[l].wave = -1;
+    layers[l].lo = BASE_NOTE;
+    layers[l].hi = BASE_NOTE - 1;
+    layers[l].level = 1.0f;
+    layers[l].gain = (l == 0) ? 1.0f : 0.0f;
+    for (size_t p = 0; p < NUM_LAYER_PARAMS; p++) {
+      layers[l].raw[p] = layer_params[p]->Raw();
+    }
+  }
+  cur_layer = 0;
+  ShareGrains();
+}
+
 // MIDI Callback Functions
 void RTStartCB()
 {
+  transport.Start();
   InitControls();
-  grnltr.Reset( \
-      &sm[wav_info[cur_wave].wav_start_pos], \
-      wav_info[cur_wave].wav_file_hdr.raw_data.SubCHunk2Size / sizeof(int16_t), \
-      wav_info[cur_wave].loop, wav_info[cur_wave].rev);
-  sample_bpm = wav_info[cur_wave].bpm;
-  grnltr.Dispatch(0);
+  ResetWave();
 }
 
 void RTContCB()
 {
-  grnltr.ReStart();
+  transport.Continue();
+  QueueNote(0, NOTE_RESTART, 0, 0, 0.0f);
 }
 
 void RTStopCB()
 {
-  grnltr.Stop();
+  transport.Stop();
+  QueueNote(0, NOTE_STOP, 0, 0, 0.0f);
 #ifdef TARGET_POD
   hw.led2.Set(OFF);
 #endif
@@ -357,6 +1244,16 @@ void RTBeatCB()
 #endif
 }
 
+void RTClockCB()
+{
+  transport.Tick();
+}
+
+void MidiSPPHCB(uint16_t spp)
+{
+  transport.SongPosition(spp);
+}
+
 void RTHalfBeatCB()
 {
 #ifdef TARGET_POD
@@ -364,180 +1261,191 @@ void RTHalfBeatCB()
 #endif
 }
 
+/*
+ * What each CC does, looked up rather than switched on.
+ * CCs that move a param are coalesced by the MIDI handler, so a burst of automation only lands once per batch,
+ * toggles and triggers run every time they come in.
+ */
+typedef struct {
+  PagedParam  *param;
+  void	      (*fn)(uint8_t val);
+} cc_entry_t;
+
+cc_entry_t cc_map[MIDI_NUM_CC];
+
+void InitCCMap()
+{
+  cc_map[CC_SCAN].param =	    &rate_p;
+  cc_map[CC_GRAINPITCH].param =	    &pitch_p;
+  cc_map[CC_GRAINDUR].param =	    &grain_duration_p;
+  cc_map[CC_GRAINDENS].param =	    &grain_density_p;
+  cc_map[CC_SCATTERDIST].param =    &scatter_dist_p;
+  cc_map[CC_PITCHDIST].param =	    &pitch_dist_p;
+  cc_map[CC_SAMPLESTART_MSB].param = &sample_start_p;
+  cc_map[CC_SAMPLEEND_MSB].param =  &sample_end_p;
+  cc_map[CC_CRUSH].param =	    &crush_p;
+  cc_map[CC_DOWNSAMPLE].param =	    &downsample_p;
+  cc_map[CC_PAN].param =	    &pan_p;
+  cc_map[CC_PAN_DIST].param =	    &pan_dist_p;
+  cc_map[CC_LIVE_DLY].param =	    &live_dly_p;
+  cc_map[CC_DLY_MIX].param =	    &dly_mix_p;
+  cc_map[CC_DLY_TIME].param =	    &dly_time_p;
+  cc_map[CC_DLY_FBK].param =	    &dly_fbk_p;
+  cc_map[CC_DLY_XST].param =	    &dly_xst_p;
+  cc_map[CC_WIDTH].param =	    &width_p;
+  cc_map[CC_TGT_LOUD].param =	    &tgt_loud_p;
+  cc_map[CC_TGT_BRIGHT].param =	    &tgt_bright_p;
+  cc_map[CC_TGT_PITCH].param =	    &tgt_pitch_p;
+
+  cc_map[CC_TOG_GREV].fn =	  [](uint8_t val) { grnltrs[cur_layer].ToggleGrainReverse(); };
+  cc_map[CC_TOG_SREV].fn =	  [](uint8_t val) { QueueNote(cur_layer, NOTE_SCAN_REV, 0, 0, 0.0f); };
+  cc_map[CC_TOG_SCATTER].fn =	  [](uint8_t val) { grnltrs[cur_layer].ToggleScatter(); };
+  cc_map[CC_TOG_PITCH].fn =	  [](uint8_t val) { grnltrs[cur_layer].ToggleRandomPitch(); };
+  cc_map[CC_TOG_FREEZE].fn =	  [](uint8_t val) { grnltr.ToggleFreeze(); };
+  cc_map[CC_TOG_LOOP].fn =	  [](uint8_t val) { QueueNote(cur_layer, NOTE_TOG_LOOP, 0, 0, 0.0f); };
+  cc_map[CC_TOG_DENS].fn =	  [](uint8_t val) { grnltrs[cur_layer].ToggleRandomDensity(); };
+  cc_map[CC_TOG_OVERDUB].fn =	  [](uint8_t val) { grnltr.ToggleOverdub(); };
+  cc_map[CC_TOG_SKIP].fn =	  [](uint8_t val) { grnltrs[cur_layer].ToggleSkipSilence(); };
+  cc_map[CC_TOG_ZC].fn =	  [](uint8_t val) { grnltrs[cur_layer].ToggleSnapZC(); };
+  cc_map[CC_TOG_NORM].fn =	  [](uint8_t val) { QueueNote(cur_layer, NOTE_TOG_NORM, 0, 0, 0.0f); };
+  cc_map[CC_TOG_CONCAT].fn =	  [](uint8_t val) { grnltrs[cur_layer].ToggleConcat(); };
+  cc_map[CC_TOG_PSOLA].fn =	  [](uint8_t val) { grnltrs[cur_layer].TogglePsola(); };
+  cc_map[CC_TOG_STRETCH].fn =	  [](uint8_t val) { QueueNote(cur_layer, NOTE_TOG_STRETCH, 0, 0, 0.0f); };
+  cc_map[CC_TOG_PHASE_LOCK].fn =  [](uint8_t val) { phase_lock = !phase_lock; };
+  cc_map[CC_TOG_POLY].fn =	  [](uint8_t val) { grnltrs[cur_layer].TogglePoly(); };
+  cc_map[CC_TOG_MPE].fn =	  [](uint8_t val) { mmh.SetMPE((mmh.GetMPE() > 0) ? 0 : MIDI_CHANNELS - 1); };
+  cc_map[CC_HEADS].fn =		  [](uint8_t val) { QueueNote(cur_layer, NOTE_HEADS, 1 + ((val * MAX_HEADS) >> 7), 0, 0.0f); };
+  cc_map[CC_HEAD_SPREAD].fn =	  [](uint8_t val) { QueueNote(cur_layer, NOTE_HEAD_SPREAD, 0, 0, val / 127.0f); };
+  cc_map[CC_TOG_HEAD_WEIGHTS].fn = [](uint8_t val) { grnltrs[cur_layer].ToggleHeadWeights(); };
+  cc_map[CC_LAYER_SEL].fn =	  [](uint8_t val) { SelectLayer((val * MAX_LAYERS) >> 7); };
+  // 0 turns the layer off, 1 on picks the wave
+  cc_map[CC_LAYER_WAVE].fn =	  [](uint8_t val) { eq.push_event(eq.LAYER_WAVE, val); };
+  cc_map[CC_LAYER_LEVEL].fn =	  [](uint8_t val) { layers[cur_layer].level = val / 127.0f; };
+  cc_map[CC_LAYER_LO].fn =	  [](uint8_t val) { layers[cur_layer].lo = val; };
+  cc_map[CC_LAYER_HI].fn =	  [](uint8_t val) { layers[cur_layer].hi = val; };
+  cc_map[CC_REC_SRC].fn =	  [](uint8_t val) { rec_out = !rec_out; };
+  cc_map[CC_REC_BARS].fn =	  [](uint8_t val) { rec_bars = 1 + ((val * MAX_REC_BARS) / 128); };
+
+  cc_map[CC_LIVE_REC].fn =	  [](uint8_t val) { eq.push_event(eq.LIVE_REC, 0); };
+  cc_map[CC_LIVE_SAMP].fn =	  [](uint8_t val) { eq.push_event(eq.LIVE_PLAY, 0); };
+  cc_map[CC_REC].fn =		  [](uint8_t val) { eq.push_event(eq.REC, 0); };
+  cc_map[CC_BOUNCE].fn =	  [](uint8_t val) { eq.push_event(eq.BOUNCE, 0); };
+  // 0-63 saves stereo, 64-127 mono
+  cc_map[CC_SAVE_BOUNCE].fn =	  [](uint8_t val) { eq.push_event(eq.SAVE_BOUNCE, (val < 64) ? 2 : 1); };
+  cc_map[CC_TOG_RND_PAN].fn =	  [](uint8_t val) { eq.push_event(eq.TOG_RND_PAN, 0); };
+  cc_map[CC_TOG_RETRIG].fn =	  [](uint8_t val) { eq.push_event(eq.TOG_RETRIG, 0); };
+  cc_map[CC_TOG_GATE].fn =	  [](uint8_t val) { eq.push_event(eq.TOG_GATE, 0); };
+  cc_map[CC_NOTE].fn =		  [](uint8_t val) { eq.push_event(eq.TOG_NOTE, 0); };
+  cc_map[CC_GRAINENV].fn =	  [](uint8_t val) { eq.push_event(eq.INCR_GRAIN_ENV, 0); };
+  cc_map[CC_RST_PITCH_SCAN].fn =  [](uint8_t val) { eq.push_event(eq.RST_PITCH_SCAN, 0); };
+
+  // CC_BPM: 60 + CC, needs some concept of bars or beats per sample
+
+  // every param is 14 bit over NRPN, these two have CC pairs as well
+  mmh.SetCCPair(CC_SAMPLESTART_MSB, CC_SAMPLESTART_LSB);
+  mmh.SetCCPair(CC_SAMPLEEND_MSB, CC_SAMPLEEND_LSB);
+
+  for (size_t cc = 0; cc < MIDI_NUM_CC; cc++) {
+    mmh.SetCCCoalesce(cc, cc_map[cc].param != nullptr);
+  }
+}
+
 void MidiCCHCB(uint8_t cc, uint8_t val)
 {
-  switch(cc)
-  {
-    case CC_SCAN:
-      rate_p.MidiCCIn(val);
-      break;
-    case CC_GRAINPITCH:
-      pitch_p.MidiCCIn(val);
-      break;
-    case CC_GRAINDUR:
-      grain_duration_p.MidiCCIn(val);
-      break;
-    case CC_GRAINDENS:
-      grain_density_p.MidiCCIn(val);
-      break;
-    case CC_SCATTERDIST:
-      scatter_dist_p.MidiCCIn(val);
-      break;
-    case CC_PITCHDIST:
-      pitch_dist_p.MidiCCIn(val);
-      break;
-    case CC_SAMPLESTART_MSB:
-      sample_start_p.MidiCCIn(val);
-      break;
-    case CC_SAMPLEEND_MSB:
-      sample_end_p.MidiCCIn(val);
-      break;
-    case CC_SAMPLESTART_LSB:
-    {
-      float cur_val = sample_start_p.CurVal();
-      float lsb_val = ((val - 63) / (127.0f * 127.0f));
-      sample_start_p.RawSet(cur_val + lsb_val);
-      break;
-    }
-    case CC_SAMPLEEND_LSB:
-    {
-      float cur_val = sample_end_p.CurVal();
-      float lsb_val = ((val - 63) / (127.0f * 127.0f));
-      sample_end_p.RawSet(cur_val + lsb_val);
-      break;
-    }
-    case CC_CRUSH:
-      crush_p.MidiCCIn(val);
-      break;
-    case CC_DOWNSAMPLE:
-      downsample_p.MidiCCIn(val);
-      break;
-    case CC_TOG_GREV:
-      grnltr.ToggleGrainReverse();
-      break;
-    case CC_TOG_SREV:
-      grnltr.ToggleScanReverse();
-      break;
-    case CC_TOG_SCATTER:
-      grnltr.ToggleScatter();
-      break;
-    case CC_TOG_PITCH:
-      grnltr.ToggleRandomPitch();
-      break;
-    case CC_TOG_FREEZE:
-      grnltr.ToggleFreeze();
-      break;
-    case CC_TOG_LOOP:
-      grnltr.ToggleSampleLoop();
-      break;
-    case CC_TOG_DENS:
-      grnltr.ToggleRandomDensity();
-      break;
-    case CC_LIVE_REC:
-      eq.push_event(eq.LIVE_REC, 0);
-      break;
-    case CC_LIVE_SAMP:
-      eq.push_event(eq.LIVE_PLAY, 0);
-      break;
-    case CC_PAN:
-      pan_p.MidiCCIn(val);
-      break;
-    case CC_PAN_DIST:
-      pan_dist_p.MidiCCIn(val);
-      break;
-    case CC_TOG_RND_PAN:
-      eq.push_event(eq.TOG_RND_PAN, 0);
-      break;
-    case CC_TOG_RETRIG:
-      eq.push_event(eq.TOG_RETRIG, 0);
-      break;
-    case CC_TOG_GATE:
-      eq.push_event(eq.TOG_GATE, 0);
-      break;
-    case CC_DLY_MIX:
-      dly_mix_p.MidiCCIn(val);
-      break;
-    case CC_DLY_TIME:
-      dly_time_p.MidiCCIn(val);
-      break;
-    case CC_DLY_FBK:
-      dly_fbk_p.MidiCCIn(val);
-      break;
-    case CC_DLY_XST:
-      dly_xst_p.MidiCCIn(val);
-      break;
-    case CC_NOTE:
-      eq.push_event(eq.TOG_NOTE, 0);
-      break;
-    case CC_GRAINENV:
-      eq.push_event(eq.INCR_GRAIN_ENV, 0);
-      break;
-    case CC_RST_PITCH_SCAN:
-      eq.push_event(eq.RST_PITCH_SCAN, 0);
-      break;
-    case CC_BPM:
-      // 60 + CC 
-      // Need some concept of bars or beats per sample
-      break;
-    default: break;
+  cc_entry_t *e = &cc_map[cc & (MIDI_NUM_CC - 1)];
+  if (e->param != nullptr) {
+    e->param->MidiCCIn(val);
+  } else if (e->fn != nullptr) {
+    e->fn(val);
   }
 }
 
+void MidiCCRangeHCB(uint8_t cc, uint16_t val, uint16_t lo, uint16_t hi)
+{
+  cc_map[cc & (MIDI_NUM_CC - 1)].param->MidiCC14In(val, lo, hi);
+  midi_params = true;
+}
+
+// MPE master channel bend is still the whole zone's
 void MidiPBHCB(int16_t val)
 {
   pitch_p.MidiPBIn(val);
 }
 
-void MidiNOffHCB(uint8_t n, uint8_t vel) 
+static_assert((EXPR_BEND == (int)MidiMsgHandler<HW_TYPE>::Bend) && (EXPR_PRESSURE == (int)MidiMsgHandler<HW_TYPE>::Pressure) &&
+    (EXPR_SLIDE == (int)MidiMsgHandler<HW_TYPE>::Slide), "expression dims and types are in a different order");
+
+// the member's note could be in any layer's range, only the voices playing it take any notice
+void MidiExprHCB(uint8_t member, uint8_t type, float val)
+{
+  for (size_t l = 0; l < MAX_LAYERS; l++) {
+    grnltrs[l].SetExpression(member, type, val);
+  }
+}
+
+// A note in another layer's range plays that layer, from lo at the wave's own pitch
+void LayerNote(int8_t l, uint8_t n, uint8_t member, bool on)
+{
+  float pitch = powf(2, (n - layers[l].lo) / 12.0f);
+  if (grnltrs[l].IsPoly()) {
+    QueueNote(l, on ? NOTE_VOICE_ON : NOTE_VOICE_OFF, n, member, pitch);
+  } else if (on) {
+    if (l == cur_layer) pitch_p.Lock(pitch);
+    QueueNote(l, retrig ? NOTE_RESTART : NOTE_START, n, member, pitch);
+  } else if (gate) {
+    QueueNote(l, NOTE_STOP, n, member, 0.0f);
+  }
+}
+
+void MidiNOffHCB(uint8_t n, uint8_t vel, uint8_t member) 
 { 
   int8_t this_wave = n - BASE_NOTE;
-  if ((this_wave == cur_wave) || note) {
+  int8_t l = NoteLayer(n);
+  if (l > 0) {
+    LayerNote(l, n, member, false);
+  } else if (note && grnltr.IsPoly()) {
+    QueueNote(0, NOTE_VOICE_OFF, n, member, 0.0f);
+  } else if ((this_wave == cur_wave) || note) {
     if (gate) {
       if (!note | (--note_on_count == 0)) {
-	grnltr.Stop();
+	QueueNote(0, NOTE_STOP, n, 0, 0.0f);
       }
     }
   }
 }
 
-void MidiNOnHCB(uint8_t n, uint8_t vel) 
+void MidiNOnHCB(uint8_t n, uint8_t vel, uint8_t member) 
 { 
   int8_t next_wave;
 
   // Handle note on with 0 velocity as note off
   if (vel == 0) {
-    MidiNOffHCB(n, vel);
+    MidiNOffHCB(n, vel, member);
     return;
   }
 
-  if (note) {
-    pitch_p.Lock(powf(2, (n - BASE_NOTE) / 12.0f));
+  int8_t l = NoteLayer(n);
+  if (l > 0) {
+    LayerNote(l, n, member, true);
+  } else if (note && grnltr.IsPoly()) {
+    // each note has its own pitch, the grain pitch param transposes them all
+    QueueNote(0, NOTE_VOICE_ON, n, member, powf(2, (n - BASE_NOTE) / 12.0f));
+  } else if (note) {
+    float pitch = powf(2, (n - BASE_NOTE) / 12.0f);
+    // the lock keeps Parameters() agreeing with the pitch the note brings with it
+    if (cur_layer == 0) pitch_p.Lock(pitch);
     if (gate) { 
       note_on_count++;
     }
-    if (retrig) {
-      grnltr.ReStart();
-    } else {
-      grnltr.Start();
-    }
+    QueueNote(0, retrig ? NOTE_RESTART : NOTE_START, n, 0, pitch);
   } else if ((n >= BASE_NOTE) && (n < (BASE_NOTE + wav_file_count))) {
     next_wave = n - BASE_NOTE;
     if (next_wave != cur_wave) {
       cur_wave = next_wave;
-      grnltr.Stop();
       InitControls();
-      grnltr.Reset( \
-          &sm[wav_info[cur_wave].wav_start_pos], \
-          wav_info[cur_wave].wav_file_hdr.raw_data.SubCHunk2Size / sizeof(int16_t), \
-	  wav_info[cur_wave].loop, wav_info[cur_wave].rev);
-      sample_bpm = wav_info[cur_wave].bpm;
-      grnltr.Dispatch(0);
+      ResetWave();
     } else {
-      if (retrig) {
-	grnltr.ReStart();
-      } else {
-	grnltr.Start();
-      }
+      QueueNote(0, retrig ? NOTE_RESTART : NOTE_START, n, 0, 0.0f);
     }
   }
 }
@@ -545,6 +1453,9 @@ void MidiNOnHCB(uint8_t n, uint8_t vel)
 void process_events()
 {
   EventQueue<QUEUE_LENGTH>::event_entry ev = eq.pull_event();
+#ifdef DEBUG_POD
+  if ((System::GetNow() - ev.time) > event_wait) event_wait = System::GetNow() - ev.time;
+#endif
   switch(ev.ev) {
     case eq.PAGE_UP:
       cur_page++;
@@ -559,7 +1470,7 @@ void process_events()
       if (cur_grain_env == NUM_GRAIN_ENVS) {
         cur_grain_env = 0;
       }
-      grnltr.ChangeEnv(grain_envs[cur_grain_env]);
+      grnltrs[cur_layer].ChangeEnv(grain_envs[cur_grain_env]);
       break;
     case eq.RST_PITCH_SCAN:
       pitch_p.Lock(1.0f);
@@ -567,58 +1478,47 @@ void process_events()
       mmh.ResetGotClock();
       break;
     case eq.TOG_GRAIN_REV:
-      grnltr.ToggleGrainReverse();
+      grnltrs[cur_layer].ToggleGrainReverse();
       break;
     case eq.TOG_SCAN_REV:
-      grnltr.ToggleScanReverse();
+      QueueNote(cur_layer, NOTE_SCAN_REV, 0, 0, 0.0f);
       break;
     case eq.TOG_SCAT:
-      grnltr.ToggleScatter();
+      grnltrs[cur_layer].ToggleScatter();
       break;
     case eq.TOG_FREEZE:
       grnltr.ToggleFreeze();
       break;
     case eq.TOG_RND_PITCH:
-      grnltr.ToggleRandomPitch();
+      grnltrs[cur_layer].ToggleRandomPitch();
       break;
     case eq.TOG_RND_DENS:
-      grnltr.ToggleRandomDensity();
+      grnltrs[cur_layer].ToggleRandomDensity();
       break;
     case eq.INCR_WAV:
       cur_wave++;
       if (cur_wave >= wav_file_count) cur_wave = 0;
-      grnltr.Stop();
       InitControls();
-      grnltr.Reset( \
-          &sm[wav_info[cur_wave].wav_start_pos], \
-          wav_info[cur_wave].wav_file_hdr.raw_data.SubCHunk2Size / sizeof(int16_t), \
-	  wav_info[cur_wave].loop, wav_info[cur_wave].rev);
-      sample_bpm = wav_info[cur_wave].bpm;
-
-      grnltr.Dispatch(0);
+      ResetWave();
       break;
     case eq.TOG_LOOP:
-      grnltr.ToggleSampleLoop();
+      QueueNote(cur_layer, NOTE_TOG_LOOP, 0, 0, 0.0f);
       break;
     case eq.LIVE_REC:
-      grnltr.Stop();
+      stream.Close();
       InitControls();
-      grnltr.Live( \
-          &sm[0], \
-          live_rec_buf_len);
+      // start from silence rather than whatever was left from last time
+      memset(live_src.start, 0, live_src.len * 2 * sizeof(int16_t));
+      QueueNote(0, NOTE_LIVE_REC, 0, 0, 0.0f);
       sample_bpm = DEFAULT_BPM;
       break;
     case eq.LIVE_PLAY:
       gate = false;
       retrig = false;
-      grnltr.Stop();
+      stream.Close();
       InitControls();
-      grnltr.Reset( \
-          &sm[0], \
-          live_rec_buf_len, \
-	  true, false);
+      QueueNote(0, NOTE_LIVE_PLAY, 0, 0, 0.0f);
       sample_bpm = DEFAULT_BPM;
-      grnltr.Dispatch(0);
       break;
     case eq.INCR_MIDI:
       cur_midi_channel++;
@@ -627,18 +1527,30 @@ void process_events()
       break;
     case eq.NEXT_DIR:
       cur_dir = ev.id;
-      grnltr.Stop();
+      // the other layers' waves are about to go
+      LayersOff();
       InitControls();
-      LoadNewDir();
-      grnltr.Reset( \
-          &sm[wav_info[cur_wave].wav_start_pos], \
-          wav_info[cur_wave].wav_file_hdr.raw_data.SubCHunk2Size / sizeof(int16_t), \
-	  wav_info[cur_wave].loop, wav_info[cur_wave].rev);
-      sample_bpm = wav_info[cur_wave].bpm;
-      grnltr.Dispatch(0);
+      // the callback stops every grain at its next block, then LoadTask() reads the new bank in
+      // from idle time and switches to it once it's all there, one already on its way in is dropped
+      bank_quiet = false;
+      bank_listed = false;
+      __atomic_signal_fence(__ATOMIC_SEQ_CST);
+      bank_loading = true;
       break;
     case eq.TOG_RND_PAN:
-      grnltr.ToggleRandomPan();
+      grnltrs[cur_layer].ToggleRandomPan();
+      break;
+    case eq.TOG_OVERDUB:
+      grnltr.ToggleOverdub();
+      break;
+    case eq.REC:
+      ToggleRecord();
+      break;
+    case eq.BOUNCE:
+      ToggleBounce();
+      break;
+    case eq.SAVE_BOUNCE:
+      SaveBounce(ev.id);
       break;
     case eq.TOG_RETRIG:
       if (!grnltr.IsLive()) {
@@ -654,6 +1566,15 @@ void process_events()
       note = !note;
       note_on_count = 0;
       break;
+    case eq.LAYER_WAVE:
+      if (cur_layer > 0) {
+	SetLayerWave(cur_layer, (int8_t)ev.id - 1);
+      } else if ((ev.id > 0) && (ev.id <= wav_file_count)) {
+	cur_wave = ev.id - 1;
+	InitControls();
+	ResetWave();
+      }
+      break;
     case eq.NONE:
     default:
       break;
@@ -662,12 +1583,16 @@ void process_events()
 
 void InitControls()
 {
+  // they're the main layer's
+  SelectLayer(0);
   pitch_p.Init(           0,  DEFAULT_GRAIN_PITCH,	MIN_GRAIN_PITCH,  MAX_GRAIN_PITCH,  PARAM_THRESH);
   rate_p.Init(            0,  DEFAULT_SCAN_RATE,        MIN_SCAN_RATE,	  MAX_SCAN_RATE,    PARAM_THRESH);
   grain_duration_p.Init(  1,  DEFAULT_GRAIN_DUR,        MIN_GRAIN_DUR,    MAX_GRAIN_DUR,    PARAM_THRESH);
   grain_density_p.Init(   1,  sr/DEFAULT_GRAIN_DENS,  sr/MIN_GRAIN_DENS, sr/MAX_GRAIN_DENS, PARAM_THRESH);
   scatter_dist_p.Init(    2,  DEFAULT_SCATTER_DIST,	0.0f,   1.0f, PARAM_THRESH);
+  live_dly_p.Init(	  2,  DEFAULT_LIVE_DLY,		0.0f,   1.0f, PARAM_THRESH);
   pitch_dist_p.Init(      3,  DEFAULT_PITCH_DIST,       0.0f,   1.0f, PARAM_THRESH);
+  width_p.Init(		  3,  DEFAULT_WIDTH,		0.0f,   1.0f, PARAM_THRESH);
   sample_start_p.Init(    4,  0.0f,			0.0f,   1.0f, PARAM_THRESH);
   sample_end_p.Init(	  4,  1.0f,			0.0f,   1.0f, PARAM_THRESH);
   crush_p.Init(           5,  0.0f,                     0.0f,   1.0f, PARAM_THRESH);
@@ -678,6 +1603,9 @@ void InitControls()
   dly_time_p.Init( 	  7,  DEFAULT_DLY,		0.0f,   1.0f, PARAM_THRESH);
   dly_fbk_p.Init(	  8,  DEFAULT_FBK,		0.0f,   1.0f, PARAM_THRESH);
   dly_xst_p.Init(	  8,  DEFAULT_XST,		0.0f,   1.0f, PARAM_THRESH);
+  tgt_loud_p.Init(	  CC_ONLY_PAGE, DEFAULT_TGT,	0.0f,   1.0f, PARAM_THRESH);
+  tgt_bright_p.Init(	  CC_ONLY_PAGE, DEFAULT_TGT,	0.0f,   1.0f, PARAM_THRESH);
+  tgt_pitch_p.Init(	  CC_ONLY_PAGE, DEFAULT_TGT,	0.0f,   1.0f, PARAM_THRESH);
 }
 
 void Controls(int8_t cur_page)
@@ -688,14 +1616,17 @@ void Controls(int8_t cur_page)
   k2 = knob2.Process();
   
   grnltr_params.GrainPitch =   pitch_p.Process(k1, cur_page);
-  if (mmh.GotClock()) {
-    rate_p.Set((mmh.GetBPM() / sample_bpm));
+  if (mmh.GotClock() && mmh.ClockLocked()) {
+    transport.SetBPM(mmh.GetBPM());
+    rate_p.Set((mmh.GetBPM() / LayerBPM(cur_layer)));
   }
   grnltr_params.ScanRate =     rate_p.Process(k2, cur_page);
   grnltr_params.GrainDur =     grain_duration_p.Process(k1, cur_page);
   grnltr_params.GrainDens =    (int32_t)grain_density_p.Process(k2, cur_page);
   grnltr_params.ScatterDist =  scatter_dist_p.Process(k1, cur_page);
+  grnltr_params.LiveDelay =    live_dly_p.Process(k2, cur_page);
   grnltr_params.PitchDist =    pitch_dist_p.Process(k1, cur_page);
+  grnltr_params.Width =	       width_p.Process(k2, cur_page);
   grnltr_params.SampleStart =  sample_start_p.Process(k1, cur_page);
   grnltr_params.SampleEnd =    sample_end_p.Process(k2, cur_page);
   grnltr_params.Crush =        crush_p.Process(k1, cur_page);
@@ -706,27 +1637,148 @@ void Controls(int8_t cur_page)
   grnltr_params.DelayTime =    dly_time_p.Process(k2, cur_page);
   grnltr_params.DelayFbk =     dly_fbk_p.Process(k1, cur_page);
   grnltr_params.DelayXSt =     dly_xst_p.Process(k2, cur_page);
+  grnltr_params.TargetLoud =   tgt_loud_p.Process(k1, cur_page);
+  grnltr_params.TargetBright = tgt_bright_p.Process(k1, cur_page);
+  grnltr_params.TargetPitch =  tgt_pitch_p.Process(k2, cur_page);
 }
 
+// the callback does the setting, see ApplyParams()
 void Parameters() {
-  grnltr.SetGrainPitch(grnltr_params.GrainPitch);
-  grnltr.SetScanRate(grnltr_params.ScanRate);
-  grnltr.SetGrainDuration(grnltr_params.GrainDur);
-  grnltr.SetDensity(grnltr_params.GrainDens);
-  grnltr.SetScatterDist(grnltr_params.ScatterDist);
-  grnltr.SetPitchDist(grnltr_params.PitchDist);
-  grnltr.SetSampleStart(grnltr_params.SampleStart);
-  grnltr.SetSampleEnd(grnltr_params.SampleEnd);
-  grnltr.SetPan(grnltr_params.Pan);
-  grnltr.SetPanDist(grnltr_params.PanDist);
-  crush_l.SetBitcrushFactor(grnltr_params.Crush);
-  crush_l.SetDownsampleFactor(grnltr_params.DownSample);
-  crush_r.SetBitcrushFactor(grnltr_params.Crush);
-  crush_r.SetDownsampleFactor(grnltr_params.DownSample);
+  param_snap_t *snap = param_snap.Back();
+
+  snap->Params = grnltr_params;
+  snap->BeatFrames = (sr * SPM) / LayerBPM(cur_layer);
+  snap->Layer = cur_layer;
+  param_snap.Publish();
 }
 
+/*
+ * The main loop's tasks. MIDI is polled at the highest priority so nothing else can sit in front of it
+ * for more than one run of itself, the knobs, buttons and their events at 1kHz, params at MAIN_LOOP_DLY
+ * (or straight away, at most every MIDI_PARAM_DLY, when MIDI has moved one), the UI at UI_PERIOD_US.
+ * The SD card work - streaming, recording and marking waves - fills whatever time is left.
+ */
+Scheduler sched;
+size_t params_task;
+uint32_t midi_dly = 0;
+#ifdef DEBUG_POD
+uint32_t rec_ms = 0;
+#endif
+
+void MidiTask()
+{
+  mmh.Process();
+  if (midi_params && ((System::GetNow() - midi_dly) >= MIDI_PARAM_DLY)) {
+    midi_dly = System::GetNow();
+    sched.Wake(params_task);
+  }
+}
 
-int main(void)
+void ControlsTask()
+{
+  hw.ProcessDigitalControls();
+  UpdateEncoder(cur_page);
+#ifdef TARGET_POD
+  UpdateButtons(cur_page);
+#endif
+  while (eq.has_event()) {
+    process_events();
+  }
+}
+
+void ParamsTask()
+{
+  Controls(cur_page);
+  // hi tele_player
+  Parameters();
+  midi_params = false;
+}
+
+void UITask()
+{
+  UpdateUI(cur_page);
+}
+
+// blinks the seed's LED, debug builds say how things are going
+void StatusTask()
+{
+  static bool led_state = true;
+
+  hw.seed.SetLed(led_state);
+  led_state = !led_state;
+#ifdef DEBUG_POD
+  const task_t *t;
+
+  hw.seed.PrintLine("CPU avg %d%% max %d%%", \
+      (int)(cpu_meter.GetAvgCpuLoad() * 100.0f), (int)(cpu_meter.GetMaxCpuLoad() * 100.0f));
+  if (stream.IsOpen()) {
+    hw.seed.PrintLine("Stream underruns %d", stream.Underruns());
+  }
+  hw.seed.PrintLine("Events dropped %d high water %d/%d longest wait %dms", \
+      eq.Dropped(), eq.HighWater(), QUEUE_LENGTH, event_wait);
+  for (size_t i = 0; i < sched.Tasks(); i++) {
+    t = sched.Task(i);
+    hw.seed.PrintLine("%s: %d runs, worst %duS, %d over budget, %d late", \
+	t->name, t->runs, t->worst, t->overruns, t->late);
+  }
+#endif
+}
+
+// FatFS blocks so streamed waves are read from here, never from the callback
+void StreamTask()
+{
+  if (!wave_queued) stream.Service(grnltr.GetScanPos(), grnltr.ScanReverse(), grnltr.GetScanRate());
+  if (bounce.IsDone()) {
+    AddBounce();
+  }
+}
+
+void RecTask()
+{
+  if (!rec.IsRecording()) return;
+#ifdef DEBUG_POD
+  uint32_t rec_start = System::GetNow();
+#endif
+  rec.Service();
+  if ((saving_bounce >= 0) && !rec.IsRecording()) {
+    BounceSaved();
+  }
+#ifdef DEBUG_POD
+  rec_ms += System::GetNow() - rec_start;
+  if (!rec.IsRecording()) {
+    hw.seed.PrintLine("Recorded %d bytes, %dKB/s, high water %d frames, %d overruns", \
+	rec.BytesWritten(), rec_ms ? (int)(rec.BytesWritten() / rec_ms) : 0, \
+	rec.HighWater(), rec.Overruns());
+    rec_ms = 0;
+  }
+#endif
+}
+
+void MarksTask()
+{
+  if (!bank_loading) MarkWaves();
+}
+
+// a new bank goes in a buffer at a time
+void LoadTask()
+{
+  // not a byte of the old bank is touched until the callback's had a block to stop reading it
+  if (!bank_loading || !bank_quiet) return;
+  if (!bank_listed) {
+    StartBank();
+    bank_listed = true;
+    return;
+  }
+  if (LoadBankStep()) return;
+  BankLoaded();
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  bank_loading = false;
+  ResetWave();
+}
+
+
+// Everything up to the main loop, the host tests boot through here too
+void Setup()
 {
   rectangular_window(rect_env, GRAIN_ENV_SIZE);
   gaussian_window(gauss_env, GRAIN_ENV_SIZE, 0.5f);
@@ -739,6 +1791,7 @@ int main(void)
 
 #ifdef DEBUG_POD
   hw.seed.StartLog(true);
+  cpu_meter.Init(sr, hw.AudioBlockSize());
 #endif
 
   Status(STARTUP);
@@ -788,14 +1841,31 @@ int main(void)
 
   Status(GRNLTR_INIT);
 
+  rec.Init(rec_stage, REC_HALF_FRAMES, buf, CP_BUF_SIZE);
+  bounce.Init();
+  marker.Init(sr);
+
+  // nothing to play if the first wave is streamed and won't open, the live buffer stands in, silent and stopped
+  const sample_src_t *first_src = &wav_info[cur_wave].src;
+  if (!OpenStream(&wav_info[cur_wave])) {
+    memset(live_src.start, 0, live_src.len * 2 * sizeof(int16_t));
+    first_src = &live_src;
+  }
   grnltr.Init(sr, \
-      &sm[wav_info[cur_wave].wav_start_pos], \
-      wav_info[cur_wave].wav_file_hdr.raw_data.SubCHunk2Size / sizeof(int16_t), \
+      first_src, \
       grain_envs[cur_grain_env], \
       GRAIN_ENV_SIZE, \
       wav_info[cur_wave].loop, wav_info[cur_wave].rev);
+  for (size_t l = 0; l < MAX_LAYERS; l++) {
+    if (l > 0) {
+      grnltrs[l].Init(sr, first_src, grain_envs[cur_grain_env], GRAIN_ENV_SIZE, false, false);
+    }
+    grnltrs[l].SetCorpus(&corpus);
+    grnltrs[l].SetHannEnv(hann_env);
+  }
   sample_bpm = wav_info[cur_wave].bpm;
   grnltr.Dispatch(0);
+  if (first_src == &live_src) grnltr.Stop();
   
   crush_l.Init();
   crush_l.SetDownsampleFactor(0.0f);
@@ -808,6 +1878,8 @@ int main(void)
   delr.SetDelay(sr * 0.5f);
 
   InitControls();
+  InitLayers();
+  InitSmoothers();
 
   // Setup Midi and Callbacks
   mmh.SetChannel(cur_midi_channel);
@@ -818,15 +1890,24 @@ int main(void)
   mmh.SetSRTCB(mmh.Stop,      RTStopCB);
   mmh.SetSRTCB(mmh.Beat,      RTBeatCB);
   mmh.SetSRTCB(mmh.HalfBeat,  RTHalfBeatCB);
+  mmh.SetSRTCB(mmh.Clock,     RTClockCB);
+  mmh.SetSPPHCB(MidiSPPHCB);
+  transport.Init(sr, mmh.GetPPQN());
+  block_clock.Init(System::GetTick, sr / (2.0f * System::GetPClk1Freq()));
   mmh.SetMNOnHCB(MidiNOnHCB);
   mmh.SetMNOffHCB(MidiNOffHCB);
   mmh.SetMCCHCB(MidiCCHCB);
+  mmh.SetMCCRangeHCB(MidiCCRangeHCB);
+  InitCCMap();
   mmh.SetMPBHCB(MidiPBHCB);
+  mmh.SetExprHCB(MidiExprHCB);
 
   grnltr_delay(250);
 
   Status(OK);
   
+  eq.SetClock(System::GetNow);
+
   // GO!
   hw_start(AudioCallback);
   hw.ProcessDigitalControls();
@@ -835,42 +1916,24 @@ int main(void)
   }
   UpdateUI(cur_page);
 
-  int blink_mask = 15; 
-  int blink_cnt = 0;
-  uint32_t now = hw.seed.system.GetNow();
-  uint32_t loop_dly = now;
+  sched.Init(System::GetUs);
+  sched.AddTask("midi", MidiTask, MIDI_PERIOD_US, MIDI_BUDGET_US, 0);
+  sched.AddTask("controls", ControlsTask, CONTROLS_PERIOD_US, CONTROLS_BUDGET_US, 1);
+  params_task = sched.AddTask("params", ParamsTask, MAIN_LOOP_DLY * 1000, PARAMS_BUDGET_US, 2);
+  sched.AddTask("ui", UITask, UI_PERIOD_US, UI_BUDGET_US, 3);
+  sched.AddTask("status", StatusTask, STATUS_PERIOD_US, STATUS_BUDGET_US, 4);
+  sched.AddTask("stream", StreamTask, TASK_IDLE, SD_BUDGET_US, 5);
+  sched.AddTask("rec", RecTask, TASK_IDLE, SD_BUDGET_US, 5);
+  sched.AddTask("marks", MarksTask, TASK_IDLE, SD_BUDGET_US, 5);
+  sched.AddTask("load", LoadTask, TASK_IDLE, SD_BUDGET_US, 5);
+}
+
+int main(void)
+{
+  Setup();
 
-  bool led_state = true;
   for(;;)
   {
-    mmh.Process();
-
-    hw.ProcessDigitalControls();
-    UpdateEncoder(cur_page);
-
-    #ifdef TARGET_POD
-    UpdateButtons(cur_page);
-    #endif
-
-    while (eq.has_event()) {
-      process_events();
-    }
-    UpdateUI(cur_page);
-
-    // counter here so we don't do this too often if it's called repeatedly in the main loop
-    now = hw.seed.system.GetNow();
-    if ((now - loop_dly > MAIN_LOOP_DLY) || (now < loop_dly)) {
-      Controls(cur_page);
-      // hi tele_player
-      Parameters();
-
-      blink_cnt &= blink_mask;
-      if (blink_cnt == 0) {
-        hw.seed.SetLed(led_state);
-        led_state = !led_state;
-      }
-      blink_cnt++;
-      loop_dly = now;
-    } 
+    sched.Run();
   }
 }
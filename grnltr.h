@@ -1,6 +1,9 @@
 #pragma once
 
 #include "util/wav_format.h"
+#include "sample_src.h"
+#include "sample_index.h"
+#include "pitch_marks.h"
 
 #define GRAIN_ENV_SIZE 1024
 #define NUM_GRAIN_ENVS 6
@@ -11,8 +14,31 @@
 #define MAX_DIR_LENGTH  64
 #define MAX_WAVES	16
 #define LINE_BUF_SIZE	128
+// file,bpm,loop,rev[,adpcm]
+#define MAX_CFG_TOKENS	5
 
 #define CP_BUF_SIZE 8192
+// live record buffer, ~21s of stereo at 48k, must be a power of 2
+#define LIVE_BUF_FRAMES (1 << 20)
+// frames of stereo kept in SDRAM for a streamed wave, must be a power of 2
+#define STREAM_WIN_FRAMES (1 << 20)
+#define PCM_STAGE_FRAMES 2048
+// recorder staging, two halves of stereo kept at the very top of SDRAM
+#define REC_HALF_FRAMES (1 << 16)
+#define REC_STAGE_BYTES (2 * REC_HALF_FRAMES * 2 * sizeof(int16_t))
+#define REC_BARS	4
+#define MAX_REC_BARS	16
+#define BEATS_PER_BAR	4
+#define REC_NAME	"rec%03d.wav"
+#define BOUNCE_NAME	"bounce%03d.wav"
+#define MAX_RECS	1000
+
+// LoadWav results
+#define LOAD_OK		0
+#define LOAD_ERR	-1
+#define LOAD_NO_ROOM	-2
+// BeginWav()/LoadChunk() have more to read
+#define LOAD_BUSY	1
 
 #define DEFAULT_BPM 120.0f
 
@@ -51,17 +77,70 @@
 #define	CC_NOTE		    42
 #define CC_GRAINENV	    43
 #define CC_RST_PITCH_SCAN   46
+#define CC_WIDTH	    47
+#define CC_LIVE_DLY	    48
+#define CC_TOG_OVERDUB	    49
+#define CC_REC		    50
+#define CC_REC_BARS	    51
+#define CC_REC_SRC	    52
+#define CC_BOUNCE	    53
+#define CC_SAVE_BOUNCE	    54
+#define CC_TOG_SKIP	    55
+#define CC_TOG_ZC	    56
+#define CC_TOG_NORM	    57
+#define CC_TOG_CONCAT	    58
+#define CC_TGT_LOUD	    59
+#define CC_TGT_BRIGHT	    60
+#define CC_TGT_PITCH	    61
+#define CC_TOG_PSOLA	    62
+#define CC_TOG_STRETCH	    63
+#define CC_TOG_PHASE_LOCK   64
+#define CC_TOG_POLY	    65
+#define CC_TOG_MPE	    66
+#define CC_LAYER_SEL	    67
+#define CC_LAYER_WAVE	    68
+#define CC_LAYER_LEVEL	    69
+#define CC_LAYER_LO	    70
+#define CC_LAYER_HI	    71
+#define CC_HEADS	    72
+#define CC_HEAD_SPREAD	    73
+#define CC_TOG_HEAD_WEIGHTS 75
 //C3
 #define BASE_NOTE	    60
 
 // 33mS - something like 30Hz
 #define MAIN_LOOP_DLY	   33 
+// params moved by MIDI are passed on this often, smooth automation doesn't step at 30Hz
+#define MIDI_PARAM_DLY	   1
+// main loop tasks, periods and how long each should take in uS
+#define MIDI_PERIOD_US	   250
+#define MIDI_BUDGET_US	   200
+#define CONTROLS_PERIOD_US 1000
+#define CONTROLS_BUDGET_US 200
+#define PARAMS_BUDGET_US   500
+#define UI_BUDGET_US	   5000
+#define STATUS_PERIOD_US   (16 * MAIN_LOOP_DLY * 1000)
+#define STATUS_BUDGET_US   5000
+#define SD_BUDGET_US	   5000
+// notes waiting for the audio callback, power of 2
+#define NOTE_QUEUE_LEN	   32
+
+#define MAX_LAYERS	   4
+#define NUM_LAYER_PARAMS   15
+// layer levels are smoothed over about 10mS
+#define LAYER_GAIN_COEF	   0.002f
+#define LAYER_SILENT	   0.0001f
 
 typedef struct {
   WavFileInfo wav_file_hdr;
-  size_t      wav_start_pos;
+  sample_src_t src; // after conversion
   float	      bpm;
   bool	      loop;
   bool	      rev;
+  bool	      adpcm; // store compressed
+  bool	      stream; // too big for SDRAM, played straight off the card
+  size_t      data_offset; // where the sample data starts in the file when streaming
+  sample_index_t index;
+  pitch_marks_t marks;
 } wav_info_t;
 
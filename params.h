@@ -21,25 +21,62 @@
 #define DEFAULT_GRAIN_VOL     0.7f
 #define DEFAULT_PAN	      0.5f
 #define DEFAULT_PAN_DIST      0.5f
+#define DEFAULT_WIDTH	      1.0f
+#define DEFAULT_LIVE_DLY      0.0f
 #define DEFAULT_MIX	      0.0f
 #define DEFAULT_DLY	      0.5f
 #define DEFAULT_FBK	      0.0f
 #define DEFAULT_XST	      0.0f
+#define DEFAULT_TGT	      0.5f
+// the concatenative targets are only on midi, they don't live on any knob page
+#define CC_ONLY_PAGE	      NUM_PAGES
 
 #define MAX_DELAY static_cast<size_t>(48000)
 
 
 #define PARAM_THRESH 0.01f
+
+// params arrive every MAIN_LOOP_DLY, the linear ones ramp over about that so they never stop moving in between
+#define SMOOTH_GLIDE_SECS     0.033f
+#define SMOOTH_SECS	      0.02f
+// the same as the old per sample one pole on the delay time
+#define SMOOTH_DLY_SECS	      0.3f
+
+// each layer's continuous controls, smoothed in the callback and set on its granulator once a block
+enum grain_smooth {
+  SM_PITCH,	  // linear
+  SM_RATE,	  // linear
+  SM_PAN,	  // linear
+  SM_DUR,
+  SM_SCATTER,
+  SM_PITCH_DIST,
+  SM_PAN_DIST,
+  SM_WIDTH,
+  SM_LIVE_DLY,
+  SM_GRAIN_PARAMS
+};
+
+// the delay's, ramped across the block a sample at a time
+// feedback and cross feed are smoothed as the two gains they make so there's less to do per sample
+enum fx_smooth {
+  SM_DLY_MIX,
+  SM_DLY_TIME,	  // frames
+  SM_DLY_DIRECT,  // feedback * (1 - cross)
+  SM_DLY_CROSS,	  // feedback * cross
+  SM_FX_PARAMS
+};
 extern PagedParam pitch_p, rate_p, crush_p, downsample_p, grain_duration_p, \
 		  grain_density_p, scatter_dist_p, pitch_dist_p, sample_start_p, \
 		  sample_end_p, pan_p, pan_dist_p, dly_mix_p, dly_time_p, \
-		  dly_fbk_p, dly_xst_p;
+		  dly_fbk_p, dly_xst_p, width_p, live_dly_p, \
+		  tgt_loud_p, tgt_bright_p, tgt_pitch_p;
 
 typedef struct {
   float	  GrainPitch;
   float   ScanRate;
   float   GrainDur;
   float	  ScatterDist;
+  float	  LiveDelay;
   float	  PitchDist;
   float	  SampleStart;
   float	  SampleEnd;
@@ -47,11 +84,22 @@ typedef struct {
   float	  DownSample;
   float	  Pan;
   float	  PanDist;
+  float	  Width;
   float	  DelayMix;
   float	  DelayTime;
   float	  DelayFbk;
   float	  DelayXSt;
+  float	  TargetLoud;
+  float	  TargetBright;
+  float	  TargetPitch;
   int32_t GrainDens;
 } grnltr_params_t;
 
 extern grnltr_params_t grnltr_params;
+
+// what the callback picks up, the knobs and which layer they're for
+typedef struct {
+  grnltr_params_t Params;
+  float	  BeatFrames;
+  int8_t  Layer;
+} param_snap_t;
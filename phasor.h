@@ -2,12 +2,14 @@
 
 #define MIN_SAMP 48
 
-class Phasor
+// P is what the position's kept in, see the typedefs at the end
+template <typename P>
+class PhasorT
 {
   public:
 
-    Phasor() {}
-    ~Phasor() {} 
+    PhasorT() {}
+    ~PhasorT() {} 
 
     void Init(float sr, size_t len) 
     {
@@ -16,7 +18,7 @@ class Phasor
       start_pos_ = loop_pos_ = 0;
       cur_pos_ = 0;
       phase_incr_ = 1;
-      loop_ = ping_pong_ = false;
+      loop_ = ping_pong_ = reverse_ = false;
       play_ = true;
     }
 
@@ -51,10 +53,9 @@ class Phasor
     }
 
     // Set cur_pos_ exactly
-    // don't need to check for < 0 as size_t is unsigned?
-    void SetCurPos(size_t pos)
+    void SetCurPos(double pos)
     {
-      cur_pos_ = (pos > len_) ? len_ : pos;
+      cur_pos_ = (pos < 0.0) ? 0.0 : ((pos > len_) ? len_ : pos);
     }
 
     // Don't let end_pos_ get in front of start_pos_
@@ -122,12 +123,32 @@ class Phasor
       play_ = true;
     }
 
-    inline float GetPos()
+    inline P GetPos()
     {
       return cur_pos_;
     }
+
+    inline size_t GetStartPos()
+    {
+      return start_pos_;
+    }
+
+    inline size_t GetEndPos()
+    {
+      return end_pos_;
+    }
+
+    inline bool IsReverse()
+    {
+      return reverse_;
+    }
+
+    inline float GetRate()
+    {
+      return phase_incr_;
+    }
     
-    float Process(bool *eot)
+    P Process(bool *eot)
     {
       *eot = false;
       if (play_) {
@@ -167,6 +188,12 @@ class Phasor
   protected:
     bool loop_, ping_pong_, reverse_, play_;
     size_t start_pos_, end_pos_, loop_pos_, len_;
-    float sr_, cur_pos_, phase_incr_;
+    float sr_, phase_incr_;
+    P cur_pos_;
 };
 
+// grains and envelopes, they only ever go a short way from where they start
+typedef PhasorT<float> Phasor;
+// scan heads cross the whole wave, a float runs out of fraction past 2^24 frames and long streamed waves get that far
+typedef PhasorT<double> ScanPhasor;
+
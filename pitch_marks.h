@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include "sample_src.h"
+#include "sample_index.h"
+
+// pitch range we look for
+#define PM_MIN_HZ	    60.0f
+#define PM_MAX_HZ	    800.0f
+// the period is estimated on a 4x decimated copy, correlating PM_WIN frames of it (~21mS at 48k)
+#define PM_DECIM	    4
+#define PM_WIN		    256
+#define PM_MAX_LAG	    512
+// re-estimate the period once the marks have moved on this far
+#define PM_HOP		    512
+// normalised correlation needed to call it pitched
+#define PM_VOICED	    0.6f
+// take the shortest lag that's this close to the best one, longer ones are usually octave errors
+#define PM_OCTAVE	    0.9f
+// unpitched stretches are marked every 5mS
+#define PM_UNVOICED_SECS    0.005f
+// marks found per Service call, keeps the main loop moving
+#define PM_SERVICE_MARKS    32
+
+typedef struct pitch_marks_s {
+  uint32_t	*pos;
+  size_t	n;
+  volatile bool	ready; // set once the whole wave is marked, nothing reads pos before then
+} pitch_marks_t;
+
+// the next mark is searched for within a quarter period either side, so they're never closer than 3/4 of the shortest period
+inline size_t PitchMarksBytes(size_t frames, float sr)
+{
+  return ((size_t)((frames * PM_MAX_HZ * 4.0f) / (3.0f * sr)) + 2) * sizeof(uint32_t);
+}
+
+/*
+ * Finds pitch marks, one per period at the biggest peak, for pitch synchronous grains.
+ * The period comes from the normalised autocorrelation of a decimated copy,
+ * each mark is then placed on the peak nearest a period on from the last.
+ * Unpitched parts get evenly spaced marks so grains still have somewhere to start.
+ * It works through a wave a few marks at a time from the main loop so loading isn't held up.
+ */
+class PitchMarker
+{
+  public:
+    PitchMarker() {}
+    ~PitchMarker() {}
+
+    void Init(float sr)
+    {
+      sr_ = sr;
+      min_lag_ = (size_t)(sr / (PM_MAX_HZ * PM_DECIM));
+      max_lag_ = (size_t)(sr / (PM_MIN_HZ * PM_DECIM));
+      max_lag_ = (max_lag_ < PM_MAX_LAG) ? max_lag_ : PM_MAX_LAG - 1;
+      unvoiced_ = (size_t)(sr * PM_UNVOICED_SECS);
+      busy_ = false;
+    }
+
+    // marks->pos must hold PitchMarksBytes(src->len)
+    void Start(const sample_src_t *src, pitch_marks_t *marks)
+    {
+      src_ = src;
+      marks_ = marks;
+      reader_.Init(src);
+      max_ = PitchMarksBytes(src->len, sr_) / sizeof(uint32_t);
+      marks_->n = 0;
+      marks_->ready = false;
+      next_est_ = 0;
+      busy_ = true;
+    }
+
+    // the wave is about to go away
+    void Cancel()
+    {
+      busy_ = false;
+    }
+
+    // Main loop only
+    // returns true while there's still work to do
+    bool Service()
+    {
+      if (!busy_) return false;
+
+      size_t mark;
+      for (size_t i = 0; i < PM_SERVICE_MARKS; i++) {
+	mark = (marks_->n == 0) ? 0 : marks_->pos[marks_->n - 1];
+	if (mark >= next_est_) {
+	  period_ = Period(mark);
+	  next_est_ = mark + PM_HOP;
+	}
+	if (marks_->n == 0) {
+	  mark = (period_ > 0.0f) ? Peak(0, (size_t)period_) : 0;
+	} else if (period_ > 0.0f) {
+	  size_t quarter = (size_t)(period_ * 0.25f);
+	  size_t next = mark + (size_t)period_;
+	  mark = Peak(next - quarter, next + quarter);
+	} else {
+	  mark += unvoiced_;
+	}
+	if ((mark >= src_->len) || (marks_->n >= max_)) {
+	  marks_->ready = (marks_->n > 1);
+	  busy_ = false;
+	  return false;
+	}
+	marks_->pos[marks_->n++] = mark;
+      }
+      return true;
+    }
+
+  private:
+    // period at pos in frames, 0 if it isn't pitched
+    float Period(size_t pos)
+    {
+      size_t n = PM_WIN + max_lag_ + 1;
+      size_t i, k, lag, best = 0;
+      float mean = 0.0f;
+      float c, e0 = 0.0f, el = 0.0f;
+
+      for (i = 0; i < n; i++) {
+	k = pos + (i * PM_DECIM);
+	dec_[i] = 0.0f;
+	for (size_t d = 0; d < PM_DECIM; d++) {
+	  if ((k + d) < src_->len) dec_[i] += reader_.Mid(k + d);
+	}
+	mean += dec_[i];
+      }
+      mean /= n;
+      for (i = 0; i < n; i++) {
+	dec_[i] -= mean;
+      }
+
+      for (i = 0; i < PM_WIN; i++) {
+	e0 += dec_[i] * dec_[i];
+      }
+      // nothing there to be pitched
+      if (e0 < (PM_WIN * PM_DECIM * PM_DECIM * IDX_SILENCE * IDX_SILENCE)) return 0.0f;
+
+      for (i = min_lag_; i < (min_lag_ + PM_WIN); i++) {
+	el += dec_[i] * dec_[i];
+      }
+      r_[min_lag_ - 1] = 0.0f;
+      for (lag = min_lag_; lag <= max_lag_; lag++) {
+	c = 0.0f;
+	for (i = 0; i < PM_WIN; i++) {
+	  c += dec_[i] * dec_[i + lag];
+	}
+	r_[lag] = (el > 0.0f) ? c / sqrtf(e0 * el) : 0.0f;
+	if ((best == 0) || (r_[lag] > r_[best])) best = lag;
+	el += (dec_[lag + PM_WIN] * dec_[lag + PM_WIN]) - (dec_[lag] * dec_[lag]);
+      }
+      r_[max_lag_ + 1] = 0.0f;
+      if (r_[best] < PM_VOICED) return 0.0f;
+
+      for (lag = min_lag_; lag < best; lag++) {
+	if ((r_[lag] >= (PM_OCTAVE * r_[best])) && (r_[lag] >= r_[lag - 1]) && (r_[lag] >= r_[lag + 1])) break;
+      }
+      // parabolic fit between lags
+      float a = r_[lag - 1], b = r_[lag], d = r_[lag + 1];
+      float den = a - (2.0f * b) + d;
+      float frac = (den < 0.0f) ? 0.5f * (a - d) / den : 0.0f;
+      return (lag + frac) * PM_DECIM;
+    }
+
+    // biggest sample in [lo, hi)
+    size_t Peak(size_t lo, size_t hi)
+    {
+      int32_t s, max = INT32_MIN;
+      size_t at = lo;
+      hi = (hi < src_->len) ? hi : src_->len;
+      for (size_t i = lo; i < hi; i++) {
+	s = reader_.Mid(i);
+	if (s > max) {
+	  max = s;
+	  at = i;
+	}
+      }
+      return at;
+    }
+
+    const sample_src_t *src_;
+    pitch_marks_t *marks_;
+    SampleReader reader_;
+    float dec_[PM_WIN + PM_MAX_LAG + 1];
+    float r_[PM_MAX_LAG + 1];
+    float sr_, period_;
+    size_t min_lag_, max_lag_, unvoiced_, max_, next_est_;
+    bool busy_;
+};
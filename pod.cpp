@@ -48,7 +48,7 @@ void UpdateUI(int8_t cur_page)
 {
   // limit update rate
   uint32_t now = hw.seed.system.GetNow();
-  if (last_ui_update - now >= 1) {
+  if ((now - last_ui_update) >= 1) {
     last_ui_update = now;
 
     if (setup_page) {
@@ -78,6 +78,7 @@ void UpdateUI(int8_t cur_page)
           hw.led1.Set(YELLOW);
           /*
            * k1 = Scatter Distance
+	   * k2 = Live Delay (live mode only)
            * b1 = Toggle Scatter
            * b2 = Toggle Freeze
            */
@@ -86,6 +87,7 @@ void UpdateUI(int8_t cur_page)
           hw.led1.Set(GREEN);
           /*
            * k1 = Pitch Distance
+	   * k2 = Stereo Width
            * b1 = Toggle Random Pitch
            * b2 = Toggle Random Density
            */
@@ -105,6 +107,8 @@ void UpdateUI(int8_t cur_page)
           /*
            * k1 = Bit Crush
            * k2 = Downsample
+	   * b1 = Record to SD (press again to stop at the end of the bar)
+	   * b2 = Bounce output to a new wave (press again to stop)
            */
           break;
         case 6:
@@ -113,6 +117,7 @@ void UpdateUI(int8_t cur_page)
            * k1 = pan
            * k2 = pan dist
            * b1 = Toggle random pan
+	   * b2 = Toggle Overdub (live mode only)
            */
           break;
         case 7:
@@ -202,13 +207,16 @@ void UpdateButtons(int8_t cur_page)
       break;
     case 5:
       if(hw.button1.RisingEdge()) {
-        eq.push_event(eq.TOG_LOOP, 0);
+	eq.push_event(eq.REC, 0);
       }
       break;
     case 6:
       if(hw.button1.RisingEdge()) {
         eq.push_event(eq.TOG_RND_PAN, 0);
       }
+      if(hw.button2.RisingEdge()) {
+	eq.push_event(eq.TOG_OVERDUB, 0);
+      }
       break;
     case 7:
       if(hw.button1.RisingEdge()) {
@@ -222,6 +230,9 @@ void UpdateButtons(int8_t cur_page)
       if(hw.button1.RisingEdge()) {
         eq.push_event(eq.TOG_NOTE, 0);
       }
+      if(hw.button2.RisingEdge()) {
+	eq.push_event(eq.TOG_LOOP, 0);
+      }
       break;
     default:
       break;
@@ -303,6 +314,12 @@ void Status(status_t status)
     case MISSING_WAV:
       hw.led2.Set(LBLUE);
       break;
+    case REC_ERROR:
+      hw.led2.Set(ORANGE);
+    #ifdef DEBUG_POD
+      hw.seed.PrintLine("  Can't record");
+    #endif
+      break;
     case OK:
       hw.led1.Set(OFF);
       hw.led2.Set(OFF);
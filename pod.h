@@ -10,6 +10,8 @@
 #include "status.h"
 
 #define LONG_PRESS 512
+// the LEDs are software PWM so they need updating far more often than 30Hz
+#define UI_PERIOD_US 1000
 
 extern float sample_bpm;
 extern MidiMsgHandler<HW_TYPE> mmh;
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sample_src.h"
+#include "adpcm.h"
+
+// one entry per 128 frames, ~2.7mS at 48k
+#define IDX_BLOCK_SHIFT	    7
+#define IDX_BLOCK_FRAMES    (1 << IDX_BLOCK_SHIFT)
+// block rms below this (about -60dBFS) counts as silence
+#define IDX_SILENCE	    33
+// block rms jumping by this much over the one before is an onset
+#define IDX_ONSET_RATIO	    2.0f
+// normalize peaks to -1dBFS but don't boost quiet waves by more than 18dB
+#define IDX_NORM_PEAK	    29204.0f
+#define IDX_MAX_GAIN	    8.0f
+
+// block flags
+#define IDX_LOUD	    1
+#define IDX_ONSET	    2
+
+typedef struct {
+  uint16_t  rms;
+  uint16_t  peak;
+  uint8_t   zc;	    // first zero crossing in the block, 0 if there isn't one
+  uint8_t   flags;
+  uint16_t  skip;   // blocks to the next loud one, 0 if this one's loud or nothing loud follows
+} idx_block_t;
+
+typedef struct sample_index_s {
+  idx_block_t *blocks;
+  size_t      n;
+  float	      gain; // brings the wave's peak up (or down) to IDX_NORM_PEAK
+} sample_index_t;
+
+inline size_t IndexBytes(size_t frames)
+{
+  return ((frames + IDX_BLOCK_FRAMES - 1) >> IDX_BLOCK_SHIFT) * sizeof(idx_block_t);
+}
+
+// Reads a loaded wave as mono (the mid of stereo), decoding ADPCM as it goes
+// Best read in order so each compressed block is only decoded once
+class SampleReader
+{
+  public:
+    SampleReader() {}
+    ~SampleReader() {}
+
+    void Init(const sample_src_t *src)
+    {
+      src_ = src;
+      if (src_->adpcm != nullptr) {
+	cache_.Init(src_->adpcm, src_->chans);
+      }
+    }
+
+    inline int32_t Mid(size_t idx)
+    {
+      if (src_->adpcm != nullptr) {
+	if (src_->chans == 1) return cache_.Get(idx, 0);
+	return (cache_.Get(idx, 0) + cache_.Get(idx, 1)) >> 1;
+      }
+      if (src_->chans == 1) return src_->start[idx];
+      return (src_->start[2 * idx] + src_->start[(2 * idx) + 1]) >> 1;
+    }
+
+  private:
+    const sample_src_t *src_;
+    AdpcmCache cache_;
+};
+
+/*
+ * Builds a sample_index_t from a loaded wave in one pass.
+ * Stereo is analysed as the mid signal and ADPCM waves are decoded a block at a time.
+ * Everything the granulator needs at dispatch is precomputed so it only ever does a lookup.
+ */
+class SampleAnalyser
+{
+  public:
+    SampleAnalyser() {}
+    ~SampleAnalyser() {}
+
+    // mem must hold IndexBytes(src->len)
+    void Analyse(const sample_src_t *src, idx_block_t *mem, sample_index_t *idx)
+    {
+      int32_t s, prev = 0;
+      int32_t peak, wave_peak = 0;
+      float sum, last_rms = 0.0f;
+      size_t i, n, b;
+      idx_block_t *blk;
+
+      reader_.Init(src);
+
+      idx->blocks = mem;
+      idx->n = (src->len + IDX_BLOCK_FRAMES - 1) >> IDX_BLOCK_SHIFT;
+
+      for (b = 0; b < idx->n; b++) {
+	blk = &mem[b];
+	i = b << IDX_BLOCK_SHIFT;
+	n = ((src->len - i) < IDX_BLOCK_FRAMES) ? (src->len - i) : IDX_BLOCK_FRAMES;
+	sum = 0.0f;
+	peak = 0;
+	blk->zc = 0;
+	blk->flags = 0;
+	blk->skip = 0;
+	for (size_t k = 0; k < n; k++) {
+	  s = reader_.Mid(i + k);
+	  sum += (float)s * s;
+	  peak = (abs(s) > peak) ? abs(s) : peak;
+	  if ((blk->zc == 0) && (k > 0) && ((s ^ prev) < 0)) {
+	    blk->zc = k;
+	  }
+	  prev = s;
+	}
+	blk->rms = (uint16_t)sqrtf(sum / n);
+	blk->peak = (uint16_t)peak;
+	if (blk->rms > IDX_SILENCE) {
+	  blk->flags |= IDX_LOUD;
+	  if (blk->rms > (IDX_ONSET_RATIO * last_rms)) {
+	    blk->flags |= IDX_ONSET;
+	  }
+	}
+	last_rms = blk->rms;
+	wave_peak = (peak > wave_peak) ? peak : wave_peak;
+      }
+
+      // walk back so every quiet block knows how far it is to the next loud one
+      uint32_t next = 0;
+      bool seen_loud = false;
+      for (b = idx->n; b > 0; b--) {
+	blk = &mem[b - 1];
+	if (blk->flags & IDX_LOUD) {
+	  next = 0;
+	  seen_loud = true;
+	} else if (seen_loud) {
+	  next = (next < UINT16_MAX) ? next + 1 : UINT16_MAX;
+	  blk->skip = next;
+	}
+      }
+
+      idx->gain = (wave_peak > 0) ? fminf(IDX_MAX_GAIN, IDX_NORM_PEAK / wave_peak) : 1.0f;
+    }
+
+  private:
+    SampleReader reader_;
+};
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "phasor.h"
+#include "adpcm.h"
+
+// a grain never gets further than MAX_GRAIN_DUR at MAX_GRAIN_PITCH (38400 frames at 48k) from where it starts
+#define SAMPLE_REBASE (1 << 16)
 
 template <typename T>
 class Sample : public Phasor
@@ -9,49 +13,63 @@ class Sample : public Phasor
     Sample() {}
     ~Sample() {} 
 
-    void Init(T *start, float sr, size_t len) 
+    // mask wraps reads into a streaming window, SIZE_MAX for samples that are all in memory
+    void Init(T *start, float sr, size_t len, uint8_t chans = 1, size_t mask = SIZE_MAX) 
     {
       mem_start_ = start;
+      chans_ = chans;
+      mask_ = mask;
+      cache_ = nullptr;
+      base_ = 0;
       Phasor::Init(sr, len);
     }
 
+    /*
+     * The position's a float, which stops moving past 2^24 frames and long waves get that far.
+     * So a grain counts from SAMPLE_REBASE frames behind where it starts, far enough that it
+     * never gets back there in reverse, and base_ goes back on for the reads.
+     * Looping (circular) samples are short and wrap at their ends, they're left as they are.
+     */
+    void SetCurPos(double pos)
+    {
+      if (!loop_) {
+	Rebase((pos > SAMPLE_REBASE) ? (size_t)pos - SAMPLE_REBASE : 0);
+	pos -= base_;
+      }
+      Phasor::SetCurPos(pos);
+    }
+
+    void Reset()
+    {
+      Rebase(0);
+      Phasor::Reset();
+    }
+
+    // compressed samples are read through a per grain block cache instead of mem_start_
+    void SetCache(AdpcmCache *cache)
+    {
+      cache_ = cache;
+    }
+
     // danger = it should be the same length as the original sample otherwise the phasor won't work
     void SetSample(T *start)
     {
       mem_start_ = start;
     }
 
+    inline uint8_t Chans()
+    {
+      return chans_;
+    }
+
     float Process(bool *eot)
     {
       size_t idx0, idx1;
-      T s0, s1;
       float sf, sample;
     
       if (play_) {
-        idx0 = (size_t)cur_pos_;
-      	if (reverse_) {
-      	  idx1 = (idx0 == start_pos_) ? end_pos_ : idx0 - 1;
-      	} else {
-      	  idx1 = (idx0 == end_pos_) ? start_pos_ : idx0 + 1;
-      	}
-      	sf = cur_pos_ - idx0;
-    
-      	s0 = mem_start_[idx0];
-      	s1 = mem_start_[idx1];
-    
-      	switch(sizeof(T)) 
-      	{
-      	  case 2:
-      	    sample = s162f(T(s0 + sf * (s1 - s0)));
-      	    break;
-      	  case 4:
-      	    sample = s0 + sf * (s1 - s0);
-      	    break;
-      	  default:
-      	    // TODO: deal with other sample formats
-      	    break;
-      	}
-     
+	Index(&idx0, &idx1, &sf);
+	sample = Interp(Read(idx0, 0), Read(idx1, 0), sf);
       } else {
         sample = 0.0f;
       }
@@ -61,6 +79,66 @@ class Sample : public Phasor
       return sample;
     }
 
+    // Interleaved stereo - the index and fraction are only worked out once for both channels
+    void ProcessStereo(bool *eot, float *l, float *r)
+    {
+      size_t idx0, idx1;
+      float sf;
+
+      if (play_) {
+	Index(&idx0, &idx1, &sf);
+	*l = Interp(Read(idx0, 0), Read(idx1, 0), sf);
+	*r = Interp(Read(idx0, 1), Read(idx1, 1), sf);
+      } else {
+	*l = *r = 0.0f;
+      }
+
+      Phasor::Process(eot);
+    }
+
   private:
+    inline void Rebase(size_t base)
+    {
+      end_pos_ += base_ - base;
+      base_ = base;
+    }
+
+    inline void Index(size_t *idx0, size_t *idx1, float *sf)
+    {
+      *idx0 = (size_t)cur_pos_;
+      if (reverse_) {
+	*idx1 = (*idx0 == start_pos_) ? end_pos_ : *idx0 - 1;
+      } else {
+	*idx1 = (*idx0 == end_pos_) ? start_pos_ : *idx0 + 1;
+      }
+      *sf = (float)(cur_pos_ - *idx0);
+    }
+
+    inline T Read(size_t idx, uint8_t ch)
+    {
+      idx += base_;
+      if (cache_) {
+	return cache_->Get(idx, ch);
+      }
+      return mem_start_[((idx & mask_) << (chans_ - 1)) + ch];
+    }
+
+    inline float Interp(T s0, T s1, float sf)
+    {
+      switch(sizeof(T)) 
+      {
+	case 2:
+	  return s162f(T(s0 + sf * (s1 - s0)));
+	case 4:
+	  return s0 + sf * (s1 - s0);
+	default:
+	  // TODO: deal with other sample formats
+	  return 0.0f;
+      }
+    }
+
     T *mem_start_;
+    AdpcmCache *cache_;
+    size_t mask_, base_;
+    uint8_t chans_;
 };
@@ -0,0 +1,33 @@
+#pragma once
+
+// The part of a streamed sample that is currently in memory, in frames
+// Written by the main loop as it reads from SD, read by the audio callback
+// seq is odd while lo/hi are being changed, the callback can't preempt itself so it just backs off
+typedef struct {
+  volatile size_t   lo;
+  volatile size_t   hi;
+  volatile uint32_t seq;
+  volatile uint32_t underruns;
+} stream_win_t;
+
+// see sample_index.h and pitch_marks.h
+struct sample_index_s;
+struct pitch_marks_s;
+
+// A chunk of sample memory that grains can read from
+// Stereo is interleaved and len is always in frames
+// When adpcm is set the sample is stored as IMA-ADPCM blocks there and start is unused
+// Streamed samples live in a power of 2 ring, frame n is at (n & mask), everything else has mask = SIZE_MAX
+// wrap is set for circular buffers, grains carry on round from the end to the start instead of stopping
+// index is the load time analysis, if there is one, marks are its pitch marks once they've been found
+typedef struct {
+  int16_t	*start;
+  const uint8_t *adpcm;
+  size_t	len;
+  size_t	mask;
+  stream_win_t	*win;
+  const struct sample_index_s *index;
+  const struct pitch_marks_s *marks;
+  uint8_t	chans;
+  bool		wrap;
+} sample_src_t;
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MAX_TASKS 12
+// period for tasks that only run when nothing else is due
+#define TASK_IDLE 0
+
+typedef void (*task_fn_t)();
+
+typedef struct {
+  const char  *name;
+  task_fn_t   fn;
+  uint32_t    period;	// uS, TASK_IDLE for idle time only
+  uint32_t    budget;	// uS it should be done in
+  uint8_t     priority;	// 0 goes first
+  uint32_t    due;
+  uint32_t    runs;
+  uint32_t    overruns;	// took longer than its budget
+  uint32_t    late;	// started more than a period after it was due
+  uint32_t    worst;	// longest run, uS
+} task_t;
+
+/*
+ * Cooperative main loop scheduler, each pass runs the most urgent task that's due (lowest priority
+ * number, then whichever has been due longest) or, if none are, the next idle one round robin.
+ * Nothing is preempted so a slow task still holds everything up, but only for one run of itself,
+ * every pass goes back through the high priority ones before anything else gets another go.
+ * Times are from clock() in uS and every comparison is wrap safe.
+ */
+class Scheduler
+{
+  public:
+    Scheduler() {}
+    ~Scheduler() {}
+
+    void Init(uint32_t (*clock)())
+    {
+      clock_ = clock;
+      count_ = 0;
+      next_idle_ = 0;
+    }
+
+    // returns its index, for Wake() and Task(), MAX_TASKS if there's no room
+    size_t AddTask(const char *name, task_fn_t fn, uint32_t period, uint32_t budget, uint8_t priority)
+    {
+      task_t *t = &tasks_[count_];
+      if (count_ >= MAX_TASKS) return MAX_TASKS;
+
+      t->name = name;
+      t->fn = fn;
+      t->period = period;
+      t->budget = budget;
+      t->priority = priority;
+      t->due = clock_();
+      t->runs = t->overruns = t->late = t->worst = 0;
+      return count_++;
+    }
+
+    // due now rather than at the end of its period
+    void Wake(size_t i)
+    {
+      if (i < count_) tasks_[i].due = clock_();
+    }
+
+    // one pass
+    void Run()
+    {
+      task_t *t, *best = nullptr;
+      uint32_t now = clock_();
+
+      for (size_t i = 0; i < count_; i++) {
+	t = &tasks_[i];
+	if ((t->period == TASK_IDLE) || ((int32_t)(now - t->due) < 0)) continue;
+	if ((best == nullptr) || (t->priority < best->priority) || \
+	    ((t->priority == best->priority) && ((int32_t)(t->due - best->due) < 0))) {
+	  best = t;
+	}
+      }
+
+      if (best != nullptr) {
+	if ((now - best->due) > best->period) best->late++;
+	Exec(best, now);
+	// skip the ones it's missed rather than run it back to back to catch up
+	best->due += best->period;
+	if ((int32_t)(now - best->due) >= 0) best->due = now + best->period;
+	return;
+      }
+
+      for (size_t i = 0; i < count_; i++) {
+	t = &tasks_[next_idle_];
+	next_idle_ = (next_idle_ + 1) % count_;
+	if (t->period == TASK_IDLE) {
+	  Exec(t, now);
+	  return;
+	}
+      }
+    }
+
+    size_t Tasks()
+    {
+      return count_;
+    }
+
+    const task_t *Task(size_t i)
+    {
+      return &tasks_[i];
+    }
+
+  private:
+    void Exec(task_t *t, uint32_t start)
+    {
+      uint32_t took;
+
+      t->fn();
+      took = clock_() - start;
+      t->runs++;
+      if (took > t->budget) t->overruns++;
+      if (took > t->worst) t->worst = took;
+    }
+
+    task_t tasks_[MAX_TASKS];
+    uint32_t (*clock_)();
+    size_t count_, next_idle_;
+};
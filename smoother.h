@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+/*
+ * Block rate smoothing for a set of controls, so steps from the main loop turn into ramps.
+ * Once a block each one moves towards its target, either exponentially with a time constant or
+ * linearly so it gets there in a set time, and Step() gives the per sample slope across the block
+ * for anything that's used every sample. Both kinds are the same sum with different numbers in it,
+ * an exponential one has no slew limit and a linear one moves the whole way limited by its slew,
+ * so Process() is one branch free pass over the arrays whatever the mix.
+ */
+template <size_t N>
+class Smoother
+{
+  public:
+    Smoother() {}
+    ~Smoother() {}
+
+    void Init(float sr)
+    {
+      sr_ = sr;
+      frames_ = 0;
+      for (size_t i = 0; i < N; i++) {
+	cur_[i] = target_[i] = step_[i] = 0.0f;
+	SetTime(i, 0.0f, false);
+      }
+    }
+
+    // secs is the time constant, or for linear ones how long it takes to get to a new target
+    void SetTime(size_t i, float secs, bool linear)
+    {
+      secs_[i] = secs;
+      linear_[i] = linear;
+      slew_[i] = INFINITY;
+      frames_ = 0;
+    }
+
+    void SetTarget(size_t i, float val)
+    {
+      target_[i] = val;
+      if (linear_[i]) slew_[i] = fabsf(val - cur_[i]) / fmaxf(1.0f, secs_[i] * sr_);
+    }
+
+    // straight there, no ramp
+    void Jump(size_t i, float val)
+    {
+      cur_[i] = target_[i] = val;
+      step_[i] = 0.0f;
+    }
+
+    // once a block, before anything reads Value() or Step()
+    void Process(size_t frames)
+    {
+      if (frames != frames_) Coefs(frames);
+      for (size_t i = 0; i < N; i++) {
+	float lim = slew_[i] * frames_;
+	float d = fminf(lim, fmaxf(-lim, coef_[i] * (target_[i] - cur_[i])));
+	cur_[i] += d;
+	step_[i] = d * inv_frames_;
+      }
+    }
+
+    // where it is at the end of the block
+    inline float Value(size_t i)
+    {
+      return cur_[i];
+    }
+
+    // where it was at the start of the block
+    inline float Start(size_t i)
+    {
+      return cur_[i] - (step_[i] * frames_);
+    }
+
+    inline float Step(size_t i)
+    {
+      return step_[i];
+    }
+
+  private:
+    // only when the block size changes
+    void Coefs(size_t frames)
+    {
+      frames_ = frames;
+      inv_frames_ = 1.0f / frames;
+      for (size_t i = 0; i < N; i++) {
+	coef_[i] = (linear_[i] || (secs_[i] <= 0.0f)) ? 1.0f : 1.0f - expf(-(float)frames / (secs_[i] * sr_));
+      }
+    }
+
+    float cur_[N], target_[N], step_[N], coef_[N], slew_[N], secs_[N];
+    bool linear_[N];
+    float sr_, inv_frames_;
+    size_t frames_;
+};
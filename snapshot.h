@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SNAP_INDEX 3
+#define SNAP_FRESH 4
+
+/*
+ * Triple buffer for handing a whole struct from the main loop to the audio callback.
+ * The writer fills in the back buffer and swaps it for the middle one, the reader swaps the middle one
+ * for its front buffer when there's something new there. Each side only ever touches its own buffer,
+ * the one word swap is the only thing they share, so the reader always gets a complete set from one
+ * Publish() and neither side ever waits. Anything published twice before the reader looks is just the newest.
+ */
+template <typename T>
+class Snapshot
+{
+  public:
+    Snapshot() : back_(0), mid_(1), front_(2) {}
+    ~Snapshot() {}
+
+    // before either side starts
+    void Init(const T &val)
+    {
+      for (size_t i = 0; i < 3; i++) {
+	bufs_[i] = val;
+      }
+    }
+
+    // writer only, what's there is from a while ago so fill in all of it
+    inline T *Back()
+    {
+      return &bufs_[back_];
+    }
+
+    // writer only
+    void Publish()
+    {
+      back_ = __atomic_exchange_n(&mid_, back_ | SNAP_FRESH, __ATOMIC_ACQ_REL) & SNAP_INDEX;
+    }
+
+    // reader only, true if Front() has changed
+    bool Fetch()
+    {
+      if (!(__atomic_load_n(&mid_, __ATOMIC_RELAXED) & SNAP_FRESH)) return false;
+      front_ = __atomic_exchange_n(&mid_, front_, __ATOMIC_ACQ_REL) & SNAP_INDEX;
+      return true;
+    }
+
+    // reader only, stays put until the next Fetch()
+    inline const T *Front()
+    {
+      return &bufs_[front_];
+    }
+
+  private:
+    T bufs_[3];
+    uint32_t back_, mid_, front_;
+};
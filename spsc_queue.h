@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Single producer, single consumer ring with no locks, for handing things from the main loop to the
+ * audio callback. Only the producer moves tail_ and only the consumer moves head_, and both are word
+ * sized so each side always sees a consistent count. The entry is written before tail_ moves past it.
+ * N has to be a power of 2, one slot is always left empty to tell full from empty.
+ */
+template <typename T, size_t N>
+class SpscQueue
+{
+  public:
+    SpscQueue() : head_(0), tail_(0), dropped_(0) {}
+    ~SpscQueue() {}
+
+    // producer only, false (and counted) if it's full
+    bool Push(const T &item)
+    {
+      uint32_t tail = tail_;
+      uint32_t next = (tail + 1) & (N - 1);
+      if (next == head_) {
+	dropped_++;
+	return false;
+      }
+      items_[tail] = item;
+      __sync_synchronize();
+      tail_ = next;
+      return true;
+    }
+
+    // consumer only, look at the oldest without taking it
+    bool Peek(T *item)
+    {
+      uint32_t head = head_;
+      if (head == tail_) return false;
+      __sync_synchronize();
+      *item = items_[head];
+      return true;
+    }
+
+    // consumer only
+    void Drop()
+    {
+      if (head_ != tail_) head_ = (head_ + 1) & (N - 1);
+    }
+
+    bool Pop(T *item)
+    {
+      if (!Peek(item)) return false;
+      Drop();
+      return true;
+    }
+
+    bool Empty()
+    {
+      return head_ == tail_;
+    }
+
+    uint32_t Dropped()
+    {
+      return dropped_;
+    }
+
+  private:
+    static_assert((N & (N - 1)) == 0, "SpscQueue length must be a power of 2");
+    T items_[N];
+    volatile uint32_t head_, tail_;
+    volatile uint32_t dropped_;
+};
@@ -12,5 +12,6 @@ typedef enum {
   READING_WAV,
   MISSING_WAV,
   GRNLTR_INIT,
+  REC_ERROR,
   OK
   } status_t;
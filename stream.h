@@ -0,0 +1,212 @@
+#pragma once
+
+#include <string.h>
+#include "fatfs.h"
+#include "sample_src.h"
+
+// frames per SD read - the window is a whole number of these
+#define STREAM_CHUNK_FRAMES   8192
+// read before a streamed wave starts playing, the rest is filled in from the main loop
+// enough for the granulator to fit two of the longest grains at the highest pitch in (see InWindow())
+#define STREAM_PRIME_CHUNKS   10
+
+/*
+ * Keeps a sliding window of a wave that's too big for SDRAM around the scan head.
+ * Everything here runs in the main loop, the audio callback only ever looks at the window bounds.
+ * The window is kept chunk aligned so each read lands in one contiguous piece of the ring.
+ * FatFS reads block, so a chunk is read a bounce buffer at a time over as many Service() calls as
+ * it takes and only joins the window once it's all there, no one call holds the main loop for long.
+ */
+class SampleStream
+{
+  public:
+    SampleStream() {}
+    ~SampleStream() {}
+
+    // mem must hold win_frames of stereo, win_frames must be a power of 2
+    // SD reads land in bounce first, same as the loader, then get copied into the ring
+    void Init(int16_t *mem, size_t win_frames, char *bounce, size_t bounce_bytes)
+    {
+      mem_ = mem;
+      win_frames_ = win_frames;
+      bounce_ = bounce;
+      bounce_bytes_ = bounce_bytes;
+      open_ = false;
+      pend_ = false;
+      win_.lo = win_.hi = 0;
+      win_.seq = 0;
+      win_.underruns = 0;
+    }
+
+    // Points src at the window, it still needs priming
+    bool Open(const char *name, size_t data_offset, sample_src_t *src)
+    {
+      Close();
+      if (f_open(&fp_, name, FA_READ) != FR_OK) return false;
+      data_offset_ = data_offset;
+      len_ = src->len;
+      chans_ = src->chans;
+      frame_bytes_ = chans_ * sizeof(int16_t);
+      win_.lo = win_.hi = 0;
+      pend_ = false;
+      src->start = mem_;
+      src->mask = win_frames_ - 1;
+      src->win = &win_;
+      open_ = true;
+      return true;
+    }
+
+    void Close()
+    {
+      if (open_) {
+	f_close(&fp_);
+	open_ = false;
+      }
+    }
+
+    // Blocking read of the first few chunks around pos
+    void Prime(size_t pos, bool reverse)
+    {
+      Restart(pos, reverse);
+      while ((win_.hi - win_.lo) < (STREAM_PRIME_CHUNKS * STREAM_CHUNK_FRAMES)) {
+	if (!Fill(pos, reverse)) break;
+      }
+    }
+
+    // Call often from the main loop
+    // Faster scanning gets more reads per call, each one is a bounce buffer's worth
+    void Service(size_t pos, bool reverse, float rate)
+    {
+      if (!open_) return;
+
+      // jumped out of the window - looped, retriggered or moved - so start again around pos
+      if ((pos < win_.lo) || (pos >= win_.hi)) {
+	Restart(pos, reverse);
+      }
+
+      for (int reads = 1 + (int)rate; reads > 0; reads--) {
+	if (!Fill(pos, reverse)) break;
+      }
+    }
+
+    uint32_t Underruns()
+    {
+      return win_.underruns;
+    }
+
+    bool IsOpen()
+    {
+      return open_;
+    }
+
+  private:
+    // the window stays empty until the first Fill, a chunk half read is for the old spot so it goes
+    void Restart(size_t pos, bool reverse)
+    {
+      size_t start = reverse ? AlignDown(pos) + STREAM_CHUNK_FRAMES : AlignDown(pos);
+      pend_ = false;
+      Update(start, start);
+    }
+
+    // One read towards the next chunk ahead of pos in the scan direction if there's room
+    // Returns false once it's far enough ahead, hits the end of the file or the read fails
+    bool Fill(size_t pos, bool reverse)
+    {
+      size_t lo = win_.lo;
+      size_t hi = win_.hi;
+      size_t back = win_frames_ / 4;
+      size_t ahead;
+
+      // turned round half way through a chunk
+      if (pend_ && (reverse != pend_rev_)) pend_ = false;
+
+      if (!pend_) {
+	if (!reverse) {
+	  ahead = (hi > pos) ? hi - pos : 0;
+	  if ((hi >= len_) || (ahead >= (win_frames_ - back))) return false;
+	  // drop the oldest chunk first so the callback stops reading it before it's overwritten
+	  if (((hi - lo) + STREAM_CHUNK_FRAMES) > win_frames_) {
+	    Update(lo + STREAM_CHUNK_FRAMES, hi);
+	  }
+	  if (!Begin(hi, reverse)) return false;
+	} else {
+	  ahead = (pos > lo) ? pos - lo : 0;
+	  if ((lo == 0) || (ahead >= (win_frames_ - back))) return false;
+	  if (((hi - lo) + STREAM_CHUNK_FRAMES) > win_frames_) {
+	    Update(lo, AlignDown(hi - 1));
+	  }
+	  if (!Begin(lo - STREAM_CHUNK_FRAMES, reverse)) return false;
+	}
+      }
+
+      if (!ReadPiece()) {
+	pend_ = false;
+	return false;
+      }
+      if (pend_done_ < pend_bytes_) return true;
+
+      // all there, it goes on whichever end it was read for
+      pend_ = false;
+      if (!reverse) {
+	Update(win_.lo, win_.hi + (pend_bytes_ / frame_bytes_));
+      } else {
+	Update(pend_frame_, win_.hi);
+      }
+      return true;
+    }
+
+    inline void Update(size_t lo, size_t hi)
+    {
+      win_.seq++;
+      win_.lo = lo;
+      win_.hi = hi;
+      win_.seq++;
+    }
+
+    // frame is always chunk aligned so the read never wraps the ring
+    bool Begin(size_t frame, bool reverse)
+    {
+      size_t n = len_ - frame;
+
+      if (f_lseek(&fp_, data_offset_ + (frame * frame_bytes_)) != FR_OK) return false;
+      pend_ = true;
+      pend_rev_ = reverse;
+      pend_frame_ = frame;
+      pend_done_ = 0;
+      pend_bytes_ = ((n > STREAM_CHUNK_FRAMES) ? STREAM_CHUNK_FRAMES : n) * frame_bytes_;
+      return true;
+    }
+
+    // the next bounce buffer's worth of the chunk, a short read is the end of the file
+    bool ReadPiece()
+    {
+      size_t to_read, bytesread;
+      size_t piece = bounce_bytes_ - (bounce_bytes_ % frame_bytes_);
+      uint8_t *dst = (uint8_t *)&mem_[(pend_frame_ & (win_frames_ - 1)) * chans_];
+
+      to_read = ((pend_bytes_ - pend_done_) < piece) ? (pend_bytes_ - pend_done_) : piece;
+      if (f_read(&fp_, (void *)bounce_, to_read, &bytesread) != FR_OK) return false;
+      memcpy(dst + pend_done_, bounce_, bytesread);
+      pend_done_ += bytesread;
+      if (bytesread != to_read) {
+	pend_bytes_ = pend_done_ - (pend_done_ % frame_bytes_);
+	if (pend_bytes_ == 0) return false;
+      }
+      return true;
+    }
+
+    inline size_t AlignDown(size_t frame)
+    {
+      return frame & ~((size_t)STREAM_CHUNK_FRAMES - 1);
+    }
+
+    FIL fp_;
+    stream_win_t win_;
+    int16_t *mem_;
+    char *bounce_;
+    size_t bounce_bytes_, win_frames_, len_, data_offset_, frame_bytes_;
+    // the chunk being read
+    size_t pend_frame_, pend_done_, pend_bytes_;
+    uint8_t chans_;
+    bool open_, pend_, pend_rev_;
+};
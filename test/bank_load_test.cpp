@@ -0,0 +1,247 @@
+// The bank loader on the host: grnltr.cpp booted on a Pod with nothing plugged in and a card with three banks.
+// A bank switch has to wait for the callback to let go of the old bank, a second switch part way through drops
+// the wave that's half in and starts over, LoadTask() gets the last bank all the way in a buffer at a time with
+// the callback silent throughout, and then the new bank plays. Then what a LoadTask() call costs on the card.
+#include <vector>
+#include <string>
+#define TARGET_POD
+#define main grnltr_main
+#include "grnltr.cpp"
+#include "pod.cpp"
+#include "windows.cpp"
+#undef main
+
+#define TONE_HZ		220.0
+// nothing should take more than this many calls
+#define MAX_CALLS	100000
+
+typedef struct {
+  const char *name;
+  uint16_t fmt, chans, bits;
+  uint32_t sr;
+  double secs;
+} card_wav_t;
+
+static const card_wav_t wavs[] = {
+  {"/grnltr/a/one.wav", WAV_FMT_PCM, 1, 16, 48000, 1.0},
+  {"/grnltr/b/1.wav", WAV_FMT_PCM, 2, 16, 48000, 2.0},
+  {"/grnltr/b/2.wav", WAV_FMT_PCM, 2, 16, 48000, 2.0},
+  {"/grnltr/b/3.wav", WAV_FMT_PCM, 2, 16, 48000, 2.0},
+  {"/grnltr/c/mono.wav", WAV_FMT_PCM, 1, 16, 48000, 1.5},
+  {"/grnltr/c/hi.wav", WAV_FMT_PCM, 2, 24, 44100, 1.0},
+  {"/grnltr/c/float.wav", WAV_FMT_FLOAT, 1, 32, 48000, 0.5},
+};
+#define NUM_WAVS (sizeof(wavs) / sizeof(wavs[0]))
+
+static std::vector<uint8_t> data[NUM_WAVS];
+static sd_file_t files[NUM_WAVS];
+static float in_l[BOARD_BLOCK], in_r[BOARD_BLOCK], out_l[BOARD_BLOCK], out_r[BOARD_BLOCK];
+static size_t calls;
+static double worst_us;
+static int fails;
+
+static void Put(std::vector<uint8_t> *f, const void *p, size_t n)
+{
+  f->insert(f->end(), (const uint8_t *)p, (const uint8_t *)p + n);
+}
+
+static void Put32(std::vector<uint8_t> *f, uint32_t v)
+{
+  Put(f, &v, 4);
+}
+
+static void Put16(std::vector<uint8_t> *f, uint16_t v)
+{
+  Put(f, &v, 2);
+}
+
+// a tone at -6dB, the same on every channel
+static double Tone(const card_wav_t *w, double i)
+{
+  return 0.5 * sin(2.0 * M_PI * TONE_HZ * i / w->sr);
+}
+
+static void MakeWav(const card_wav_t *w, std::vector<uint8_t> *f)
+{
+  size_t frames = w->secs * w->sr;
+  size_t frame_bytes = w->chans * (w->bits / 8);
+  int32_t v;
+  float s;
+
+  Put32(f, RIFF_ID);
+  Put32(f, 36 + (frames * frame_bytes));
+  Put32(f, WAVE_ID);
+  Put32(f, FMT_ID);
+  Put32(f, 16);
+  Put16(f, w->fmt);
+  Put16(f, w->chans);
+  Put32(f, w->sr);
+  Put32(f, w->sr * frame_bytes);
+  Put16(f, frame_bytes);
+  Put16(f, w->bits);
+  Put32(f, DATA_ID);
+  Put32(f, frames * frame_bytes);
+  for (size_t i = 0; i < frames; i++) {
+    for (uint16_t c = 0; c < w->chans; c++) {
+      if (w->fmt == WAV_FMT_FLOAT) {
+	s = Tone(w, i);
+	Put(f, &s, 4);
+      } else {
+	v = (int32_t)lrint(Tone(w, i) * ((w->bits == 24) ? 8388607.0 : 32767.0));
+	Put(f, &v, w->bits / 8);
+      }
+    }
+  }
+}
+
+// one block of audio, the loudest sample out of it
+static float Block()
+{
+  const float *ins[2] = {in_l, in_r};
+  float *outs[2] = {out_l, out_r};
+  float peak = 0.0f;
+
+  board.us += (BOARD_BLOCK * 1e6) / BOARD_SR;
+  board.audio(ins, outs, BOARD_BLOCK);
+  for (size_t i = 0; i < BOARD_BLOCK; i++) {
+    peak = fmaxf(peak, fmaxf(fabsf(out_l[i]), fabsf(out_r[i])));
+  }
+  return peak;
+}
+
+static void Events()
+{
+  while (eq.has_event()) {
+    process_events();
+  }
+}
+
+static void Load()
+{
+  double before = sd_card.us;
+  LoadTask();
+  worst_us = fmax(worst_us, sd_card.us - before);
+  calls++;
+}
+
+// a main loop pass and a block, which has to be silent while a bank's on its way in
+static void Pass()
+{
+  Events();
+  Load();
+  if (bank_loading && (Block() != 0.0f)) {
+    printf("the callback played during a bank load\n");
+    fails++;
+  }
+}
+
+// a bank switch does nothing on the card until the callback's had a block to let go of the old bank
+static void NextBank(int8_t dir)
+{
+  uint32_t reads = sd_card.reads;
+
+  eq.push_event(eq.NEXT_DIR, dir);
+  Events();
+  for (int i = 0; i < 3; i++) {
+    Load();
+  }
+  if (!bank_loading || bank_listed || (sd_card.reads != reads)) {
+    printf("bank %d: the loader didn't wait for the callback\n", dir);
+    fails++;
+  }
+  Block();
+}
+
+static bool Plays(double secs)
+{
+  float peak = 0.0f;
+
+  for (size_t i = 0; i < (secs * BOARD_SR) / BOARD_BLOCK; i++) {
+    Events();
+    peak = fmaxf(peak, Block());
+  }
+  return peak > 0.01f;
+}
+
+// what bank c's waves came in as against what's on the card
+static void Check()
+{
+  const card_wav_t *w;
+  wav_info_t *info;
+  size_t frames;
+  double err, worst, lag_worst;
+
+  if ((wav_file_count != 3) || (wavs_read != 3)) {
+    printf("bank c: %d of %d waves read, 3 on the card\n", wavs_read, wav_file_count);
+    fails++;
+    return;
+  }
+  for (size_t i = 0; i < 3; i++) {
+    w = &wavs[4 + i];
+    info = &wav_info[i];
+    frames = (size_t)(w->secs * BOARD_SR);
+    worst = 1e9;
+    // the resampler runs a few frames late, the best line up is the one it's at
+    for (int lag = -RS_TAPS; (lag <= RS_TAPS) && (info->src.start != nullptr); lag++) {
+      lag_worst = 0.0;
+      for (size_t f = 64; f < (info->src.len - 64); f++) {
+	err = info->src.start[f * info->src.chans] - (Tone(w, ((double)f + lag) * (w->sr / BOARD_SR)) * 32767.0);
+	lag_worst = fmax(lag_worst, fabs(err));
+      }
+      worst = fmin(worst, lag_worst);
+    }
+    printf("  %s: %zu frames of %zu, %d chans, worst %.1f LSB off the tone%s\n", info->wav_file_hdr.name, \
+	info->src.len, frames, info->src.chans, worst, (info->src.index != nullptr) ? ", indexed" : "");
+    // 24 and 32 bit are dithered, 44.1k goes through the resampler
+    if ((strcmp(info->wav_file_hdr.name, w->name) != 0) || (info->src.chans != w->chans) || \
+	(labs((long)info->src.len - (long)frames) > RS_TAPS) || (worst > ((w->sr == BOARD_SR) ? 2.0 : 8.0)) || \
+	(info->src.index == nullptr)) {
+      fails++;
+    }
+  }
+}
+
+int main()
+{
+  for (size_t i = 0; i < NUM_WAVS; i++) {
+    MakeWav(&wavs[i], &data[i]);
+    files[i] = {wavs[i].name, data[i].data(), data[i].size()};
+  }
+  sd_card.files = files;
+  sd_card.nfiles = NUM_WAVS;
+
+  Setup();
+  if ((dir_count != 3) || (wav_file_count != 1) || (wavs_read != 1) || bank_loading) {
+    printf("boot: %d banks, %d of %d waves\n", dir_count, wavs_read, wav_file_count);
+    fails++;
+  }
+  printf("booted on bank a, %s\n", Plays(0.5) ? "playing" : "silent");
+
+  // part way through bank b's second wave
+  NextBank(1);
+  while (((load_next < 2) || (wl.info == nullptr) || (wl.len == 0)) && (calls < MAX_CALLS)) {
+    Pass();
+  }
+  printf("bank b: switched away %zu frames into %s\n", wl.len, wl.info->wav_file_hdr.name);
+
+  NextBank(2);
+  calls = 0;
+  worst_us = 0.0;
+  sd_card.us = 0.0;
+  while (bank_loading && (calls < MAX_CALLS)) {
+    Pass();
+  }
+  printf("bank c: in after %zu LoadTask() calls, %.1fmS of card, worst call %.1fmS\n", calls, sd_card.us / 1000.0, \
+      worst_us / 1000.0);
+  Check();
+  // a call reads at most a buffer, or the header of the next wave
+  if (bank_loading || (worst_us > (2.0 * (sd_card.cmd_us + (CP_BUF_SIZE / sd_card.bytes_per_us))))) fails++;
+
+  if (!Plays(1.0)) {
+    printf("bank c: silent once it's in\n");
+    fails++;
+  }
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
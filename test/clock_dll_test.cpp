@@ -0,0 +1,100 @@
+// MIDI clock DLL: how fast it locks to a jittered clock, that dropped ticks are counted in,
+// and that a tempo drop is followed rather than read as ticks going missing
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include "clock_dll.h"
+
+#define PPQN	    24
+// uniform arrival jitter either side, seconds, about what USB MIDI and a busy main loop add up to
+#define JITTER	    0.001f
+
+static uint32_t seed = 1;
+static int fails;
+
+// -1 to 1, the same every run
+static float Rand()
+{
+  seed = (seed * 1664525) + 1013904223;
+  return ((seed >> 8) / (float)(1 << 23)) - 1.0f;
+}
+
+static float Period(float bpm)
+{
+  return 60.0f / (bpm * PPQN);
+}
+
+// count ticks at bpm, every drop'th one lost (0 for none), returns how many the DLL says went by
+// and the tick it first got within 1% and stayed there (-1 if it never did)
+static int Run(ClockDLL *dll, float bpm, int count, int drop, double *t, double *last, int *settled)
+{
+  int counted = 0;
+  double arrived;
+
+  *settled = -1;
+  for (int i = 0; i < count; i++) {
+    *t += Period(bpm);
+    if ((drop > 0) && ((i % drop) == (drop - 1))) continue;
+    arrived = *t + (JITTER * Rand());
+    counted += dll->Tick((float)(arrived - *last));
+    *last = arrived;
+    if (fabsf(dll->GetBPM() - bpm) > (0.01f * bpm)) {
+      *settled = -1;
+    } else if (*settled < 0) {
+      *settled = i;
+    }
+  }
+  return counted;
+}
+
+static void Check(const char *what, bool ok)
+{
+  printf("%s %s\n", what, ok ? "" : "FAIL");
+  if (!ok) fails++;
+}
+
+int main()
+{
+  ClockDLL dll;
+  double t, last;
+  int settled, counted;
+  char what[128];
+  const float drops[] = {100.0f, 90.0f, 80.0f, 60.0f, 40.0f};
+  const float rises[] = {140.0f, 180.0f, 240.0f};
+
+  // from nothing to locked, with the jitter
+  dll.Init(PPQN);
+  t = last = 0.0;
+  Run(&dll, 120.0f, 8 * PPQN, 0, &t, &last, &settled);
+  snprintf(what, sizeof(what), "lock to 120bpm +-%.1fms: settled after %d ticks, %.2fbpm, confidence %.2f", \
+      JITTER * 1000.0f, settled, dll.GetBPM(), dll.Confidence());
+  Check(what, (settled >= 0) && (settled < 2 * PPQN) && (dll.Confidence() > 0.5f));
+
+  // one in every 20 lost, they're counted and the tempo holds
+  counted = Run(&dll, 120.0f, 8 * PPQN, 20, &t, &last, &settled);
+  snprintf(what, sizeof(what), "120bpm, 1 in 20 dropped: counted %d of %d, %.2fbpm", counted, 8 * PPQN, dll.GetBPM());
+  Check(what, (counted == 8 * PPQN) && (fabsf(dll.GetBPM() - 120.0f) < 1.2f));
+
+  // tempo changes from a steady lock, each should be followed within 4 beats, not locked onto at a multiple
+  for (size_t i = 0; i < sizeof(drops) / sizeof(drops[0]); i++) {
+    dll.Init(PPQN);
+    t = last = 0.0;
+    Run(&dll, 120.0f, 16 * PPQN, 0, &t, &last, &settled);
+    Run(&dll, drops[i], 4 * PPQN, 0, &t, &last, &settled);
+    snprintf(what, sizeof(what), "120 down to %.0fbpm: %.2fbpm after 4 beats, settled after %d ticks", \
+	drops[i], dll.GetBPM(), settled);
+    Check(what, settled >= 0);
+  }
+  for (size_t i = 0; i < sizeof(rises) / sizeof(rises[0]); i++) {
+    dll.Init(PPQN);
+    t = last = 0.0;
+    Run(&dll, 120.0f, 16 * PPQN, 0, &t, &last, &settled);
+    Run(&dll, rises[i], 4 * PPQN, 0, &t, &last, &settled);
+    snprintf(what, sizeof(what), "120 up to %.0fbpm: %.2fbpm after 4 beats, settled after %d ticks", \
+	rises[i], dll.GetBPM(), settled);
+    Check(what, settled >= 0);
+  }
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+// The load time analysis on the host: what the corpus features read back for plain sines, then how long
+// 4 minutes of mono takes to index and to build into the k-d tree, and what a lookup costs and how often
+// the bounded search comes back with the true nearest segment.
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "corpus.h"
+
+#define SR		48000.0f
+#define SINE_SECS	1
+#define BENCH_WAVES	8
+#define BENCH_SECS	30
+#define BENCH_REPS	3
+#define LOOKUPS		100000
+// same as the granulator's
+#define JITTER		0.05f
+
+static Corpus corpus;
+static int fails;
+static uint32_t seed = 1;
+
+static float Rand()
+{
+  seed = seed * 1664525u + 1013904223u;
+  return (seed >> 8) / 16777216.0f;
+}
+
+static void Src(sample_src_t *src, std::vector<int16_t> *w)
+{
+  *src = {};
+  src->start = w->data();
+  src->len = w->size();
+  src->mask = SIZE_MAX;
+  src->chans = 1;
+}
+
+// back from 0 to 1 to Hz
+static float Hz(float f, float max)
+{
+  return CORPUS_MIN_HZ * powf(2.0f, f * log2f(max / CORPUS_MIN_HZ));
+}
+
+static void Sines()
+{
+  const float tones[] = {110.0f, 440.0f, 1760.0f};
+  std::vector<int16_t> w[3];
+  std::vector<corpus_seg_t> mem;
+  sample_src_t src[3];
+  float bright, pitch, n;
+
+  mem.resize(3 * Corpus::Segments(SINE_SECS * (size_t)SR));
+  corpus.Init(mem.data(), mem.size(), SR);
+  for (size_t t = 0; t < 3; t++) {
+    w[t].resize(SINE_SECS * (size_t)SR);
+    for (size_t i = 0; i < w[t].size(); i++) {
+      w[t][i] = (int16_t)lrint(16383.0 * sin(2.0 * M_PI * tones[t] * i / SR));
+    }
+    Src(&src[t], &w[t]);
+    corpus.Add(&src[t]);
+  }
+  corpus.Build();
+
+  for (size_t t = 0; t < 3; t++) {
+    bright = pitch = n = 0.0f;
+    for (size_t i = 0; i < corpus.Size(); i++) {
+      if (corpus.Seg(i)->wave != t) continue;
+      bright += Hz(corpus.Seg(i)->f[CORPUS_BRIGHT], CORPUS_MAX_BRIGHT);
+      pitch += Hz(corpus.Seg(i)->f[CORPUS_PITCH], CORPUS_MAX_PITCH);
+      n++;
+    }
+    bright /= n;
+    pitch /= n;
+    printf("%.0fHz sine reads back %.0fHz bright, %.0fHz pitch\n", tones[t], bright, pitch);
+    if ((fabsf(bright - tones[t]) > (0.1f * tones[t])) || (fabsf(pitch - tones[t]) > (0.1f * tones[t]))) fails++;
+  }
+}
+
+// every segment something different, a tone at some pitch and level with some noise, now and then silence
+static void Wave(std::vector<int16_t> *w)
+{
+  float hz = 0.0f, amp = 0.0f, noise = 0.0f, ph = 0.0f;
+
+  w->resize(BENCH_SECS * (size_t)SR);
+  for (size_t i = 0; i < w->size(); i++) {
+    if ((i % CORPUS_SEG_FRAMES) == 0) {
+      hz = 60.0f * powf(2.0f, 5.0f * Rand());
+      amp = (Rand() < 0.05f) ? 0.0f : powf(10.0f, -2.5f * Rand());
+      noise = Rand() * Rand();
+    }
+    ph += 2.0f * M_PI * hz / SR;
+    if (ph > (2.0f * M_PI)) ph -= 2.0f * M_PI;
+    (*w)[i] = (int16_t)lrintf(32767.0f * amp * ((1.0f - noise) * sinf(ph) + noise * (2.0f * Rand() - 1.0f)));
+  }
+}
+
+static float Dist(const float *a, const float *b)
+{
+  float d = 0.0f;
+  for (size_t i = 0; i < CORPUS_DIMS; i++) {
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return d;
+}
+
+static void Bench()
+{
+  std::vector<int16_t> w[BENCH_WAVES];
+  std::vector<idx_block_t> blocks[BENCH_WAVES];
+  sample_index_t idx[BENCH_WAVES];
+  sample_src_t src[BENCH_WAVES];
+  std::vector<corpus_seg_t> mem;
+  std::vector<float> targets(LOOKUPS * CORPUS_DIMS);
+  SampleAnalyser analyser;
+  const sample_src_t *got;
+  size_t pos, segs = 0, exact = 0;
+  double index_ms = 1e18, build_ms = 1e18, lookup_ns, found, best, mean = 0.0;
+  std::vector<double> extra(LOOKUPS);
+  float *t;
+
+  for (size_t i = 0; i < BENCH_WAVES; i++) {
+    Wave(&w[i]);
+    Src(&src[i], &w[i]);
+    blocks[i].resize(IndexBytes(w[i].size()) / sizeof(idx_block_t));
+    segs += Corpus::Segments(w[i].size());
+  }
+  mem.resize(segs);
+
+  for (int r = 0; r < BENCH_REPS; r++) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < BENCH_WAVES; i++) {
+      analyser.Analyse(&src[i], blocks[i].data(), &idx[i]);
+    }
+    auto mid = std::chrono::steady_clock::now();
+    corpus.Init(mem.data(), mem.size(), SR);
+    for (size_t i = 0; i < BENCH_WAVES; i++) {
+      corpus.Add(&src[i]);
+    }
+    corpus.Build();
+    auto end = std::chrono::steady_clock::now();
+    index_ms = fmin(index_ms, std::chrono::duration<double, std::milli>(mid - start).count());
+    build_ms = fmin(build_ms, std::chrono::duration<double, std::milli>(end - mid).count());
+  }
+
+  // targets the way concat mode makes them, a segment that's there jittered, then anywhere at all
+  for (size_t l = 0; l < LOOKUPS; l++) {
+    t = &targets[l * CORPUS_DIMS];
+    for (size_t d = 0; d < CORPUS_DIMS; d++) {
+      t[d] = (l & 1) ? Rand() : corpus.Seg((size_t)(Rand() * corpus.Size()))->f[d] + JITTER * (2.0f * Rand() - 1.0f);
+    }
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (size_t l = 0; l < LOOKUPS; l++) {
+    corpus.Nearest(&targets[l * CORPUS_DIMS], &got, &pos);
+  }
+  lookup_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / LOOKUPS;
+
+  for (size_t l = 0; l < LOOKUPS; l++) {
+    t = &targets[l * CORPUS_DIMS];
+    corpus.Nearest(t, &got, &pos);
+    found = best = INFINITY;
+    for (size_t i = 0; i < corpus.Size(); i++) {
+      const corpus_seg_t *seg = corpus.Seg(i);
+      if ((&src[seg->wave] == got) && (seg->pos == pos)) found = Dist(t, seg->f);
+      best = fmin(best, Dist(t, seg->f));
+    }
+    if (found == best) exact++;
+    extra[l] = sqrt(found) - sqrt(best);
+    mean += extra[l] / LOOKUPS;
+  }
+  std::sort(extra.begin(), extra.end());
+
+  printf("on this host, %d minutes of mono: index %.1fms, %zu segments built in %.1fms\n", \
+      (BENCH_WAVES * BENCH_SECS) / 60, index_ms, corpus.Size(), build_ms);
+  printf("lookup %.2fuS, true nearest %.0f%% of the time, further than it by %.4f on average, %.4f at the 95th\n", \
+      lookup_ns / 1000.0, (100.0 * exact) / LOOKUPS, mean, extra[(LOOKUPS * 95) / 100]);
+  // nearly all of the rest have to be close neighbours, well inside the jitter
+  if ((exact < (LOOKUPS / 2)) || (extra[(LOOKUPS * 95) / 100] > (JITTER / 2.0f))) fails++;
+}
+
+int main()
+{
+  Sines();
+  Bench();
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+// EventQueue with producers on their own threads and one consumer, run it under ThreadSanitizer too.
+// Each producer counts up in its events, so the consumer can tell if one of them comes out of order or mangled.
+// With the consumer keeping up nothing should be dropped, flat out against a slow one everything
+// pushed should either come out or be counted as dropped.
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <chrono>
+#include "EventQueue.h"
+
+#define DEPTH		64
+#define PRODUCERS	3
+
+typedef EventQueue<DEPTH> queue_t;
+
+static queue_t *q;
+static uint32_t producers_done;
+
+static uint32_t Clock()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>( \
+      std::chrono::steady_clock::now().time_since_epoch()).count() | 1;
+}
+
+// producer p sends id p, its count in the 14 bit val and the whole of it in f, the first one by hand
+static void Producer(uint8_t p, uint32_t count, bool yield)
+{
+  queue_t::event_entry e;
+
+  for (uint32_t n = 0; n < count; n++) {
+    if (p == 0) {
+      e = {queue_t::LAYER_WAVE, p, (uint16_t)(n & 0x3fff), (float)n, 0};
+      q->push(&e);
+    } else {
+      q->push_float(queue_t::LAYER_WAVE, p, (float)n);
+    }
+    if (yield) std::this_thread::yield();
+  }
+  __atomic_fetch_add(&producers_done, 1, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+  uint32_t got, out_of_order, bad, dropped, high_water;
+  double secs;
+} result_t;
+
+static result_t Run(uint32_t count, bool yield, uint32_t consumer_us)
+{
+  std::thread producers[PRODUCERS];
+  int64_t last[PRODUCERS];
+  queue_t::event_entry e;
+  result_t r = {};
+  bool finished;
+
+  q = new queue_t();
+  q->SetClock(Clock);
+  producers_done = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint8_t p = 0; p < PRODUCERS; p++) {
+    last[p] = -1;
+    producers[p] = std::thread(Producer, p, count, yield);
+  }
+  do {
+    finished = __atomic_load_n(&producers_done, __ATOMIC_ACQUIRE) == PRODUCERS;
+    while (q->pop(&e)) {
+      int64_t n = (int64_t)e.f;
+      r.got++;
+      if ((e.id >= PRODUCERS) || (e.ev != queue_t::LAYER_WAVE) || (e.time == 0) || \
+	  ((e.id == 0) && (e.val != (n & 0x3fff)))) {
+	r.bad++;
+	continue;
+      }
+      if (n <= last[e.id]) r.out_of_order++;
+      last[e.id] = n;
+    }
+    if (consumer_us) {
+      std::this_thread::sleep_for(std::chrono::microseconds(consumer_us));
+    } else {
+      std::this_thread::yield();
+    }
+  } while (!finished);
+  for (uint8_t p = 0; p < PRODUCERS; p++) {
+    producers[p].join();
+  }
+  r.secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  r.dropped = q->Dropped();
+  r.high_water = q->HighWater();
+  delete q;
+  return r;
+}
+
+int main()
+{
+  const uint32_t count = 100000;
+  result_t r;
+  int fails = 0;
+
+  r = Run(count, true, 0);
+  printf("%d producers x %u, yielding between pushes: got %u, dropped %u, out of order %u, bad %u, " \
+      "high water %u/%d, %.2fM events/s\n", PRODUCERS, count, r.got, r.dropped, r.out_of_order, r.bad, r.high_water, \
+      DEPTH, r.got / r.secs / 1e6);
+  if ((r.got != (PRODUCERS * count)) || r.dropped || r.out_of_order || r.bad) fails++;
+
+  r = Run(count / 10, false, 200);
+  printf("%d producers x %u flat out, consumer every 200uS: got %u + dropped %u = %u, out of order %u, bad %u, " \
+      "high water %u/%d\n", PRODUCERS, count / 10, r.got, r.dropped, r.got + r.dropped, r.out_of_order, r.bad, \
+      r.high_water, DEPTH);
+  if (((r.got + r.dropped) != (PRODUCERS * count / 10)) || r.out_of_order || r.bad || (r.high_water > DEPTH)) fails++;
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
@@ -0,0 +1,201 @@
+// MIDI ingestion under load: a saturated DIN wire and a USB burst of DAW automation, with a main loop
+// that now and then goes off for a few mS. Nothing should be dropped, every controller has to end up at
+// the last value sent, every note and clock gets through, and no pass drains more than MIDI_BATCH.
+// Then how many messages a second it gets through on this host, and how long a full queue takes to drain.
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "daisy_midi.h"
+#include "MidiMsgHandler.h"
+
+// libDaisy's receive queue
+#define FIFO		256
+#define CONTROLLERS	16
+#define OTHER_CHANNEL	2
+#define SECS		10.0
+// a main loop pass, the odd one held up by the knobs, UI and SD, and now and then a long one
+#define PASS_US		50.0
+#define SLOW_EVERY_US	33000.0
+#define SLOW_US		5000.0
+#define STALL_EVERY	30
+#define STALL_US	20000.0
+
+typedef struct {
+  MidiEvent e;
+  double at;
+} wire_msg_t;
+
+static mock_hw_t hw;
+static MidiMsgHandler<mock_hw_t> mmh;
+static std::vector<wire_msg_t> wire;
+static size_t next_msg, dropped, notes, clocks, passes_over;
+static uint16_t last_val[MIDI_NUM_CC];
+static uint8_t sent_val[MIDI_NUM_CC];
+static std::vector<double> waits, note_waits;
+static int fails;
+
+static void CCRange(uint8_t cc, uint16_t val, uint16_t, uint16_t)
+{
+  last_val[cc] = val >> 7;
+}
+
+static void NoteOnCB(uint8_t, uint8_t, uint8_t)
+{
+  notes++;
+  note_waits.push_back(hw.seed.system.now_us - hw.midi.popped_at);
+}
+
+static void ClockTick()
+{
+  clocks++;
+}
+
+// the UART or USB interrupt, everything that's come in by now goes in the queue if there's room
+static void Receive(double now)
+{
+  for (; (next_msg < wire.size()) && (wire[next_msg].at <= now); next_msg++) {
+    if (hw.midi.fifo.size() >= FIFO) {
+      dropped++;
+      continue;
+    }
+    hw.midi.fifo.push_back(wire[next_msg].e);
+    hw.midi.arrived.push_back(wire[next_msg].at);
+  }
+}
+
+static MidiEvent Msg(MidiMessageType type, int ch, uint8_t d0, uint8_t d1)
+{
+  MidiEvent e = {};
+  e.type = type;
+  e.channel = ch;
+  e.data[0] = d0;
+  e.data[1] = d1;
+  return e;
+}
+
+// msg_us apart, a clock at 120bpm and a note every 250mS in with controllers sweeping on our channel,
+// every other message is for someone else
+static void Fill(double msg_us, size_t *ours, size_t *sent_notes, size_t *sent_clocks)
+{
+  double clk = 0.0, note = 0.0;
+  MidiEvent e;
+  uint8_t c, v;
+
+  wire.clear();
+  *ours = *sent_notes = *sent_clocks = 0;
+  for (size_t k = 0; (k * msg_us) < (SECS * 1e6); k++) {
+    double t = k * msg_us;
+    if (t >= clk) {
+      e = {};
+      e.type = SystemRealTime;
+      e.srt_type = TimingClock;
+      clk += 1e6 / 48.0;
+      (*sent_clocks)++;
+    } else if (t >= note) {
+      e = Msg(NoteOn, 0, 60, 100);
+      note += 250e3;
+      (*sent_notes)++;
+    } else if (k & 1) {
+      e = Msg(ControlChange, OTHER_CHANNEL, 7, rand() & 127);
+    } else {
+      c = (k >> 1) % CONTROLLERS;
+      v = (k >> 5) & 127;
+      e = Msg(ControlChange, 0, c, v);
+      sent_val[c] = v;
+      (*ours)++;
+    }
+    wire.push_back({e, t});
+  }
+}
+
+// v has to be sorted
+static double Pct(const std::vector<double> *v, double p)
+{
+  return (*v)[(size_t)((v->size() - 1) * p)];
+}
+
+static void Run(const char *what, double msg_us)
+{
+  size_t ours, sent_notes, sent_clocks, before, stale = 0;
+  double next_slow = SLOW_EVERY_US, now;
+  std::vector<double> at;
+  int slow = 0;
+
+  Fill(msg_us, &ours, &sent_notes, &sent_clocks);
+  next_msg = dropped = notes = clocks = passes_over = 0;
+  waits.clear();
+  note_waits.clear();
+  hw.seed.system.now_us = 0.0;
+  while ((hw.seed.system.now_us < ((SECS * 1e6) + STALL_US)) || !hw.midi.fifo.empty()) {
+    now = hw.seed.system.now_us;
+    Receive(now);
+    at.assign(hw.midi.arrived.begin(), hw.midi.arrived.end());
+    before = hw.midi.fifo.size();
+    mmh.Process();
+    if ((before - hw.midi.fifo.size()) > MIDI_BATCH) passes_over++;
+    for (size_t i = 0; i < (before - hw.midi.fifo.size()); i++) {
+      waits.push_back(now - at[i]);
+    }
+    hw.seed.system.now_us += PASS_US;
+    if (hw.seed.system.now_us >= next_slow) {
+      hw.seed.system.now_us += ((++slow % STALL_EVERY) == 0) ? STALL_US : SLOW_US;
+      next_slow += SLOW_EVERY_US;
+    }
+  }
+  for (uint8_t c = 0; c < CONTROLLERS; c++) {
+    if (last_val[c] != sent_val[c]) stale++;
+  }
+
+  std::sort(waits.begin(), waits.end());
+  std::sort(note_waits.begin(), note_waits.end());
+  printf("%s: %zu messages in %.0fs, %zu ours\n", what, wire.size(), SECS, ours);
+  printf("  queue wait p50 %.0fuS p99 %.0fuS max %.0fuS, notes p99 %.0fuS max %.0fuS\n", Pct(&waits, 0.5), \
+      Pct(&waits, 0.99), waits.back(), Pct(&note_waits, 0.99), note_waits.back());
+  printf("  dropped %zu, notes %zu of %zu, clocks %zu of %zu, stale controllers %zu, passes over the batch %zu\n", \
+      dropped, notes, sent_notes, clocks, sent_clocks, stale, passes_over);
+  if (dropped || (notes != sent_notes) || (clocks != sent_clocks) || stale || passes_over) fails++;
+  // the longest a message waits is the longest the main loop's away, and the passes to catch up after
+  if (waits.back() > (STALL_US + SLOW_US)) fails++;
+}
+
+int main()
+{
+  double ns, best = 1e18, total = 0.0;
+  const int reps = 2000;
+
+  mmh.SetHWHandle(&hw);
+  mmh.SetChannel(0);
+  mmh.SetMCCRangeHCB(CCRange);
+  mmh.SetMNOnHCB(NoteOnCB);
+  mmh.SetSRTCB(mmh.Clock, ClockTick);
+  for (uint8_t c = 0; c < CONTROLLERS; c++) {
+    mmh.SetCCCoalesce(c, true);
+  }
+
+  // 3 bytes at 31250 baud, and USB automation from a DAW
+  Run("DIN, saturated", 960.0);
+  Run("USB, 10k messages/s", 100.0);
+
+  // a full queue of CCs, best pass of many so the host's own noise doesn't count
+  hw.midi.arrived.clear();
+  for (int r = 0; r < reps; r++) {
+    hw.midi.fifo.clear();
+    for (int i = 0; i < FIFO; i++) {
+      hw.midi.fifo.push_back(Msg(ControlChange, 0, i % CONTROLLERS, i & 127));
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (!hw.midi.fifo.empty()) {
+      mmh.Process();
+    }
+    ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    best = std::min(best, ns);
+    total += ns;
+  }
+  printf("full queue on this host: %.1fM messages/s, %.0fnS to drain %d (best of %d)\n", \
+      (reps * (double)FIFO) / (total / 1e9) / 1e6, best, FIFO, reps);
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
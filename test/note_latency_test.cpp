@@ -0,0 +1,133 @@
+// Note to sound latency through the note queue, with the real BlockClock stamping and the callback's drain.
+// Notes come in at random, the main loop gets to them anywhere up to a few mS later, the callback
+// starts each block a little late now and then. Every note should play on the frame it was stamped
+// with, so from the main loop seeing it to it being heard is the same two blocks every time.
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include "spsc_queue.h"
+#include "block_clock.h"
+
+#define SR		48000.0
+#define BLOCK		48
+#define TICKS_PER_FRAME 10
+// the timer wraps part way through
+#define TICK_START	0xfff00000u
+#define NOTES		20000
+// most main loop passes get to MIDI within 250uS, 1 in 10 are held up by the SD card for up to 3mS
+#define POLL_US		250.0
+#define POLL_SLOW_US	3000.0
+// how late the callback can start after its DMA interrupt
+#define ISR_LATE_TICKS	50
+
+typedef struct {
+  uint32_t frame;
+  uint32_t id;
+} note_event_t;
+
+static SpscQueue<note_event_t, 32> note_q;
+static BlockClock block_clock;
+static uint64_t wall;	// ticks
+static uint32_t seed = 1;
+
+static uint32_t Clock()
+{
+  return TICK_START + (uint32_t)wall;
+}
+
+// 0 to 1, the same every run
+static double Rand()
+{
+  seed = (seed * 1664525) + 1013904223;
+  return (seed >> 8) / (double)(1 << 24);
+}
+
+static double Ms(double ticks)
+{
+  return ticks / (TICKS_PER_FRAME * SR) * 1000.0;
+}
+
+typedef struct {
+  double min, max, sum, sum2;
+  uint32_t n;
+} stat_t;
+
+static void Add(stat_t *s, double x)
+{
+  if ((s->n == 0) || (x < s->min)) s->min = x;
+  if ((s->n == 0) || (x > s->max)) s->max = x;
+  s->sum += x;
+  s->sum2 += x * x;
+  s->n++;
+}
+
+static void Print(const char *what, const stat_t *s)
+{
+  double mean = s->sum / s->n;
+  printf("  %-18s mean %6.3fmS sd %6.3f min %6.3f max %6.3f\n", what, mean, sqrt((s->sum2 / s->n) - (mean * mean)), \
+      s->min, s->max);
+}
+
+int main()
+{
+  static double arrived[NOTES], polled[NOTES];
+  stat_t total = {}, from_poll = {};
+  uint64_t next_block = 0, block_start = 0;
+  uint32_t pushed = 0, played = 0, off_frame = 0, out_of_order = 0, f;
+  double t = 0.0, poll = 0.0, heard;
+  note_event_t ev;
+  int fails = 0;
+
+  // when each note comes in, and when the main loop gets round to it, in order
+  for (uint32_t n = 0; n < NOTES; n++) {
+    t += (1.0 + (9.0 * Rand())) * TICKS_PER_FRAME * SR / 1000.0;
+    arrived[n] = t;
+    poll = fmax(poll, t + (((Rand() < 0.1) ? POLL_SLOW_US : POLL_US) * Rand() * TICKS_PER_FRAME * SR / 1e6));
+    polled[n] = poll;
+  }
+
+  block_clock.Init(Clock, 1.0f / TICKS_PER_FRAME);
+  while (played < NOTES) {
+    // the main loop can't run between the interrupt and the callback starting
+    if (block_start < next_block) block_start = next_block + (uint64_t)(ISR_LATE_TICKS * Rand());
+    if ((pushed < NOTES) && (polled[pushed] < block_start)) {
+      // main loop
+      wall = (uint64_t)polled[pushed];
+      ev.frame = block_clock.Stamp();
+      ev.id = pushed;
+      if (!note_q.Push(ev)) break;
+      pushed++;
+      continue;
+    }
+    // the callback, the block it works on goes out a block after it started
+    wall = block_start;
+    block_clock.Block(BLOCK);
+    for (size_t i = 0; i < BLOCK; i++) {
+      f = block_clock.Frame() + i;
+      while (note_q.Peek(&ev) && ((int32_t)(ev.frame - f) <= 0)) {
+	note_q.Drop();
+	if (ev.frame != f) off_frame++;
+	if (ev.id != played) out_of_order++;
+	heard = (double)(f + BLOCK) * TICKS_PER_FRAME;
+	Add(&total, Ms(heard - arrived[ev.id]));
+	Add(&from_poll, Ms(heard - polled[ev.id]));
+	played++;
+      }
+    }
+    next_block += BLOCK * TICKS_PER_FRAME;
+  }
+
+  printf("%u notes, %d frame blocks at %.0fkHz, main loop up to %.0fuS late (1 in 10 up to %.0fuS)\n", NOTES, BLOCK, \
+      SR / 1000.0, POLL_US, POLL_SLOW_US);
+  Print("note to sound", &total);
+  Print("main loop to sound", &from_poll);
+  printf("  played %u, not on their stamped frame %u, out of order %u, dropped %u\n", played, off_frame, out_of_order, \
+      note_q.Dropped());
+  if ((played != NOTES) || off_frame || out_of_order || note_q.Dropped()) fails++;
+  // two blocks, give or take how late the callback started and a frame of rounding
+  if ((from_poll.max - from_poll.min) > Ms(ISR_LATE_TICKS + TICKS_PER_FRAME)) fails++;
+  if (fabs(from_poll.min - Ms(2 * BLOCK * TICKS_PER_FRAME)) > Ms(ISR_LATE_TICKS + TICKS_PER_FRAME)) fails++;
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// NRPN and RPN data entry: per parameter LSB tracking, toggles firing once, CC38 after any data entry
+#include <stdio.h>
+#include "daisy_midi.h"
+#include "MidiMsgHandler.h"
+
+#define CC_TOGGLE	64	// plain 7 bit callback
+#define CC_SWEEP	20	// coalesced, 14 bit
+#define CC_OTHER	21	// coalesced, only ever sent 7 bit
+#define CC_DELAY_MIX	38
+
+mock_hw_t hw;
+MidiMsgHandler<mock_hw_t> mmh;
+int toggles, delay_mix, sweeps, others;
+uint16_t sweep_val, other_val;
+int fails;
+
+void CC(uint8_t cc, uint8_t)
+{
+  if (cc == CC_TOGGLE) toggles++;
+  if (cc == CC_DELAY_MIX) delay_mix++;
+}
+
+void CCRange(uint8_t cc, uint16_t val, uint16_t, uint16_t)
+{
+  if (cc == CC_SWEEP) { sweeps++; sweep_val = val; }
+  if (cc == CC_OTHER) { others++; other_val = val; }
+}
+
+void Send(uint8_t cc, uint8_t val)
+{
+  hw.midi.fifo.push_back(MidiCC(0, cc, val));
+}
+
+void Nrpn(uint16_t n)
+{
+  Send(MIDI_NRPN_MSB, n >> 7);
+  Send(MIDI_NRPN_LSB, n & 0x7f);
+}
+
+void Check(const char *what, bool ok)
+{
+  printf("%s: %s\n", what, ok ? "ok" : "FAIL");
+  if (!ok) fails++;
+}
+
+int main()
+{
+  mmh.SetHWHandle(&hw);
+  mmh.SetChannel(0);
+  mmh.SetMCCHCB(CC);
+  mmh.SetMCCRangeHCB(CCRange);
+  mmh.SetCCCoalesce(CC_SWEEP, true);
+  mmh.SetCCCoalesce(CC_OTHER, true);
+
+  // a toggle through NRPN with the fine part too fires once
+  Nrpn(CC_TOGGLE);
+  Send(MIDI_DATA_MSB, 127);
+  Send(MIDI_DATA_LSB, 0);
+  mmh.Process();
+  Check("NRPN toggle with an LSB fires once", toggles == 1);
+
+  // a 14 bit NRPN sweep, then a 7 bit only one, one doesn't make the other wait for an LSB
+  Nrpn(CC_SWEEP);
+  Send(MIDI_DATA_MSB, 64);
+  Send(MIDI_DATA_LSB, 5);
+  mmh.Process();
+  Check("14 bit NRPN value", sweep_val == ((64 << 7) | 5));
+  Nrpn(CC_OTHER);
+  Send(MIDI_DATA_MSB, 100);
+  mmh.Process();
+  Check("7 bit NRPN after a 14 bit one still goes on the MSB", (others == 1) && (other_val == ((100 << 7) | 100)));
+  Nrpn(CC_SWEEP);
+  sweeps = 0;
+  Send(MIDI_DATA_MSB, 10);
+  mmh.Process();
+  Check("14 bit NRPN MSB waits for its LSB", sweeps == 0);
+  Send(MIDI_DATA_LSB, 3);
+  mmh.Process();
+  Check("then goes with it", (sweeps == 1) && (sweep_val == ((10 << 7) | 3)));
+
+  // MPE bend range RPN with its LSB, CC38 isn't the delay mix
+  Send(MIDI_RPN_MSB, 0);
+  Send(MIDI_RPN_LSB, MIDI_RPN_BEND_RANGE);
+  Send(MIDI_DATA_MSB, 24);
+  Send(MIDI_DATA_LSB, 0);
+  mmh.Process();
+  Check("CC38 after RPN data entry is its LSB", delay_mix == 0);
+
+  // and an NRPN above 127 has nowhere to go but still owns its LSB
+  Nrpn(1000);
+  Send(MIDI_DATA_MSB, 1);
+  Send(MIDI_DATA_LSB, 2);
+  mmh.Process();
+  Check("CC38 after a high NRPN's data entry is its LSB", delay_mix == 0);
+
+  // on its own it's just CC38
+  Send(CC_DELAY_MIX, 90);
+  mmh.Process();
+  Check("CC38 on its own is a CC", delay_mix == 1);
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
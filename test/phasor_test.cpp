@@ -0,0 +1,68 @@
+// Long streamed waves scan past 2^24 frames, where a float position stops moving at low rates
+// The scan heads keep theirs in a double, grains keep a float counted from near where they start
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include "daisy_core.h"
+#include "phasor.h"
+#include "sample_phasor.h"
+
+#define STEPS 48000
+// a grain at MAX_GRAIN_DUR
+#define GRAIN_STEPS 9600
+// a streamed window, frame n holds n so a read says where it is
+#define RING_MASK 0x7fff
+
+int main()
+{
+  const float rates[] = {0.25f, 1.0f, 1.0f / 3.0f};
+  const size_t starts[] = {(1 << 22) + 1, (1 << 24) + 1, (1 << 26) + 1};
+  static int16_t ring[RING_MASK + 1];
+  int fails = 0;
+  ScanPhasor p;
+  Sample<int16_t> g;
+  bool eot, ok;
+  double moved, want;
+
+  for (size_t s = 0; s < sizeof(starts) / sizeof(starts[0]); s++) {
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+      p.Init(48000.0f, starts[s] * 2);
+      p.SetPitch(rates[r]);
+      p.SetCurPos(starts[s]);
+      for (size_t i = 0; i < STEPS; i++) {
+	p.Process(&eot);
+      }
+      moved = p.GetPos() - starts[s];
+      want = (double)rates[r] * STEPS;
+      ok = fabs(moved - want) < 0.01;
+      printf("scan from %zu at %.3fx: moved %.3f frames, wanted %.3f %s\n", starts[s], rates[r], moved, want, ok ? "" : "FAIL");
+      if (!ok) fails++;
+    }
+  }
+
+  for (size_t i = 0; i <= RING_MASK; i++) {
+    ring[i] = i;
+  }
+  for (size_t s = 0; s < sizeof(starts) / sizeof(starts[0]); s++) {
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+      g.Init(ring, 48000.0f, starts[s] * 2, 1, RING_MASK);
+      g.Reset();
+      g.SetCurPos(starts[s]);
+      g.SetPitch(rates[r]);
+      for (size_t i = 0; i < GRAIN_STEPS; i++) {
+	g.Process(&eot);
+      }
+      // frames past the start, read back out of the ring
+      moved = (g.Process(&eot) * 32768.0) - (starts[s] & RING_MASK);
+      want = (double)rates[r] * GRAIN_STEPS;
+      // a float 2^16 frames in is good to 1/128 of a frame, a third of a frame rounds the same way every step
+      ok = fabs(moved - want) < (0.01 * want);
+      printf("grain from %zu at %.3fx: read %.0f frames on, wanted %.3f %s\n", starts[s], rates[r], moved, want, ok ? "" : "FAIL");
+      if (!ok) fails++;
+    }
+  }
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+// Poly mode through the whole granulator: what a sample costs with 1 to 8 voices next to mono, with the pool
+// short and with it full, then voices being stolen, which mustn't click, and silence once they're all let go.
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+#include "daisy_core.h"
+#include "stm32h7xx_hal.h"
+#include "granulator.h"
+
+#define SR		48000.0f
+#define ENV_LEN		1024
+#define WAVE_SECS	10
+#define BENCH_SECS	5
+#define BENCH_REPS	3
+#define STEAL_NOTES	20
+// a note every half second while stealing
+#define NOTE_FRAMES	24000
+// the release, the longest grain and some
+#define TAIL_FRAMES	(size_t)((VOICE_RELEASE_SECS + 1.0f) * SR)
+
+static Granulator g;
+static float hann[ENV_LEN];
+static std::vector<int16_t> wave;
+static sample_src_t src;
+static int fails;
+
+static void Wave(float hz)
+{
+  wave.resize(WAVE_SECS * (size_t)SR);
+  for (size_t i = 0; i < wave.size(); i++) {
+    wave[i] = (int16_t)lrint(16383.0 * sin(2.0 * M_PI * hz * i / SR));
+  }
+  src = {};
+  src.start = wave.data();
+  src.len = wave.size();
+  src.mask = SIZE_MAX;
+  src.chans = 1;
+}
+
+static float Pitch(int semis)
+{
+  return powf(2.0f, semis / 12.0f);
+}
+
+// voices 0 is mono
+static void Start(float density, uint8_t voices)
+{
+  g.Init(SR, &src, hann, ENV_LEN, true, false);
+  g.SetHannEnv(hann);
+  g.SetDensity(SR / density);
+  g.ToggleScatter();
+  g.ToggleRandomPitch();
+  if (voices == 0) return;
+  g.TogglePoly();
+  // the reset's carried out by the next sample, notes go in after that like they would from the queue
+  g.Process(0, 0);
+  for (uint8_t v = 0; v < voices; v++) {
+    g.NoteOn(48 + (v * 3), Pitch(v * 3), 0);
+  }
+}
+
+static double Cost(float density, uint8_t voices)
+{
+  sample_t s;
+  double best = 1e18, ns;
+  float sink = 0.0f;
+  size_t frames = BENCH_SECS * (size_t)SR;
+
+  for (int r = 0; r < BENCH_REPS; r++) {
+    Start(density, voices);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frames; i++) {
+      s = g.Process(0, 0);
+      sink += s.l;
+    }
+    ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frames;
+    best = fmin(best, ns);
+  }
+  if (sink == 12345.0f) printf(" ");
+  return best;
+}
+
+// largest step from one sample to the next over frames
+static float Run(size_t frames, float *last)
+{
+  sample_t s;
+  float step = 0.0f;
+
+  for (size_t i = 0; i < frames; i++) {
+    s = g.Process(0, 0);
+    step = fmaxf(step, fabsf(s.l - *last));
+    *last = s.l;
+  }
+  return step;
+}
+
+static void Steal()
+{
+  float last = 0.0f, held, stealing = 0.0f, peak = 0.0f;
+  double ns;
+  sample_t s;
+
+  // a low wave so the steps are small unless something cuts
+  Wave(110.0f);
+  Start(400.0f, 0);
+  g.ToggleRandomPitch();
+  g.ToggleScatter();
+  g.TogglePoly();
+  g.Process(0, 0);
+  for (uint8_t n = 0; n < MAX_VOICES; n++) {
+    g.NoteOn(48 + n, Pitch(n), 0);
+  }
+  Run(NOTE_FRAMES, &last);
+  held = Run(NOTE_FRAMES, &last);
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint8_t n = 0; n < STEAL_NOTES; n++) {
+    g.NoteOn(60 + n, Pitch(n - 12), 0);
+    stealing = fmaxf(stealing, Run(NOTE_FRAMES, &last));
+  }
+  ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / \
+      (STEAL_NOTES * NOTE_FRAMES);
+  printf("%d notes round %d voices: %.1fns a sample, largest step %.4f (%.4f just held)\n", STEAL_NOTES, \
+      MAX_VOICES, ns, stealing, held);
+  // a grain cut dead on a 110Hz wave steps by a tenth or more
+  if (stealing > (2.0f * held)) fails++;
+
+  for (uint8_t n = 0; n < STEAL_NOTES; n++) {
+    g.NoteOff(60 + n, 0);
+  }
+  Run(TAIL_FRAMES, &last);
+  for (size_t i = 0; i < (size_t)SR; i++) {
+    s = g.Process(0, 0);
+    peak = fmaxf(peak, fmaxf(fabsf(s.l), fabsf(s.r)));
+  }
+  printf("after the release: peak %.6f\n", peak);
+  if (peak != 0.0f) fails++;
+}
+
+int main()
+{
+  const float densities[] = {60.0f, 400.0f};
+  const uint8_t voices[] = {1, 2, 4, 8};
+
+  for (size_t i = 0; i < ENV_LEN; i++) {
+    hann[i] = 0.5f - 0.5f * cosf(2.0f * M_PI * i / (ENV_LEN - 1));
+  }
+
+  Wave(220.0f);
+  printf("on this host, ns a sample, 220Hz sine, scatter and random pitch:\n");
+  for (float d : densities) {
+    printf("  %3.0f grains/s: mono %6.1f, poly", d, Cost(d, 0));
+    for (uint8_t v : voices) {
+      printf(" %d voices %6.1f%s", v, Cost(d, v), (v == MAX_VOICES) ? "\n" : ",");
+    }
+  }
+
+  Steal();
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
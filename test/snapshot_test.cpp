@@ -0,0 +1,71 @@
+// Snapshot triple buffer with the writer and reader on their own threads, run it under ThreadSanitizer too.
+// Every field of a published struct is the same number, so a torn read shows up as a field that isn't,
+// the numbers only go up so the reader should never see an older one, and it has to end on the last.
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <chrono>
+#include "snapshot.h"
+
+#define FIELDS	24
+#define SECS	1
+
+typedef struct {
+  uint32_t v[FIELDS];
+} snap_t;
+
+static Snapshot<snap_t> snap;
+static uint32_t published;
+static bool done;
+
+static void Writer()
+{
+  auto end = std::chrono::steady_clock::now() + std::chrono::seconds(SECS);
+  uint32_t n = 0;
+  snap_t *b;
+
+  while (std::chrono::steady_clock::now() < end) {
+    b = snap.Back();
+    n++;
+    for (size_t i = 0; i < FIELDS; i++) {
+      b->v[i] = n;
+    }
+    snap.Publish();
+    if ((n & 7) == 0) std::this_thread::yield();
+  }
+  published = n;
+  __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+}
+
+int main()
+{
+  snap_t zero = {};
+  size_t fetched = 0, torn = 0, backwards = 0;
+  uint32_t last = 0, n;
+  const snap_t *f;
+  bool finished;
+
+  snap.Init(zero);
+  std::thread writer(Writer);
+  do {
+    // whatever the writer got to before it said it was done, then one more look for the last of it
+    finished = __atomic_load_n(&done, __ATOMIC_ACQUIRE);
+    if (snap.Fetch()) {
+      fetched++;
+      f = snap.Front();
+      n = f->v[0];
+      for (size_t i = 0; i < FIELDS; i++) {
+	if (f->v[i] != n) torn++;
+      }
+      if (n < last) backwards++;
+      last = n;
+    }
+    std::this_thread::yield();
+  } while (!finished);
+  writer.join();
+
+  printf("%u published, %zu fetched, %zu torn fields, %zu went backwards, ended on %u\n", published, fetched, torn, \
+      backwards, last);
+  printf("%s\n", (torn || backwards || (last != published)) ? "FAIL" : "PASS");
+  return (torn || backwards || (last != published)) ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+// Does the stream window keep ahead of the scan head at MAX_SCAN_RATE?
+// The card is stubbed with a per command and per byte cost, the scan head moves on by however long
+// each Service() call took plus the rest of the main loop, then the window and what's in it are checked.
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include "fatfs.h"
+#include "stream.h"
+#include "params.h"
+
+#define SR		48000.0
+#define WIN_FRAMES	(1 << 20)
+#define BOUNCE_BYTES	8192
+// everything else the main loop gets up to between two goes at the stream, uS
+#define OTHER_US	2000.0
+#define WAV_FRAMES	(3 * WIN_FRAMES + 12345)
+
+static int16_t ring[WIN_FRAMES * 2];
+static char bounce[BOUNCE_BYTES];
+
+static inline int16_t Expect(size_t frame, uint8_t ch)
+{
+  return (int16_t)((frame * 7 + ch * 3) & 0x7fff);
+}
+
+typedef struct {
+  uint32_t underruns, bad;
+  size_t min_lead;
+  double worst_us, sd_busy;
+} run_t;
+
+// one pass through the whole wave, forwards or backwards
+static run_t Run(double rate, bool reverse)
+{
+  SampleStream stream;
+  sample_src_t src = {};
+  stream_win_t *win;
+  run_t r = {0, 0, SIZE_MAX, 0.0, 0.0};
+  size_t span = MAX_GRAIN_DUR * SR * MAX_GRAIN_PITCH;
+  double pos = reverse ? WAV_FRAMES - 1 : 0;
+  double t = 0.0, before, took;
+  size_t p, lead;
+
+  src.len = WAV_FRAMES;
+  src.chans = 2;
+  stream.Init(ring, WIN_FRAMES, bounce, BOUNCE_BYTES);
+  if (!stream.Open("long.wav", 0, &src)) exit(1);
+  stream.Prime((size_t)pos, reverse);
+  win = src.win;
+  sd_card.us = 0.0;
+
+  while (reverse ? (pos > span) : (pos < (WAV_FRAMES - span))) {
+    before = sd_card.us;
+    stream.Service((size_t)pos, reverse, (float)rate);
+    took = sd_card.us - before;
+    if (took > r.worst_us) r.worst_us = took;
+    t += took + OTHER_US;
+    pos += (reverse ? -1.0 : 1.0) * (took + OTHER_US) * SR * rate / 1e6;
+    if ((pos < 0.0) || (pos >= WAV_FRAMES)) break;
+
+    // the same test the granulator does before it starts a grain
+    p = (size_t)pos;
+    if ((p < win->lo) || (p >= win->hi) || ((win->hi - win->lo) <= (2 * span))) {
+      r.underruns++;
+      continue;
+    }
+    lead = reverse ? p - win->lo : win->hi - p;
+    if ((lead < r.min_lead) && (reverse ? (win->lo > 0) : (win->hi < WAV_FRAMES))) r.min_lead = lead;
+    for (uint8_t ch = 0; ch < 2; ch++) {
+      if (src.start[((p & src.mask) << 1) + ch] != Expect(p, ch)) r.bad++;
+    }
+  }
+  r.sd_busy = sd_card.us / t;
+  stream.Close();
+  return r;
+}
+
+int main()
+{
+  std::vector<int16_t> wav((size_t)WAV_FRAMES * 2);
+  run_t r;
+  int fails = 0;
+
+  for (size_t i = 0; i < WAV_FRAMES; i++) {
+    wav[i * 2] = Expect(i, 0);
+    wav[i * 2 + 1] = Expect(i, 1);
+  }
+  sd_card.data = (const uint8_t *)wav.data();
+  sd_card.size = wav.size() * sizeof(int16_t);
+
+  printf("card %.0fuS a command, %.1fMB/s, %.0fuS between calls\n", sd_card.cmd_us, sd_card.bytes_per_us, OTHER_US);
+  for (double rate = 1.0; rate <= MAX_SCAN_RATE; rate *= 2.0) {
+    for (int rev = 0; rev < 2; rev++) {
+      r = Run(rate, rev);
+      printf("%.0fx %s: underruns %u, bad frames %u, min lead %zu frames (%.0fms), worst call %.0fuS, card busy %.0f%%\n", \
+	  rate, rev ? "reverse" : "forward", r.underruns, r.bad, r.min_lead, r.min_lead / (SR * rate) * 1000.0, \
+	  r.worst_us, r.sd_busy * 100.0);
+      if (r.underruns || r.bad) fails++;
+    }
+  }
+
+  // card pulled, Open() has to fail without touching the src it was given
+  sample_src_t src = {};
+  SampleStream stream;
+  stream.Init(ring, WIN_FRAMES, bounce, BOUNCE_BYTES);
+  sd_card.present = false;
+  if (stream.Open("long.wav", 0, &src) || (src.win != nullptr) || (src.start != nullptr)) {
+    printf("Open() with no card changed the src\n");
+    fails++;
+  }
+  sd_card.present = true;
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
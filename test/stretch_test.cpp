@@ -0,0 +1,149 @@
+// Time stretch mode through the whole granulator: the level has to stay flat at any scan rate, with the
+// grains lined up by Align(), and what a sample of it costs next to the default grains, on an s16 wave
+// and an ADPCM one, which isn't aligned.
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+#include "daisy_core.h"
+#include "stm32h7xx_hal.h"
+#include "granulator.h"
+
+#define SR		48000.0f
+#define ENV_LEN		1024
+#define WAVE_SECS	10
+#define TONE_HZ		300.0
+// RMS over 10mS, once the first grains are going
+#define RMS_FRAMES	480
+#define SETTLE_FRAMES	(4 * RMS_FRAMES)
+#define BENCH_SECS	2
+#define BENCH_REPS	5
+
+static Granulator g;
+static float hann[ENV_LEN];
+static std::vector<int16_t> tone, mix;
+static std::vector<uint8_t> packed;
+static int fails;
+
+static void Wave(std::vector<int16_t> *w, bool noisy)
+{
+  uint32_t seed = 1;
+  double s;
+
+  w->resize(WAVE_SECS * (size_t)SR);
+  for (size_t i = 0; i < w->size(); i++) {
+    if (noisy) {
+      seed = seed * 1664525u + 1013904223u;
+      s = 0.3 * sin(2.0 * M_PI * 220.0 * i / SR) + 0.2 * sin(2.0 * M_PI * 1310.0 * i / SR) + \
+	  0.1 * sin(2.0 * M_PI * 3300.0 * i / SR) + 0.05 * (((seed >> 8) / 8388608.0) - 1.0);
+    } else {
+      s = 0.5 * sin(2.0 * M_PI * TONE_HZ * i / SR);
+    }
+    (*w)[i] = (int16_t)lrint(s * 32767.0);
+  }
+}
+
+static void Src(sample_src_t *src, std::vector<int16_t> *w, bool adpcm)
+{
+  AdpcmEncoder enc;
+
+  *src = {};
+  src->len = w->size();
+  src->mask = SIZE_MAX;
+  src->chans = 1;
+  if (adpcm) {
+    packed.resize(AdpcmBytes(w->size(), 1));
+    enc.Init(packed.data(), 1);
+    enc.Encode(w->data(), w->size());
+    enc.Flush();
+    src->adpcm = packed.data();
+  } else {
+    src->start = w->data();
+  }
+}
+
+static void Start(const sample_src_t *src, bool stretch, float rate)
+{
+  g.Init(SR, src, hann, ENV_LEN, true, false);
+  g.SetHannEnv(hann);
+  if (stretch) g.ToggleStretch();
+  g.SetScanRate(rate);
+}
+
+// the lowest and highest 10mS RMS over a second
+static void Flat(float rate, float *lo, float *hi)
+{
+  sample_src_t src;
+  sample_t s;
+  double sum = 0.0, rms;
+
+  Src(&src, &tone, false);
+  Start(&src, true, rate);
+  *lo = 1e9f;
+  *hi = 0.0f;
+  for (size_t i = 0; i < (SETTLE_FRAMES + (size_t)SR); i++) {
+    s = g.Process(0, 0);
+    if (i < SETTLE_FRAMES) continue;
+    sum += s.l * s.l;
+    if (((i - SETTLE_FRAMES) % RMS_FRAMES) == (RMS_FRAMES - 1)) {
+      rms = sqrt(sum / RMS_FRAMES);
+      *lo = fminf(*lo, rms);
+      *hi = fmaxf(*hi, rms);
+      sum = 0.0;
+    }
+  }
+}
+
+static double Cost(std::vector<int16_t> *w, bool adpcm, bool stretch, float rate)
+{
+  sample_src_t src;
+  sample_t s;
+  double best = 1e18, ns;
+  float sink = 0.0f;
+  size_t frames = BENCH_SECS * (size_t)SR;
+
+  Src(&src, w, adpcm);
+  for (int r = 0; r < BENCH_REPS; r++) {
+    Start(&src, stretch, rate);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frames; i++) {
+      s = g.Process(0, 0);
+      sink += s.l;
+    }
+    ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frames;
+    best = fmin(best, ns);
+  }
+  if (sink == 12345.0f) printf(" ");
+  return best;
+}
+
+int main()
+{
+  const float rates[] = {0.25f, 1.0f, 2.0f};
+  float lo, hi;
+
+  for (size_t i = 0; i < ENV_LEN; i++) {
+    hann[i] = 0.5f - 0.5f * cosf(2.0f * M_PI * i / (ENV_LEN - 1));
+  }
+  Wave(&tone, false);
+  Wave(&mix, true);
+
+  for (float rate : rates) {
+    Flat(rate, &lo, &hi);
+    printf("300Hz tone at %.2fx: 10mS RMS %.3f to %.3f\n", rate, lo, hi);
+    // lined up grains don't cancel, they'd dip well below half without it
+    if ((lo < (0.8f * hi)) || (hi < 0.05f)) fails++;
+  }
+
+  printf("on this host, ns a sample:\n");
+  printf("  default grains, s16:   %6.1f\n", Cost(&mix, false, false, 1.0f));
+  printf("  stretch at 0.8x, s16:  %6.1f\n", Cost(&mix, false, true, 0.8f));
+  printf("  stretch at 1.25x, s16: %6.1f\n", Cost(&mix, false, true, 1.25f));
+  printf("  default grains, ADPCM: %6.1f\n", Cost(&mix, true, false, 1.0f));
+  printf("  stretch at 0.8x, ADPCM (not aligned): %6.1f\n", Cost(&mix, true, true, 0.8f));
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+// passes straight through, nothing the host tests look at
+namespace daisysp
+{
+class Decimator
+{
+  public:
+    void Init() {}
+    float Process(float in) { return in; }
+    void SetBitcrushFactor(float) {}
+    void SetDownsampleFactor(float) {}
+};
+}
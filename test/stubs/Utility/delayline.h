@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+// always silent, nothing the host tests look at
+namespace daisysp
+{
+template <typename T, size_t N>
+class DelayLine
+{
+  public:
+    void Init() {}
+    void SetDelay(float) {}
+    T Read() { return T(0); }
+    void Write(T) {}
+};
+}
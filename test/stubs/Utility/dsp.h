@@ -0,0 +1,9 @@
+#pragma once
+
+namespace daisysp
+{
+inline void fonepole(float &out, float in, float coeff)
+{
+  out += coeff * (in - out);
+}
+}
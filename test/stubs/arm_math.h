@@ -0,0 +1,5 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
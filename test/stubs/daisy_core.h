@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// libDaisy's sample conversions, SDRAM is just memory on the host
+#define DSY_SDRAM_BSS
+
+static inline float s162f(int16_t x)
+{
+  return (float)x * 3.0517578125e-05f;
+}
+
+static inline int16_t f2s16(float x)
+{
+  x = (x <= -1.0f) ? -1.0f : ((x >= 1.0f) ? 1.0f : x);
+  return (int16_t)(x * 32767.0f);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+
+/*
+ * The bits of libDaisy's MIDI that MidiMsgHandler uses, and a transport to drive it with.
+ * Ticks are uS * 200 on a 100MHz PClk1, the same sums as the seed's 200MHz tick timer.
+ */
+namespace daisy
+{
+enum MidiMessageType { NoteOff, NoteOn, PolyphonicKeyPressure, ControlChange, ProgramChange, ChannelPressure, \
+		       PitchBend, SystemCommon, SystemRealTime, ChannelMode, MessageLast };
+enum SystemCommonType { SystemExclusive, MTCQuarterFrame, SongPositionPointer, SongSelect, SCUndefined0, \
+			SCUndefined1, TuneRequest, SysExEnd, SystemCommonLast };
+enum SystemRealTimeType { TimingClock, SRTUndefined0, Start, Continue, Stop, SRTUndefined1, ActiveSensing, \
+			  Reset, SystemRealTimeLast };
+
+struct NoteOnEvent { int channel; uint8_t note; uint8_t velocity; };
+struct NoteOffEvent { int channel; uint8_t note; uint8_t velocity; };
+struct ControlChangeEvent { int channel; uint8_t control_number; uint8_t value; };
+struct PitchBendEvent { int channel; int16_t value; };
+struct ChannelPressureEvent { int channel; uint8_t monophonic_pressure; };
+
+struct MidiEvent {
+  MidiMessageType type;
+  int channel;
+  uint8_t data[2];
+  SystemCommonType sc_type;
+  SystemRealTimeType srt_type;
+
+  NoteOnEvent AsNoteOn() { return {channel, data[0], data[1]}; }
+  NoteOffEvent AsNoteOff() { return {channel, data[0], data[1]}; }
+  ControlChangeEvent AsControlChange() { return {channel, data[0], data[1]}; }
+  PitchBendEvent AsPitchBend() { return {channel, (int16_t)(((data[1] << 7) | data[0]) - 8192)}; }
+  ChannelPressureEvent AsChannelPressure() { return {channel, data[0]}; }
+};
+}
+
+using namespace daisy;
+
+struct mock_hw_t {
+  struct {
+    struct {
+      double now_us = 0.0;
+      uint32_t GetTick() { return (uint32_t)(now_us * 200.0); }
+      uint32_t GetPClk1Freq() { return 100000000; }
+    } system;
+  } seed;
+  struct {
+    std::deque<MidiEvent> fifo;
+    // when each one in fifo came in, uS, if whoever filled it kept track, and when the last one popped did
+    std::deque<double> arrived;
+    double popped_at = 0.0;
+    void Listen() {}
+    bool HasEvents() { return !fifo.empty(); }
+    MidiEvent PopEvent()
+    {
+      MidiEvent e = fifo.front();
+      fifo.pop_front();
+      if (!arrived.empty()) {
+	popped_at = arrived.front();
+	arrived.pop_front();
+      }
+      return e;
+    }
+  } midi;
+};
+
+static inline MidiEvent MidiCC(int ch, uint8_t cc, uint8_t val)
+{
+  MidiEvent e = {};
+  e.type = ControlChange;
+  e.channel = ch;
+  e.data[0] = cc;
+  e.data[1] = val;
+  return e;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "daisy_core.h"
+#include "daisy_midi.h"
+#include "stm32h7xx_hal.h"
+#include "fatfs.h"
+
+/*
+ * A Pod with nothing plugged in, enough to boot grnltr.cpp on the host.
+ * The clock only moves when a test moves it (or something waits on it), the knobs sit where they're put,
+ * and the audio callback is handed back rather than run, the test calls it when it wants a block.
+ */
+#define BOARD_SR	48000.0f
+#define BOARD_BLOCK	48
+
+struct board_t {
+  double	us;
+  float		knob[2];
+  bool		log;
+  void		(*audio)(const float *const *, float **, size_t);
+};
+
+inline board_t board = {0.0, {0.0f, 0.0f}, false, nullptr};
+
+namespace daisy
+{
+struct System {
+  static uint32_t GetNow() { return (uint32_t)(board.us / 1000.0); }
+  static uint32_t GetUs() { return (uint32_t)board.us; }
+  // 200MHz like the seed's tick timer
+  static uint32_t GetTick() { return (uint32_t)(board.us * 200.0); }
+  static uint32_t GetPClk1Freq() { return 100000000; }
+  static void Delay(uint32_t ms) { board.us += ms * 1000.0; }
+  static void DelayUs(uint32_t us) { board.us += us; }
+};
+
+struct AudioHandle {
+  typedef const float *const *InputBuffer;
+  typedef float **OutputBuffer;
+  typedef void (*AudioCallback)(InputBuffer, OutputBuffer, size_t);
+};
+
+struct AnalogControl {
+  int n;
+};
+
+struct Parameter {
+  enum Curve { LINEAR };
+  int n;
+  void Init(AnalogControl in, float, float, Curve) { n = in.n; }
+  float Process() { return board.knob[n]; }
+};
+
+struct RgbLed { void Set(float, float, float) {} };
+
+struct Encoder {
+  bool Pressed() { return false; }
+  float TimeHeldMs() { return 0.0f; }
+  bool FallingEdge() { return false; }
+  int32_t Increment() { return 0; }
+};
+
+struct Switch { bool RisingEdge() { return false; } };
+
+struct DaisySeed {
+  System system;
+  void PrintLine(const char *fmt, ...)
+  {
+    va_list ap;
+    if (!board.log) return;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+  }
+  void StartLog(bool) {}
+  void SetLed(bool) {}
+};
+
+struct MidiUartHandler {
+  void Listen() {}
+  bool HasEvents() { return false; }
+  MidiEvent PopEvent() { return MidiEvent(); }
+  void StartReceive() {}
+};
+
+struct DaisyPod {
+  DaisySeed seed;
+  RgbLed led1, led2;
+  Encoder encoder;
+  Switch button1, button2;
+  AnalogControl knob1 = {0}, knob2 = {1};
+  MidiUartHandler midi;
+  void Init() {}
+  float AudioSampleRate() { return BOARD_SR; }
+  size_t AudioBlockSize() { return BOARD_BLOCK; }
+  void StartAdc() {}
+  void StartAudio(AudioHandle::AudioCallback cb) { board.audio = cb; }
+  void UpdateLeds() {}
+  void ProcessDigitalControls() {}
+};
+
+struct SdmmcHandler {
+  struct Config { void Defaults() {} };
+  void Init(Config) {}
+};
+
+struct FatFSInterface {
+  struct Config { enum { MEDIA_SD }; };
+  FATFS fs;
+  void Init(int) {}
+  FATFS &GetSDFileSystem() { return fs; }
+};
+}
+
+using namespace daisy;
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Just enough FatFS for stream.h, the RIFF walk and the bank loader, files in memory read through a card that takes its time.
+ * Every read and seek adds what it would have cost to sd_us so a test can keep its own clock.
+ * With no files listed every open gets the one in data, otherwise files is the whole card, the directories
+ * are whatever comes before a '/' in their names. Writes are counted and thrown away.
+ */
+typedef size_t UINT;
+typedef uint8_t BYTE;
+typedef uint32_t FSIZE_t;
+typedef enum { FR_OK = 0, FR_DISK_ERR, FR_NO_FILE, FR_NO_PATH } FRESULT;
+
+#define FA_READ		1
+#define FA_WRITE	2
+#define FA_CREATE_NEW	4
+#define FA_CREATE_ALWAYS 8
+#define AM_HID		2
+#define AM_DIR		16
+#define SD_NAME_MAX	256
+
+typedef struct {
+  size_t	pos;
+  const uint8_t *data;
+  size_t	size;
+} FIL;
+
+typedef struct {
+  char		path[SD_NAME_MAX];
+  size_t	next;
+} DIR;
+
+typedef struct {
+  char		fname[SD_NAME_MAX];
+  BYTE		fattrib;
+  FSIZE_t	fsize;
+} FILINFO;
+
+typedef struct {} FATFS;
+
+typedef struct {
+  const char	*name;
+  const uint8_t *data;
+  size_t	size;
+} sd_file_t;
+
+struct sd_card_t {
+  const uint8_t *data;
+  size_t	size;
+  bool		present;
+  double	us;		// charged so far
+  double	cmd_us;		// per command
+  double	bytes_per_us;
+  uint32_t	reads;
+  const sd_file_t *files;
+  size_t	nfiles;
+  size_t	written;
+};
+
+static sd_card_t sd_card = {nullptr, 0, true, 0.0, 500.0, 4.0, 0, nullptr, 0, 0};
+
+static inline const sd_file_t *SdFind(const char *name)
+{
+  for (size_t i = 0; i < sd_card.nfiles; i++) {
+    if (strcmp(sd_card.files[i].name, name) == 0) return &sd_card.files[i];
+  }
+  return nullptr;
+}
+
+static inline FRESULT f_open(FIL *fp, const char *name, BYTE mode)
+{
+  const sd_file_t *f;
+
+  if (!sd_card.present) return FR_NO_FILE;
+  fp->pos = 0;
+  fp->data = nullptr;
+  fp->size = 0;
+  if (mode & FA_WRITE) return FR_OK;
+  if (sd_card.files == nullptr) {
+    fp->data = sd_card.data;
+    fp->size = sd_card.size;
+    return FR_OK;
+  }
+  if ((f = SdFind(name)) == nullptr) return FR_NO_FILE;
+  fp->data = f->data;
+  fp->size = f->size;
+  sd_card.us += sd_card.cmd_us;
+  return FR_OK;
+}
+
+static inline FRESULT f_close(FIL *)
+{
+  return FR_OK;
+}
+
+static inline FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+  fp->pos = ofs;
+  sd_card.us += sd_card.cmd_us;
+  return FR_OK;
+}
+
+static inline FSIZE_t f_tell(FIL *fp)
+{
+  return fp->pos;
+}
+
+static inline FRESULT f_read(FIL *fp, void *buf, UINT btr, UINT *br)
+{
+  size_t n = (fp->pos >= fp->size) ? 0 : fp->size - fp->pos;
+  *br = 0;
+  if (!sd_card.present) return FR_DISK_ERR;
+  n = (n < btr) ? n : btr;
+  memcpy(buf, fp->data + fp->pos, n);
+  fp->pos += n;
+  *br = n;
+  sd_card.us += sd_card.cmd_us + (n / sd_card.bytes_per_us);
+  sd_card.reads++;
+  return FR_OK;
+}
+
+static inline FRESULT f_write(FIL *fp, const void *, UINT btw, UINT *bw)
+{
+  if (!sd_card.present) return FR_DISK_ERR;
+  fp->pos += btw;
+  *bw = btw;
+  sd_card.written += btw;
+  sd_card.us += sd_card.cmd_us + (btw / sd_card.bytes_per_us);
+  return FR_OK;
+}
+
+static inline char *f_gets(char *buf, int len, FIL *fp)
+{
+  int n = 0;
+
+  while ((n < (len - 1)) && (fp->pos < fp->size)) {
+    buf[n] = fp->data[fp->pos++];
+    if (buf[n++] == '\n') break;
+  }
+  buf[n] = 0;
+  return (n > 0) ? buf : nullptr;
+}
+
+static inline int f_error(FIL *)
+{
+  return 0;
+}
+
+static inline FRESULT f_stat(const char *name, FILINFO *fno)
+{
+  const sd_file_t *f = SdFind(name);
+  const char *base;
+
+  if (!sd_card.present || (f == nullptr)) return FR_NO_FILE;
+  base = strrchr(name, '/');
+  strcpy(fno->fname, (base != nullptr) ? base + 1 : name);
+  fno->fattrib = 0;
+  fno->fsize = f->size;
+  return FR_OK;
+}
+
+static inline FRESULT f_mount(FATFS *, const char *, BYTE)
+{
+  return sd_card.present ? FR_OK : FR_DISK_ERR;
+}
+
+// what's in path, name if it's directly in there, the directory it's in under path otherwise
+static inline size_t SdEntry(const char *path, const char *name, char *entry)
+{
+  size_t len = strlen(path);
+  const char *rest, *slash;
+
+  if ((strncmp(name, path, len) != 0) || (name[len] != '/')) return 0;
+  rest = name + len + 1;
+  slash = strchr(rest, '/');
+  len = (slash != nullptr) ? (size_t)(slash - rest) : strlen(rest);
+  memcpy(entry, rest, len);
+  entry[len] = 0;
+  return (slash != nullptr) ? AM_DIR : 1;
+}
+
+static inline FRESULT f_opendir(DIR *dir, const char *path)
+{
+  char entry[SD_NAME_MAX];
+
+  if (!sd_card.present) return FR_DISK_ERR;
+  for (size_t i = 0; i < sd_card.nfiles; i++) {
+    if (SdEntry(path, sd_card.files[i].name, entry)) {
+      strcpy(dir->path, path);
+      dir->next = 0;
+      return FR_OK;
+    }
+  }
+  return FR_NO_PATH;
+}
+
+// each directory once, where it first turns up
+static inline FRESULT f_readdir(DIR *dir, FILINFO *fno)
+{
+  char prev[SD_NAME_MAX];
+  size_t kind;
+  bool seen;
+
+  fno->fname[0] = 0;
+  while (dir->next < sd_card.nfiles) {
+    const sd_file_t *f = &sd_card.files[dir->next++];
+    if ((kind = SdEntry(dir->path, f->name, fno->fname)) == 0) continue;
+    fno->fattrib = (kind == AM_DIR) ? AM_DIR : 0;
+    fno->fsize = (kind == AM_DIR) ? 0 : f->size;
+    seen = false;
+    for (size_t i = 0; (i < (dir->next - 1)) && !seen && (kind == AM_DIR); i++) {
+      seen = (SdEntry(dir->path, sd_card.files[i].name, prev) == AM_DIR) && (strcmp(prev, fno->fname) == 0);
+    }
+    if (!seen) return FR_OK;
+  }
+  fno->fname[0] = 0;
+  return FR_OK;
+}
+
+static inline FRESULT f_closedir(DIR *)
+{
+  return FR_OK;
+}
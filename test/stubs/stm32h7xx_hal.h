@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The STM32 CRC unit and RNG that crc_noise.h drives, on the host.
+ * The real CRC mixes each write into what's there, this just has to be random enough and the same every run.
+ */
+#define __HAL_RCC_CRC_CLK_ENABLE()
+#define __RNG_CLK_ENABLE()
+#define __HAL_RNG_ENABLE(x)
+
+typedef struct {
+  void *Instance;
+} RNG_HandleTypeDef;
+
+struct CrcReg {
+  uint32_t v;
+  void operator=(uint32_t x) volatile
+  {
+    uint32_t t = (v ^ x) * 1664525u + 1013904223u;
+    v = t ^ (t >> 15);
+  }
+  operator uint32_t() const volatile
+  {
+    return v;
+  }
+};
+
+typedef struct {
+  volatile uint32_t POL;
+  volatile CrcReg DR;
+} CRC_TypeDef;
+
+inline CRC_TypeDef crc_unit;
+inline CRC_TypeDef *CRC = &crc_unit;
+inline void *RNG = nullptr;
+
+static inline void HAL_RNG_GenerateRandomNumber(RNG_HandleTypeDef *, uint32_t *r)
+{
+  *r = 0x12345678;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// libDaisy's WAV header and file info
+#define WAV_FILENAME_MAX 256
+
+typedef struct {
+  uint32_t ChunkId;
+  uint32_t FileSize;
+  uint32_t FileFormat;
+  uint32_t SubChunk1ID;
+  uint32_t SubChunk1Size;
+  uint16_t AudioFormat;
+  uint16_t NbrChannels;
+  uint32_t SampleRate;
+  uint32_t ByteRate;
+  uint16_t BlockAlign;
+  uint16_t BitPerSample;
+  uint32_t SubChunk2ID;
+  uint32_t SubCHunk2Size;
+} WAV_FormatTypeDef;
+
+typedef struct {
+  WAV_FormatTypeDef raw_data;
+  char name[WAV_FILENAME_MAX];
+} WavFileInfo;
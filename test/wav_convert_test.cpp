@@ -0,0 +1,235 @@
+// WAV loading on the host: the RIFF walk over headers that aren't the canonical 44 bytes, 24 bit and float
+// down to s16, 44.1k up to 48k, then how many frames a second each kind of file converts at.
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+#include "fatfs.h"
+#include "wav_convert.h"
+
+#define OUT_SR		48000.0f
+#define TONE_HZ		1000.0
+#define BENCH_SECS	10
+#define BENCH_REPS	5
+// what LoadChunk() reads at a time
+#define CHUNK_BYTES	8192
+
+static std::vector<uint8_t> file;
+static WavConverter conv;
+static int fails;
+
+static void Put(const void *p, size_t n)
+{
+  file.insert(file.end(), (const uint8_t *)p, (const uint8_t *)p + n);
+}
+
+static void Put32(uint32_t v)
+{
+  Put(&v, 4);
+}
+
+static void Put16(uint16_t v)
+{
+  Put(&v, 2);
+}
+
+// an odd length LIST chunk with its pad byte in front of fmt, extensible if ext, and a fact chunk before data
+static void MakeWav(uint16_t fmt, uint16_t chans, uint16_t bits, uint32_t sr, bool ext, size_t data_bytes)
+{
+  file.clear();
+  Put32(RIFF_ID);
+  Put32(0);
+  Put32(WAVE_ID);
+  Put("LIST", 4);
+  Put32(5);
+  Put("INFOx\0", 6);
+  Put32(FMT_ID);
+  Put32(ext ? 40 : 16);
+  Put16(ext ? WAV_FMT_EXTENSIBLE : fmt);
+  Put16(chans);
+  Put32(sr);
+  Put32(sr * chans * (bits / 8));
+  Put16(chans * (bits / 8));
+  Put16(bits);
+  if (ext) {
+    Put16(22);
+    Put16(bits);
+    Put32(0);
+    // the SubFormat GUID starts with the real format
+    Put16(fmt);
+    Put("\0\0\0\0\x10\0\x80\0\0\xaa\0\x38\x9b\x71", 14);
+  }
+  Put("fact", 4);
+  Put32(4);
+  Put32(0);
+  Put32(DATA_ID);
+  Put32(data_bytes);
+  file.resize(file.size() + data_bytes);
+}
+
+static void Walk()
+{
+  WAV_FormatTypeDef hdr;
+  FIL fp;
+  size_t data_at;
+
+  MakeWav(WAV_FMT_FLOAT, 2, 32, 44100, true, 4000);
+  data_at = file.size() - 4000;
+  sd_card.data = file.data();
+  sd_card.size = file.size();
+  f_open(&fp, "x", FA_READ);
+  if ((ReadWavHeader(&fp, &hdr) != 0) || (hdr.AudioFormat != WAV_FMT_FLOAT) || (hdr.NbrChannels != 2) || \
+      (hdr.BitPerSample != 32) || (hdr.SampleRate != 44100) || (hdr.SubCHunk2Size != 4000) || (f_tell(&fp) != data_at)) {
+    printf("extensible float after LIST and before fact: wrong\n");
+    fails++;
+  }
+
+  MakeWav(WAV_FMT_PCM, 1, 24, 48000, false, 300);
+  data_at = file.size() - 300;
+  sd_card.data = file.data();
+  sd_card.size = file.size();
+  f_open(&fp, "x", FA_READ);
+  if ((ReadWavHeader(&fp, &hdr) != 0) || (hdr.AudioFormat != WAV_FMT_PCM) || (hdr.BitPerSample != 24) || \
+      (f_tell(&fp) != data_at)) {
+    printf("24 bit PCM: wrong\n");
+    fails++;
+  }
+
+  // no fmt before data, and not a RIFF at all
+  file.erase(file.begin() + 26, file.begin() + 50);
+  sd_card.size = file.size();
+  f_open(&fp, "x", FA_READ);
+  if (ReadWavHeader(&fp, &hdr) == 0) {
+    printf("data with no fmt: read\n");
+    fails++;
+  }
+  file[0] = 'X';
+  f_open(&fp, "x", FA_READ);
+  if (ReadWavHeader(&fp, &hdr) == 0) {
+    printf("not a RIFF: read\n");
+    fails++;
+  }
+  printf("RIFF walk %s\n", fails ? "wrong" : "ok");
+}
+
+// worst error against the exact value and the average of it, in s16 LSBs
+static void Depth(const char *what, uint16_t fmt, uint16_t bits, const std::vector<double> &in)
+{
+  std::vector<uint8_t> raw(in.size() * (bits / 8));
+  std::vector<int16_t> out(in.size());
+  double err, worst = 0.0, sum = 0.0, want;
+  size_t n, changed = 0;
+  int32_t v;
+  float f;
+
+  for (size_t i = 0; i < in.size(); i++) {
+    if (fmt == WAV_FMT_FLOAT) {
+      f = (float)in[i];
+      memcpy(&raw[i * 4], &f, 4);
+    } else {
+      v = (int32_t)lrint(fmax(-8388608.0, fmin(in[i] * 8388608.0, 8388607.0)));
+      memcpy(&raw[i * 3], &v, 3);
+    }
+  }
+  conv.Init(fmt, 1, bits, (uint32_t)OUT_SR, OUT_SR, 1);
+  n = conv.Process(raw.data(), in.size(), out.data(), out.size());
+  for (size_t i = 0; i < n; i++) {
+    want = fmax(-32768.0, fmin(32767.0, in[i] * 32768.0));
+    err = out[i] - want;
+    worst = fmax(worst, fabs(err));
+    sum += err;
+    if (out[i] != lrint(want)) changed++;
+  }
+  printf("%s: %zu frames, worst %.2f LSB, mean %+.3f LSB, %zu dithered off the nearest\n", what, n, worst, \
+      sum / n, changed);
+  // TPDF is +/- 1 LSB on top of the rounding, and it has to be there
+  if ((n != in.size()) || (worst > 1.5) || (fabs(sum / n) > 0.05) || (changed == 0)) fails++;
+}
+
+static void Resample()
+{
+  const size_t in_frames = 44100;
+  std::vector<int16_t> raw(in_frames), out(conv.OutFrames(in_frames));
+  double err, sig = 0.0, noise = 0.0, snr;
+  size_t n, expect = (size_t)((in_frames * OUT_SR) / 44100.0);
+
+  for (size_t i = 0; i < in_frames; i++) {
+    raw[i] = (int16_t)lrint(16384.0 * sin(2.0 * M_PI * TONE_HZ * i / 44100.0));
+  }
+  conv.Init(WAV_FMT_PCM, 1, 16, 44100, OUT_SR, 1);
+  out.resize(conv.OutFrames(in_frames));
+  n = conv.Process((const uint8_t *)raw.data(), in_frames, out.data(), out.size());
+  n += conv.Flush(&out[n], out.size() - n);
+  // the first output is centred on the first input, leave the filter's edges out
+  for (size_t k = RS_TAPS; k < (expect - RS_TAPS); k++) {
+    err = out[k] - 16384.0 * sin(2.0 * M_PI * TONE_HZ * k / OUT_SR);
+    sig += 16384.0 * 16384.0 * 0.5;
+    noise += err * err;
+  }
+  snr = 10.0 * log10(sig / noise);
+  printf("44.1k to 48k: %zu frames in, %zu out (%zu expected), 1kHz tone %.1fdB SNR\n", in_frames, n, expect, snr);
+  if ((n < expect) || (n > (expect + RS_TAPS)) || (snr < 70.0)) fails++;
+}
+
+// LoadChunk()'s way, a chunk at a time, best of a few
+static double Bench(uint16_t fmt, uint16_t chans, uint16_t bits, uint32_t sr)
+{
+  size_t frames = BENCH_SECS * sr;
+  size_t frame_bytes = chans * (bits / 8);
+  size_t chunk = CHUNK_BYTES / frame_bytes;
+  std::vector<uint8_t> raw(frames * frame_bytes);
+  std::vector<int16_t> out;
+  double best = 1e18, secs;
+  size_t len;
+
+  for (size_t i = 0; i < raw.size(); i++) {
+    raw[i] = (uint8_t)(i * 2654435761u >> 24);
+  }
+  if (fmt == WAV_FMT_FLOAT) {
+    for (size_t i = 0; i < (frames * chans); i++) {
+      float f = sinf(i * 0.01f);
+      memcpy(&raw[i * 4], &f, 4);
+    }
+  }
+  for (int r = 0; r < BENCH_REPS; r++) {
+    conv.Init(fmt, chans, bits, sr, OUT_SR, (chans > 1) ? 2 : 1);
+    out.resize(conv.OutFrames(frames) * conv.OutChans());
+    len = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t f = 0; f < frames; f += chunk) {
+      size_t n = ((frames - f) < chunk) ? (frames - f) : chunk;
+      len += conv.Process(&raw[f * frame_bytes], n, &out[len * conv.OutChans()], conv.OutFrames(frames) - len);
+    }
+    len += conv.Flush(&out[len * conv.OutChans()], conv.OutFrames(frames) - len);
+    secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    best = fmin(best, secs);
+  }
+  return frames / best;
+}
+
+int main()
+{
+  std::vector<double> in;
+
+  Walk();
+
+  // a slow ramp over the whole range and past it, so every fraction of an LSB comes up
+  for (size_t i = 0; i < 100000; i++) {
+    in.push_back(-1.2 + (2.4 * i) / 100000.0);
+  }
+  Depth("24 bit", WAV_FMT_PCM, 24, in);
+  Depth("32 bit float", WAV_FMT_FLOAT, 32, in);
+
+  Resample();
+
+  printf("on this host, frames/s converted a %d byte chunk at a time:\n", CHUNK_BYTES);
+  printf("  s16 stereo 48k (copied):  %6.1fM\n", Bench(WAV_FMT_PCM, 2, 16, 48000) / 1e6);
+  printf("  8 bit mono 48k:           %6.1fM\n", Bench(WAV_FMT_PCM, 1, 8, 48000) / 1e6);
+  printf("  24 bit stereo 48k:        %6.1fM\n", Bench(WAV_FMT_PCM, 2, 24, 48000) / 1e6);
+  printf("  32f stereo 48k:           %6.1fM\n", Bench(WAV_FMT_FLOAT, 2, 32, 48000) / 1e6);
+  printf("  s16 stereo 44.1k to 48k:  %6.1fM\n", Bench(WAV_FMT_PCM, 2, 16, 44100) / 1e6);
+  printf("  24 bit stereo 96k to 48k: %6.1fM\n", Bench(WAV_FMT_PCM, 2, 24, 96000) / 1e6);
+
+  printf("%s\n", fails ? "FAIL" : "PASS");
+  return fails ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// MIDI beats in a Song Position Pointer are 16th notes
+#define SPP_PER_BEAT 4
+
+/*
+ * Where the sequencer is, in beats, counted from MIDI clock ticks rather than integrated from the tempo
+ * so it can't drift. Start and Song Position Pointer set it, every clock tick moves it on one.
+ * The main loop timestamps each tick with the audio frame count and the callback fills in the fraction
+ * of a tick since then from the tempo, so the phase it sees moves every block, not every tick.
+ */
+class Transport
+{
+  public:
+    Transport() {}
+    ~Transport() {}
+
+    void Init(float sr, int ppqn)
+    {
+      sr_ = sr;
+      ppqn_ = ppqn;
+      frames_ = tick_frame_ = 0;
+      seq_ = 0;
+      running_ = false;
+      SetBPM(120.0f);
+      Set(-1);
+    }
+
+    // Main loop, from the MIDI handler
+    // the first tick after a Start is the downbeat
+    void Start()
+    {
+      Set(-1);
+      running_ = true;
+    }
+
+    void Stop()
+    {
+      running_ = false;
+    }
+
+    void Continue()
+    {
+      running_ = true;
+    }
+
+    // the next tick lands on 16th note spp
+    void SongPosition(uint16_t spp)
+    {
+      Set(((int32_t)spp * (ppqn_ / SPP_PER_BEAT)) - 1);
+    }
+
+    void Tick()
+    {
+      Set(ticks_ + 1);
+    }
+
+    void SetBPM(float bpm)
+    {
+      if (bpm > 0.0f) frames_per_tick_ = (sr_ * 60.0f) / (bpm * ppqn_);
+    }
+
+    // Audio callback only, once per block
+    void Advance(size_t frames)
+    {
+      frames_ += frames;
+    }
+
+    // Audio callback only
+    // false until the first tick after a Start, while stopped, or if a tick is being written right now
+    bool Beats(double *beats)
+    {
+      uint32_t seq = seq_;
+      if ((seq & 1) || !running_) return false;
+      int32_t ticks = ticks_;
+      float frac = (frames_ - tick_frame_) / frames_per_tick_;
+      if (seq != seq_) return false;
+      if (ticks < 0) return false;
+      // don't run past the next tick if it's late
+      frac = (frac < 1.0f) ? frac : 1.0f;
+      *beats = (ticks + frac) / ppqn_;
+      return true;
+    }
+
+  private:
+    void Set(int32_t ticks)
+    {
+      seq_++;
+      ticks_ = ticks;
+      tick_frame_ = frames_;
+      seq_++;
+    }
+
+    float sr_, frames_per_tick_;
+    int ppqn_;
+    volatile int32_t ticks_;
+    volatile uint32_t frames_, tick_frame_, seq_;
+    volatile bool running_;
+};
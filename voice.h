@@ -0,0 +1,308 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include "phasor.h"
+
+#define MAX_VOICES 8
+// gate envelope on each voice's grains, linear
+#define VOICE_ATTACK_SECS 0.005f
+#define VOICE_RELEASE_SECS 0.25f
+// a taken voice's grains fade out over this rather than stop dead
+#define VOICE_STEAL_SECS 0.005f
+#define NO_NOTE 0xff
+#define NO_VOICE 0xff
+// the pool's owner for grains still playing out after their voice has gone
+#define ORPHANS MAX_VOICES
+#define NO_GRAIN -1
+
+// per note expression, from MPE member channels, in the same order as MidiMsgHandler's ExprType
+enum expr_dim {
+  EXPR_BEND,	  // semitones
+  EXPR_PRESSURE,  // 0 to 1
+  EXPR_SLIDE,	  // 0 to 1
+  EXPR_DIMS
+};
+#define EXPR_CHANNELS 16
+#define EXPR_SMOOTH_SECS 0.01f
+// full pressure makes grains this many times as dense, full slide scatters them over this much of the wave
+#define EXPR_DENSITY 4.0f
+#define EXPR_SCATTER 0.1f
+
+/*
+ * One held note in poly mode, with its own pitch, scan head and gate envelope.
+ * The granulator does the dispatching, a voice just says when its next grain is due.
+ */
+class Voice
+{
+  public:
+    Voice() {}
+    ~Voice() {}
+
+    void Init(float sr)
+    {
+      attack_ = 1.0f / (VOICE_ATTACK_SECS * sr);
+      release_ = 1.0f / (VOICE_RELEASE_SECS * sr);
+      level_ = 0.0f;
+      note_ = NO_NOTE;
+      member_ = 0;
+      bend_ = 1.0f;
+      for (size_t d = 0; d < EXPR_DIMS; d++) {
+	expr_[d] = 0.0f;
+      }
+      state_ = IDLE;
+    }
+
+    // scan is the granulator's scan head, the voice takes a copy of its settings and starts from the top
+    // expr is its channel's expression, which it starts at rather than sliding up to
+    void Start(uint8_t note, float pitch, uint8_t member, const ScanPhasor *scan, const volatile float *expr, uint32_t age)
+    {
+      note_ = note;
+      pitch_ = pitch;
+      member_ = member;
+      age_ = age;
+      for (size_t d = 0; d < EXPR_DIMS; d++) {
+	expr_[d] = expr[d];
+      }
+      bend_ = exp2f(expr_[EXPR_BEND] / 12.0f);
+      scan_ = *scan;
+      scan_.Reset();
+      density_count_ = -1;
+      state_ = ATTACK;
+    }
+
+    void Release()
+    {
+      if (state_ != IDLE) state_ = RELEASE;
+    }
+
+    // false once it's faded right out
+    inline bool Process()
+    {
+      switch (state_) {
+	case ATTACK:
+	  level_ += attack_;
+	  if (level_ >= 1.0f) {
+	    level_ = 1.0f;
+	    state_ = HOLD;
+	  }
+	  break;
+	case RELEASE:
+	  level_ -= release_;
+	  if (level_ <= 0.0f) {
+	    level_ = 0.0f;
+	    state_ = IDLE;
+	    note_ = NO_NOTE;
+	    return false;
+	  }
+	  break;
+	default:
+	  break;
+      }
+      return true;
+    }
+
+    // once a block, coef is how far to go towards expr
+    void Express(const volatile float *expr, float coef)
+    {
+      for (size_t d = 0; d < EXPR_DIMS; d++) {
+	expr_[d] += coef * (expr[d] - expr_[d]);
+      }
+      bend_ = exp2f(expr_[EXPR_BEND] / 12.0f);
+    }
+
+    // counts down to the next grain, call once a sample
+    inline bool Due()
+    {
+      return density_count_-- < 0;
+    }
+
+    inline void Wait(int32_t frames)
+    {
+      density_count_ = frames;
+    }
+
+    inline ScanPhasor *Scan()
+    {
+      return &scan_;
+    }
+
+    inline bool Active()
+    {
+      return state_ != IDLE;
+    }
+
+    inline bool Held()
+    {
+      return (state_ == ATTACK) || (state_ == HOLD);
+    }
+
+    inline float Level()
+    {
+      return level_;
+    }
+
+    // bent
+    inline float Pitch()
+    {
+      return pitch_ * bend_;
+    }
+
+    inline float Pressure()
+    {
+      return expr_[EXPR_PRESSURE];
+    }
+
+    inline float Slide()
+    {
+      return expr_[EXPR_SLIDE];
+    }
+
+    inline uint8_t Note()
+    {
+      return note_;
+    }
+
+    inline uint8_t Member()
+    {
+      return member_;
+    }
+
+    inline uint32_t Age()
+    {
+      return age_;
+    }
+
+  private:
+    enum voice_state {
+      IDLE,
+      ATTACK,
+      HOLD,
+      RELEASE
+    };
+
+    ScanPhasor scan_;
+    voice_state state_;
+    float level_, attack_, release_, pitch_, bend_;
+    float expr_[EXPR_DIMS];
+    int32_t density_count_;
+    uint32_t age_;
+    uint8_t note_, member_;
+};
+
+/*
+ * Which voice owns which grain, shared between all of them.
+ * Free grains are a stack and each voice's grains are a list in the order they started,
+ * so taking, giving back and finding a voice's oldest grain are all O(1) however many voices there are.
+ * Grains still playing out when their voice goes belong to ORPHANS, nobody takes those, they're
+ * released like any other once they're done.
+ */
+template <size_t N>
+class GrainPool
+{
+  public:
+    GrainPool() {}
+    ~GrainPool() {}
+
+    // busy[g] for the ones still playing, they're ORPHANS rather than free
+    void Init(const bool *busy)
+    {
+      free_ = NO_GRAIN;
+      for (size_t v = 0; v <= ORPHANS; v++) {
+	head_[v] = tail_[v] = NO_GRAIN;
+	count_[v] = 0;
+      }
+      for (int g = N - 1; g >= 0; g--) {
+	if (busy[g]) {
+	  Link(g, ORPHANS);
+	} else {
+	  Free(g);
+	}
+      }
+    }
+
+    // NO_GRAIN if they're all in use
+    int Alloc(uint8_t voice)
+    {
+      int g = free_;
+      if (g != NO_GRAIN) {
+	free_ = next_[g];
+	Link(g, voice);
+      }
+      return g;
+    }
+
+    void Release(int g)
+    {
+      Unlink(g);
+      Free(g);
+    }
+
+    // hand the grain over to voice, it becomes voice's newest
+    void Move(int g, uint8_t voice)
+    {
+      Unlink(g);
+      Link(g, voice);
+    }
+
+    inline int Oldest(uint8_t voice)
+    {
+      return head_[voice];
+    }
+
+    // NO_VOICE if it's free
+    inline uint8_t Owner(int g)
+    {
+      return owner_[g];
+    }
+
+    inline uint8_t Count(uint8_t voice)
+    {
+      return count_[voice];
+    }
+
+  private:
+    void Free(int g)
+    {
+      owner_[g] = NO_VOICE;
+      next_[g] = free_;
+      free_ = g;
+    }
+
+    void Link(int g, uint8_t voice)
+    {
+      owner_[g] = voice;
+      prev_[g] = tail_[voice];
+      next_[g] = NO_GRAIN;
+      if (tail_[voice] != NO_GRAIN) {
+	next_[tail_[voice]] = g;
+      } else {
+	head_[voice] = g;
+      }
+      tail_[voice] = g;
+      count_[voice]++;
+    }
+
+    void Unlink(int g)
+    {
+      uint8_t voice = owner_[g];
+      if (prev_[g] != NO_GRAIN) {
+	next_[prev_[g]] = next_[g];
+      } else {
+	head_[voice] = next_[g];
+      }
+      if (next_[g] != NO_GRAIN) {
+	prev_[next_[g]] = prev_[g];
+      } else {
+	tail_[voice] = prev_[g];
+      }
+      count_[voice]--;
+      owner_[g] = NO_VOICE;
+    }
+
+    int8_t next_[N], prev_[N];
+    uint8_t owner_[N];
+    int8_t head_[ORPHANS + 1], tail_[ORPHANS + 1];
+    uint8_t count_[ORPHANS + 1];
+    int8_t free_;
+};
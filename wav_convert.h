@@ -0,0 +1,381 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "fatfs.h"
+#include "util/wav_format.h"
+
+// AudioFormat tags from the fmt chunk that we know how to deal with
+#define WAV_FMT_PCM	    1
+#define WAV_FMT_FLOAT	    3
+#define WAV_FMT_EXTENSIBLE  0xFFFE
+
+#define MAX_CONV_CHANS	2
+
+// RIFF chunk ids as they appear little endian in the file
+#define RIFF_ID	0x46464952 // "RIFF"
+#define WAVE_ID	0x45564157 // "WAVE"
+#define FMT_ID	0x20746d66 // "fmt "
+#define DATA_ID	0x61746164 // "data"
+
+// Polyphase windowed sinc resampler
+// RS_PHASES sub filters of RS_TAPS taps, coefficients are linearly interpolated between phases
+// so any rate ratio works, not just the nice ones
+#define RS_PHASE_BITS	6
+#define RS_PHASES	(1 << RS_PHASE_BITS)
+#define RS_TAPS		16
+// frames decoded per block
+#define RS_BLOCK	256
+// 32.32 fixed point read position
+#define RS_FRAC_BITS	32
+
+/*
+ * Converts raw WAV data of (almost) any PCM or float flavour to s16 at the codec rate.
+ * Data is fed in whole frames as it's read off the SD card so the whole file never needs
+ * to sit in memory in its original format.
+ */
+class WavConverter
+{
+  public:
+    WavConverter() {}
+    ~WavConverter() {}
+
+    // Returns false if we can't deal with the source format
+    bool Init(uint16_t fmt, uint16_t chans, uint16_t bits, uint32_t in_sr, float out_sr, uint8_t out_chans)
+    {
+      if (fmt == WAV_FMT_PCM) {
+	if ((bits != 8) && (bits != 16) && (bits != 24) && (bits != 32)) return false;
+      } else if (fmt == WAV_FMT_FLOAT) {
+	if (bits != 32) return false;
+      } else {
+	return false;
+      }
+      if ((chans == 0) || (in_sr == 0)) return false;
+
+      fmt_ = fmt;
+      chans_ = chans;
+      bytes_ = bits / 8;
+      frame_bytes_ = chans_ * bytes_;
+      out_chans_ = (out_chans > MAX_CONV_CHANS) ? MAX_CONV_CHANS : ((out_chans < 1) ? 1 : out_chans);
+
+      resample_ = ((float)in_sr != out_sr);
+      passthru_ = !resample_ && (fmt_ == WAV_FMT_PCM) && (bytes_ == 2) && (chans_ == out_chans_);
+      // only what's deeper than s16 is dithered, the rest just rounds
+      dither_ = (bytes_ > 2);
+
+      step_ = (uint64_t)(((double)in_sr / out_sr) * ((uint64_t)1 << RS_FRAC_BITS));
+      if (resample_ && (step_ != last_step_)) {
+	MakeCoefs((float)in_sr, out_sr);
+	last_step_ = step_;
+      }
+
+      // prime the history so the first output is centred on the first input frame
+      memset(hist_, 0, sizeof(hist_));
+      fill_ = resample_ ? (RS_TAPS / 2) - 1 : 0;
+      pos_ = 0;
+      rng_ = 0x2545F491;
+      return true;
+    }
+
+    size_t FrameBytes()
+    {
+      return frame_bytes_;
+    }
+
+    uint8_t OutChans()
+    {
+      return out_chans_;
+    }
+
+    // the data on the card is already exactly what we'd write to SDRAM
+    bool IsPassthru()
+    {
+      return passthru_;
+    }
+
+    // Upper bound on the number of frames produced from in_frames of input
+    size_t OutFrames(size_t in_frames)
+    {
+      if (!resample_) return in_frames;
+      return (size_t)((((uint64_t)in_frames + RS_TAPS) << RS_FRAC_BITS) / step_) + 1;
+    }
+
+    // Most input frames that are guaranteed to produce no more than out_frames
+    size_t InFrames(size_t out_frames)
+    {
+      if (!resample_) return out_frames;
+      uint64_t in = ((uint64_t)(out_frames - 1) * step_) >> RS_FRAC_BITS;
+      return (in > (RS_TAPS + 1)) ? (size_t)(in - RS_TAPS) : 1;
+    }
+
+    // in holds frames whole frames of raw wav data
+    // returns the number of frames written to out
+    // decoded frames that don't fit in max_out are kept for the next call or Flush(), out has to have room for
+    // OutFrames(frames) to be sure none of in is left undecoded
+    size_t Process(const uint8_t *in, size_t frames, int16_t *out, size_t max_out)
+    {
+      size_t written;
+      size_t n;
+
+      if (passthru_) {
+	n = (frames > max_out) ? max_out : frames;
+	memcpy((void *)out, (const void *)in, n * frame_bytes_);
+	return n;
+      }
+
+      // what was held back last time goes first
+      written = Drain(out, max_out);
+      while (frames > 0) {
+	n = (frames > RS_BLOCK) ? RS_BLOCK : frames;
+	// out's full and there's no room left to hold another block
+	if ((fill_ + n) > (RS_TAPS + RS_BLOCK)) break;
+	Decode(in, n);
+	in += n * frame_bytes_;
+	frames -= n;
+	written += Drain(&out[written * out_chans_], max_out - written);
+      }
+      return written;
+    }
+
+    // Push the tail of the resampler out once the last of the data has been fed in, and anything held back
+    size_t Flush(int16_t *out, size_t max_out)
+    {
+      if (!resample_) return Quantize(out, max_out);
+      for (size_t ch = 0; ch < out_chans_; ch++) {
+	memset(&hist_[ch][fill_], 0, (RS_TAPS / 2) * sizeof(float));
+      }
+      fill_ += RS_TAPS / 2;
+      return Resample(out, max_out);
+    }
+
+  private:
+
+    void MakeCoefs(float in_sr, float out_sr)
+    {
+      // cutoff relative to the input nyquist, pulled in a little for the transition band
+      float fc = ((out_sr < in_sr) ? (out_sr / in_sr) : 1.0f) * 0.95f;
+      float half = RS_TAPS / 2.0f;
+      float sum, t, x, w;
+
+      for (size_t p = 0; p <= RS_PHASES; p++) {
+	sum = 0.0f;
+	for (size_t k = 0; k < RS_TAPS; k++) {
+	  t = ((float)k - ((RS_TAPS / 2) - 1)) - ((float)p / RS_PHASES);
+	  x = M_PI * fc * t;
+	  // blackman window
+	  w = 0.42f + 0.5f * cosf(M_PI * t / half) + 0.08f * cosf(2.0f * M_PI * t / half);
+	  coefs_[p][k] = ((t == 0.0f) ? 1.0f : sinf(x) / x) * w;
+	  sum += coefs_[p][k];
+	}
+	// unity gain at DC for every phase
+	for (size_t k = 0; k < RS_TAPS; k++) {
+	  coefs_[p][k] /= sum;
+	}
+      }
+    }
+
+    // one switch per block rather than per sample
+    void Decode(const uint8_t *in, size_t n)
+    {
+      switch(bytes_)
+      {
+	case 1:
+	  DecodeAs<1, false>(in, n);
+	  break;
+	case 2:
+	  DecodeAs<2, false>(in, n);
+	  break;
+	case 3:
+	  DecodeAs<3, false>(in, n);
+	  break;
+	case 4:
+	  if (fmt_ == WAV_FMT_FLOAT) {
+	    DecodeAs<4, true>(in, n);
+	  } else {
+	    DecodeAs<4, false>(in, n);
+	  }
+	  break;
+	default:
+	  break;
+      }
+      fill_ += n;
+    }
+
+    template <int B, bool F>
+    inline float ReadSample(const uint8_t *p)
+    {
+      switch(B)
+      {
+	case 1:
+	  return (p[0] - 128) * (1.0f / 128.0f);
+	case 2:
+	  return (int16_t)(p[0] | (p[1] << 8)) * (1.0f / 32768.0f);
+	case 3:
+	  return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) * (1.0f / 2147483648.0f);
+	case 4:
+	  if (F) {
+	    float f;
+	    memcpy(&f, p, sizeof(float));
+	    return f;
+	  }
+	  return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)) * (1.0f / 2147483648.0f);
+	default:
+	  return 0.0f;
+      }
+    }
+
+    // mono sources are duplicated, anything with more than 2 channels only keeps the first two
+    template <int B, bool F>
+    void DecodeAs(const uint8_t *in, size_t n)
+    {
+      float *l = &hist_[0][fill_];
+      float *r = &hist_[1][fill_];
+      float s0, s1;
+
+      for (size_t i = 0; i < n; i++) {
+	s0 = ReadSample<B, F>(in);
+	s1 = (chans_ > 1) ? ReadSample<B, F>(in + B) : s0;
+	if (out_chans_ == 1) {
+	  l[i] = 0.5f * (s0 + s1);
+	} else {
+	  l[i] = s0;
+	  r[i] = s1;
+	}
+	in += frame_bytes_;
+      }
+    }
+
+    inline size_t Drain(int16_t *out, size_t max_out)
+    {
+      return resample_ ? Resample(out, max_out) : Quantize(out, max_out);
+    }
+
+    // whatever doesn't fit in max_out stays at the front of the history for next time
+    size_t Quantize(int16_t *out, size_t max_out)
+    {
+      size_t n = (fill_ > max_out) ? max_out : fill_;
+      for (size_t i = 0; i < n; i++) {
+	for (size_t ch = 0; ch < out_chans_; ch++) {
+	  *out++ = Round(hist_[ch][i]);
+	}
+      }
+      fill_ -= n;
+      if (fill_ > 0) {
+	for (size_t ch = 0; ch < out_chans_; ch++) {
+	  memmove(&hist_[ch][0], &hist_[ch][n], fill_ * sizeof(float));
+	}
+      }
+      return n;
+    }
+
+    size_t Resample(int16_t *out, size_t max_out)
+    {
+      size_t n = 0;
+      size_t idx, keep;
+      uint32_t frac, ph;
+      float pf, acc;
+      float c[RS_TAPS];
+      const float *c0, *c1, *x;
+
+      while ((((idx = (size_t)(pos_ >> RS_FRAC_BITS)) + RS_TAPS) <= fill_) && (n < max_out)) {
+	frac = (uint32_t)pos_;
+	ph = frac >> (RS_FRAC_BITS - RS_PHASE_BITS);
+	pf = (frac & ((1u << (RS_FRAC_BITS - RS_PHASE_BITS)) - 1)) * (1.0f / (1u << (RS_FRAC_BITS - RS_PHASE_BITS)));
+	c0 = coefs_[ph];
+	c1 = coefs_[ph + 1];
+	// blend the two nearest phases once, then share across channels
+	for (size_t k = 0; k < RS_TAPS; k++) {
+	  c[k] = c0[k] + pf * (c1[k] - c0[k]);
+	}
+	for (size_t ch = 0; ch < out_chans_; ch++) {
+	  x = &hist_[ch][idx];
+	  acc = 0.0f;
+	  for (size_t k = 0; k < RS_TAPS; k++) {
+	    acc += x[k] * c[k];
+	  }
+	  out[(n * out_chans_) + ch] = Round(acc);
+	}
+	n++;
+	pos_ += step_;
+      }
+
+      // slide what's left of the history back to the start
+      idx = (size_t)(pos_ >> RS_FRAC_BITS);
+      if (idx > fill_) idx = fill_;
+      keep = fill_ - idx;
+      for (size_t ch = 0; ch < out_chans_; ch++) {
+	memmove(&hist_[ch][0], &hist_[ch][idx], keep * sizeof(float));
+      }
+      fill_ = keep;
+      pos_ -= (uint64_t)idx << RS_FRAC_BITS;
+      return n;
+    }
+
+    // TPDF dither, +/- 1 LSB, for sources deeper than s16, otherwise just rounded
+    // scaled by 32768 so s16 that's only folded or copied comes out as it went in
+    inline int16_t Round(float in)
+    {
+      float v = in * 32768.0f;
+      if (dither_) v += Rand() - Rand();
+      v = fminf(32767.0f, fmaxf(-32768.0f, v));
+      return (int16_t)((v < 0.0f) ? (v - 0.5f) : (v + 0.5f));
+    }
+
+    // xorshift32 - the crc_noise generator belongs to the audio thread
+    inline float Rand()
+    {
+      rng_ ^= rng_ << 13;
+      rng_ ^= rng_ >> 17;
+      rng_ ^= rng_ << 5;
+      return rng_ * (1.0f / 4294967296.0f);
+    }
+
+    float coefs_[RS_PHASES + 1][RS_TAPS];
+    float hist_[MAX_CONV_CHANS][RS_TAPS + RS_BLOCK];
+    uint64_t pos_, step_, last_step_ = 0;
+    size_t fill_, frame_bytes_;
+    uint32_t rng_;
+    uint16_t fmt_, chans_, bytes_;
+    uint8_t out_chans_;
+    bool resample_, passthru_, dither_;
+};
+
+// Walk the RIFF chunks to find fmt and data rather than assuming a canonical 44 byte header
+// Leaves the file positioned at the start of the sample data
+inline int ReadWavHeader(FIL *fp, WAV_FormatTypeDef *hdr)
+{
+  uint32_t chunk[2];
+  uint16_t ext[5];
+  size_t bytesread, skip;
+  bool got_fmt = false;
+
+  if ((f_read(fp, (void *)&hdr->ChunkId, 12, &bytesread) != FR_OK) || (bytesread != 12)) return -1;
+  if ((hdr->ChunkId != RIFF_ID) || (hdr->FileFormat != WAVE_ID)) return -1;
+
+  for(;;) {
+    if ((f_read(fp, (void *)chunk, sizeof(chunk), &bytesread) != FR_OK) || (bytesread != sizeof(chunk))) return -1;
+    skip = chunk[1] + (chunk[1] & 1); // chunks are padded to an even length
+    if (chunk[0] == FMT_ID) {
+      if (chunk[1] < 16) return -1;
+      // AudioFormat through BitPerSample is laid out exactly as the fmt chunk
+      hdr->SubChunk1ID = chunk[0];
+      hdr->SubChunk1Size = chunk[1];
+      if (f_read(fp, (void *)&hdr->AudioFormat, 16, &bytesread) != FR_OK) return -1;
+      skip -= 16;
+      // WAVE_FORMAT_EXTENSIBLE keeps the real format at the start of the SubFormat GUID
+      if ((hdr->AudioFormat == WAV_FMT_EXTENSIBLE) && (chunk[1] >= 26)) {
+	if (f_read(fp, (void *)ext, sizeof(ext), &bytesread) != FR_OK) return -1;
+	hdr->AudioFormat = ext[4];
+	skip -= sizeof(ext);
+      }
+      got_fmt = true;
+    } else if (chunk[0] == DATA_ID) {
+      if (!got_fmt) return -1;
+      hdr->SubChunk2ID = chunk[0];
+      hdr->SubCHunk2Size = chunk[1];
+      return 0;
+    }
+    if (f_lseek(fp, f_tell(fp) + skip) != FR_OK) return -1;
+  }
+}
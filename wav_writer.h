@@ -0,0 +1,307 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "fatfs.h"
+
+// header is padded out with a JUNK chunk so the sample data starts on a sector boundary
+// and every f_write after it is whole sectors
+#define REC_HDR_BYTES	    512
+#define REC_CHANS	    2
+#define REC_FRAME_BYTES	    (REC_CHANS * sizeof(int16_t))
+
+/*
+ * Records stereo s16 to a new WAV on the SD card without ever blocking the audio callback.
+ * The callback only copies frames into one half of a staging buffer in SDRAM,
+ * the main loop writes the other half out with big sequential f_writes, then they swap.
+ * The header sizes are patched in once the last of the data is down.
+ * Save writes out something that's already sitting in SDRAM, like a bounce, a write buffer's worth
+ * each Service() so it never holds up the main loop for more than one f_write.
+ */
+class WavRecorder
+{
+  public:
+    WavRecorder() {}
+    ~WavRecorder() {}
+
+    enum rec_state {
+      IDLE,
+      RUNNING,
+      DONE, // callback has finished, main loop still has to flush and close
+      SAVING // Save() is going, nothing to do with the callback
+    };
+
+    // stage holds 2 * half_frames of stereo
+    // writes go out through wbuf like every other SD access
+    void Init(int16_t *stage, size_t half_frames, char *wbuf, size_t wbuf_bytes)
+    {
+      stage_ = stage;
+      half_frames_ = half_frames;
+      wbuf_ = wbuf;
+      wbuf_bytes_ = wbuf_bytes - (wbuf_bytes % REC_FRAME_BYTES);
+      state_ = IDLE;
+      high_water_ = overruns_ = 0;
+      bytes_ = 0;
+      failed_ = false;
+    }
+
+    // Main loop only - opens name and starts recording frames at the next callback
+    bool Start(const char *name, size_t frames, uint32_t sr)
+    {
+      size_t byteswritten;
+
+      if ((state_ != IDLE) || (frames == 0)) return false;
+      if (f_open(&fp_, name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) return false;
+      sr_ = sr;
+      chans_ = REC_CHANS;
+      MakeHeader(0);
+      if ((f_write(&fp_, wbuf_, REC_HDR_BYTES, &byteswritten) != FR_OK) || (byteswritten != REC_HDR_BYTES)) {
+	f_close(&fp_);
+	return false;
+      }
+
+      count_[0] = count_[1] = 0;
+      half_ = flush_half_ = 0;
+      fill_ = 0;
+      recorded_ = flushed_ = 0;
+      target_ = frames;
+      high_water_ = overruns_ = 0;
+      dropping_ = false;
+      bytes_ = 0;
+      state_ = RUNNING;
+      return true;
+    }
+
+    // Main loop only - finish at the end of the current multiple of quant frames
+    void Stop(size_t quant)
+    {
+      if (state_ != RUNNING) return;
+      size_t next = ((recorded_ / quant) + 1) * quant;
+      if (next < target_) target_ = next;
+    }
+
+    // Audio callback only
+    inline void Write(int16_t l, int16_t r)
+    {
+      if (state_ != RUNNING) return;
+      // the main loop hasn't got this half down yet, drop frames rather than write over it
+      // so an overrun is a gap in the file, counted once however long it goes on
+      if (count_[half_] != 0) {
+	if (!dropping_) overruns_++;
+	dropping_ = true;
+	return;
+      }
+      dropping_ = false;
+
+      int16_t *frame = &stage_[((half_ * half_frames_) + fill_) * REC_CHANS];
+      frame[0] = l;
+      frame[1] = r;
+      fill_++;
+      recorded_++;
+      if ((fill_ == half_frames_) || (recorded_ >= target_)) {
+	count_[half_] = fill_;
+	half_ ^= 1;
+	fill_ = 0;
+	if (recorded_ >= target_) state_ = DONE;
+      }
+    }
+
+    // Main loop only - call often
+    // returns the number of bytes written to the card
+    size_t Service()
+    {
+      size_t written = 0;
+      size_t pending, n;
+
+      if (state_ == IDLE) return 0;
+      if (state_ == SAVING) return SavePiece();
+
+      pending = recorded_ - flushed_;
+      if (pending > high_water_) high_water_ = pending;
+
+      while (count_[flush_half_] != 0) {
+	n = count_[flush_half_];
+	// Stop can land a little behind the callback, don't let those frames through
+	if ((flushed_ + n) > target_) n = target_ - flushed_;
+	written += Flush(&stage_[flush_half_ * half_frames_ * REC_CHANS], n);
+	flushed_ += n;
+	count_[flush_half_] = 0;
+	flush_half_ ^= 1;
+      }
+
+      if ((state_ == DONE) && (count_[0] == 0) && (count_[1] == 0)) {
+	Finish();
+      }
+      return written;
+    }
+
+    // Main loop only, starts writing src (stereo) out, Service() does the rest
+    // chans = 1 mixes it down to mono on the way out, src has to stay put until IsRecording() goes false
+    bool Save(const char *name, const int16_t *src, size_t frames, uint32_t sr, uint8_t chans)
+    {
+      size_t byteswritten;
+
+      if (state_ != IDLE) return false;
+      if (f_open(&fp_, name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) return false;
+      sr_ = sr;
+      chans_ = chans;
+      bytes_ = 0;
+      MakeHeader(0);
+      if (f_write(&fp_, wbuf_, REC_HDR_BYTES, &byteswritten) != FR_OK) {
+	f_close(&fp_);
+	return false;
+      }
+      save_src_ = src;
+      save_left_ = frames;
+      failed_ = false;
+      state_ = SAVING;
+      return true;
+    }
+
+    // Main loop only, a save stops where it's got to, what's there is still a proper WAV
+    void Cancel()
+    {
+      if (state_ != SAVING) return;
+      failed_ = true;
+      Finish();
+    }
+
+    bool IsRecording()
+    {
+      return state_ != IDLE;
+    }
+
+    bool IsSaving()
+    {
+      return state_ == SAVING;
+    }
+
+    // the last Save() didn't get all of it down
+    bool Failed()
+    {
+      return failed_;
+    }
+
+    // most frames that were ever waiting to go to the card
+    size_t HighWater()
+    {
+      return high_water_;
+    }
+
+    // gaps where the callback dropped frames because the main loop was too slow getting them down
+    uint32_t Overruns()
+    {
+      return overruns_;
+    }
+
+    size_t BytesWritten()
+    {
+      return bytes_;
+    }
+
+  private:
+    size_t SavePiece()
+    {
+      size_t byteswritten, bytes;
+      size_t n = wbuf_bytes_ / REC_FRAME_BYTES;
+      uint8_t *out = (uint8_t *)wbuf_;
+
+      n = (save_left_ < n) ? save_left_ : n;
+      if (chans_ == 1) {
+	for (size_t i = 0; i < n; i++) {
+	  int16_t m = (save_src_[2 * i] + save_src_[(2 * i) + 1]) >> 1;
+	  memcpy(out + (i * sizeof(int16_t)), &m, sizeof(int16_t));
+	}
+      } else {
+	memcpy(out, save_src_, n * REC_FRAME_BYTES);
+      }
+      bytes = n * chans_ * sizeof(int16_t);
+      if ((f_write(&fp_, wbuf_, bytes, &byteswritten) != FR_OK) || (byteswritten != bytes)) {
+	failed_ = true;
+	Finish();
+	return 0;
+      }
+      bytes_ += byteswritten;
+      save_src_ += n * REC_CHANS;
+      save_left_ -= n;
+      if (save_left_ == 0) Finish();
+      return byteswritten;
+    }
+
+    size_t Flush(const int16_t *src, size_t frames)
+    {
+      const uint8_t *p = (const uint8_t *)src;
+      size_t left = frames * REC_FRAME_BYTES;
+      size_t n, byteswritten;
+      size_t written = 0;
+
+      while (left > 0) {
+	n = (left < wbuf_bytes_) ? left : wbuf_bytes_;
+	memcpy(wbuf_, p, n);
+	if ((f_write(&fp_, wbuf_, n, &byteswritten) != FR_OK) || (byteswritten != n)) break;
+	p += n;
+	left -= n;
+	written += n;
+      }
+      bytes_ += written;
+      return written;
+    }
+
+    void Finish()
+    {
+      size_t byteswritten;
+      MakeHeader(bytes_);
+      if (f_lseek(&fp_, 0) == FR_OK) {
+	f_write(&fp_, wbuf_, REC_HDR_BYTES, &byteswritten);
+      }
+      f_close(&fp_);
+      state_ = IDLE;
+    }
+
+    inline void Put32(uint8_t *p, uint32_t v)
+    {
+      memcpy(p, &v, sizeof(v));
+    }
+
+    inline void Put16(uint8_t *p, uint16_t v)
+    {
+      memcpy(p, &v, sizeof(v));
+    }
+
+    // RIFF, fmt, JUNK padding then the data chunk header, all in REC_HDR_BYTES
+    void MakeHeader(size_t data_bytes)
+    {
+      uint8_t *h = (uint8_t *)wbuf_;
+      memset(h, 0, REC_HDR_BYTES);
+      memcpy(h, "RIFF", 4);
+      Put32(h + 4, (REC_HDR_BYTES - 8) + data_bytes);
+      memcpy(h + 8, "WAVEfmt ", 8);
+      Put32(h + 16, 16);
+      Put16(h + 20, 1); // PCM
+      Put16(h + 22, chans_);
+      Put32(h + 24, sr_);
+      Put32(h + 28, sr_ * chans_ * sizeof(int16_t));
+      Put16(h + 32, chans_ * sizeof(int16_t));
+      Put16(h + 34, 16);
+      memcpy(h + 36, "JUNK", 4);
+      Put32(h + 40, REC_HDR_BYTES - 52);
+      memcpy(h + REC_HDR_BYTES - 8, "data", 4);
+      Put32(h + REC_HDR_BYTES - 4, data_bytes);
+    }
+
+    FIL fp_;
+    int16_t *stage_;
+    const int16_t *save_src_;
+    size_t save_left_;
+    char *wbuf_;
+    size_t half_frames_, wbuf_bytes_, high_water_, bytes_;
+    volatile size_t count_[2];
+    volatile size_t recorded_, target_;
+    size_t fill_, flushed_;
+    uint32_t sr_;
+    uint8_t chans_;
+    bool failed_, dropping_;
+    volatile uint32_t overruns_;
+    volatile rec_state state_;
+    uint8_t half_, flush_half_;
+};